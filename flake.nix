@@ -40,6 +40,7 @@
           [
             pkgs.cudatoolkit
             pkgs.openmpi
+            pkgs.zlib
             pkgs.clang-tools
             pkgs.llvmPackages.openmp
             pkgs.simgrid
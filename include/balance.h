@@ -0,0 +1,37 @@
+#pragma once
+
+#include "dc_process.h"
+#include "partition.h"
+#include <mpi.h>
+
+// Compute imbalance (slowest rank over the mean) tolerated before planes move
+#define DC_REBALANCE_THRESHOLD 1.10
+
+// Runtime load balancing state. Every `rebalance_interval` iterations the
+// ranks compare the time they spent computing, and when the slowest rank is
+// too far above the mean the slabs are resized to the measured throughput.
+typedef struct {
+  int num_ranks;
+  double compute_seconds;
+  double window_start_time;
+  unsigned int window_start;
+  // Imbalance that triggered the last migration, 0 once its effect is logged
+  double previous_imbalance;
+  // Every rank's ghost-inclusive box as {start x, y, z, size x, y, z}
+  unsigned long (*boxes)[2 * DIMENSIONS];
+  dc_partition_t target;
+} dc_balance_t;
+
+void dc_balance_init(dc_balance_t *balance, MPI_Comm comm);
+void dc_balance_free(dc_balance_t *balance);
+
+// Close the measurement window ending before `iteration`. Returns 1 when the
+// ranks agreed on a new partition, in which case the caller releases its halo
+// exchange and device data and calls dc_balance_migrate.
+int dc_balance_check(dc_balance_t *balance, dc_process_t *process,
+                     MPI_Comm comm, unsigned int iteration);
+
+// Move the fields and the model data to the new partition, updating the local
+// sizes, start coordinates and source index
+void dc_balance_migrate(dc_balance_t *balance, dc_process_t *process,
+                        MPI_Comm comm);
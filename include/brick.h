@@ -0,0 +1,53 @@
+#pragma once
+
+#include "definitions.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bricked layout: the local box is tiled by DC_BRICK^3 cubes, each stored
+// contiguously (x fastest inside a brick) and laid out brick by brick in the
+// same x, y, z order as cells in the flat layout. Bricks past the end of an
+// axis are padded and their extra cells are never read.
+#define DC_BRICK 8
+#define DC_BRICK_CELLS (DC_BRICK * DC_BRICK * DC_BRICK)
+// A brick and the apron of STENCIL cells its stencil reads around it
+#define DC_BRICK_TILE (DC_BRICK + 2 * STENCIL)
+#define DC_BRICK_TILE_CELLS (DC_BRICK_TILE * DC_BRICK_TILE * DC_BRICK_TILE)
+
+static inline void dc_brick_counts(const size_t sizes[DIMENSIONS],
+                                   size_t bricks[DIMENSIONS]) {
+  for (int i = 0; i < DIMENSIONS; i++)
+    bricks[i] = (sizes[i] + DC_BRICK - 1) / DC_BRICK;
+}
+
+// Floats held by an array in the bricked layout, padding included
+static inline size_t dc_brick_storage(const size_t bricks[DIMENSIONS]) {
+  return bricks[0] * bricks[1] * bricks[2] * DC_BRICK_CELLS;
+}
+
+static inline size_t dc_brick_index(size_t x, size_t y, size_t z,
+                                    const size_t bricks[DIMENSIONS]) {
+  size_t brick =
+      (z / DC_BRICK * bricks[1] + y / DC_BRICK) * bricks[0] + x / DC_BRICK;
+  return brick * DC_BRICK_CELLS +
+         (z % DC_BRICK * DC_BRICK + y % DC_BRICK) * DC_BRICK + x % DC_BRICK;
+}
+
+// Copy the [starts, ends) region of a bricked array to or from `buffer`,
+// where the region's cell (x, y, z) sits at x + y * row + z * plane relative
+// to its first cell. Rows are moved in runs that stay inside one brick.
+void dc_brick_pack(const float *bricked, const size_t bricks[DIMENSIONS],
+                   const size_t starts[DIMENSIONS],
+                   const size_t ends[DIMENSIONS], float *buffer, size_t row,
+                   size_t plane);
+void dc_brick_unpack(float *bricked, const size_t bricks[DIMENSIONS],
+                     const size_t starts[DIMENSIONS],
+                     const size_t ends[DIMENSIONS], const float *buffer,
+                     size_t row, size_t plane);
+
+#ifdef __cplusplus
+}
+#endif
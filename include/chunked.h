@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "codec.h"
+#include "definitions.h"
+
+// Chunked output: a header describing the run, the fields cut into chunks of
+// up to chunk[0] x chunk[1] x chunk[2] cells (smaller at the high ends of
+// the grid), each stored x fastest and optionally compressed on its own, and
+// an index of where every chunk lives. Readers decode only the chunks a box
+// touches.
+#define DC_CHUNKED_MAGIC "DCCHUNK"
+#define DC_CHUNKED_VERSION 1
+#define DC_CHUNKED_FIELDS 2
+#define DC_CHUNKED_DEFAULT_CHUNK 32
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t fields;
+  char field_names[DC_CHUNKED_FIELDS][8];
+  // Padded global grid, and the cells of padding (ghosts and absorbing zone)
+  // around the problem on every side
+  uint64_t sizes[DIMENSIONS];
+  uint64_t padding;
+  uint64_t chunk[DIMENSIONS];
+  float dx, dy, dz, dt;
+  // Iterations run when the fields were written
+  uint64_t iteration;
+  // A dc_codec_t; the size in a chunk's index entry tells whether it was
+  // actually compressed
+  uint32_t codec;
+  // Cell order within a chunk; 0, x fastest, is the only one
+  uint32_t layout;
+  // Byte offset of the index: per field, per chunk in x fastest chunk
+  // order, a dc_chunk_entry_t
+  uint64_t index_offset;
+} dc_chunked_header_t;
+
+typedef struct {
+  uint64_t offset;
+  uint64_t bytes;
+} dc_chunk_entry_t;
+
+typedef struct {
+  FILE *file;
+  dc_chunked_header_t header;
+  uint64_t chunks[DIMENSIONS];
+  dc_chunk_entry_t *index;
+  int level;
+} dc_chunked_t;
+
+// Number of chunks along each axis
+void dc_chunked_counts(const dc_chunked_header_t *header,
+                       uint64_t chunks[DIMENSIONS]);
+
+// Create `path` for the header's fields; `level` is the zlib level with
+// DC_CODEC_DEFLATE. Returns 0 on failure.
+int dc_chunked_create(dc_chunked_t *chunked, const char *path,
+                      const dc_chunked_header_t *header, int level);
+
+// Store chunk `c` (x fastest chunk order) of `field`, whose cells are x
+// fastest in `cells`; not thread safe. Returns 0 on failure.
+int dc_chunked_write(dc_chunked_t *chunked, int field, uint64_t c,
+                     const float *cells);
+
+// Write the index and close. Returns 0 on failure.
+int dc_chunked_finish(dc_chunked_t *chunked);
+
+// Open `path` and read its header and index. Returns 0 when it is missing
+// or not a chunked output file.
+int dc_chunked_open(dc_chunked_t *chunked, const char *path);
+
+// Read the cells from `lo` up to, excluding, `hi` of `field` into `cells`, x
+// fastest, decoding only the chunks the box touches. Returns 0 on failure.
+int dc_chunked_read_box(dc_chunked_t *chunked, int field,
+                        const uint64_t lo[DIMENSIONS],
+                        const uint64_t hi[DIMENSIONS], float *cells);
+
+void dc_chunked_close(dc_chunked_t *chunked);
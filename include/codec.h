@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+
+typedef enum {
+  DC_CODEC_NONE = 0,
+  // Bytes of the floats grouped by significance, then zlib; a block that
+  // would not shrink is stored as is, which its stored size tells
+  DC_CODEC_DEFLATE,
+} dc_codec_t;
+
+// Bytes dc_codec_encode may need for `count` floats
+size_t dc_codec_bound(size_t count);
+
+// Store `count` floats with `codec` at zlib `level` into `stored`, which
+// holds dc_codec_bound(count) bytes. Returns the bytes stored.
+size_t dc_codec_encode(dc_codec_t codec, int level, const float *cells,
+                       size_t count, unsigned char *stored);
+
+// Recover `count` floats from `bytes` stored ones; `scratch` holds
+// count * sizeof(float) bytes. Returns 0 on corrupt data.
+int dc_codec_decode(const unsigned char *stored, size_t bytes, size_t count,
+                    float *cells, unsigned char *scratch);
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "dc_process.h"
+#include "partition.h"
+#include "rank_file.h"
+#include "region.h"
 #include <mpi.h>
 #include <stdlib.h>
 
@@ -16,24 +19,71 @@ typedef struct {
   float dt;
   float time_max;
   size_t absorption_size;
+  int sponge;
   char *output_file;
+  int per_rank_output;
+  int chunked_output;
+  size_t output_chunk;
+  int output_compression;
+  // Cells to output instead of the padded grid, when region_output is set;
+  // output_plane_axis is 1 + the axis of a single plane to keep, or 0
+  int region_output;
+  dc_region_t output_region;
+  int output_plane_axis;
+  size_t output_plane;
+  // Ranks set apart as I/O servers (see io_server.h), and iterations
+  // between snapshots (see snapshot.h), 0 for none
+  int io_servers;
+  unsigned int snapshot_interval;
+  dc_halo_mode_t halo_mode;
+  dc_decomposition_t decomposition;
+  dc_layout_t layout;
+  int uniform_tiles;
+  dc_physics_t physics;
+  unsigned int temporal_steps;
+  int mpi_dims;
+  char *host_weights;
+  char *model_cache;
+  size_t materials;
+  int calibrate;
+  unsigned int rebalance_interval;
+  double rebalance_threshold;
 } dc_arguments_t;
 
-typedef struct {
-  size_t local_sizes[DIMENSIONS];
-  size_t global_sizes[DIMENSIONS];
-  size_t start_coords[DIMENSIONS];
-  size_t problem_sizes[DIMENSIONS];
-  unsigned int iterations;
-  int source_index;
-  size_t absorption_size;
-} dc_partition_info_t;
-
 void dc_determine_source(size_t size_x, size_t size_y, size_t size_z,
                          size_t *source_x, size_t *source_y, size_t *source_z);
 
-void dc_distribute_partition_info(MPI_Comm comm, unsigned int *topology,
-                                  dc_arguments_t arguments, size_t num_workers);
+// Local index of the source for a rank whose ghost-inclusive box starts at
+// `start_coords`, or -1 when the box does not hold it
+ptrdiff_t dc_local_source_index(const size_t global_sizes[DIMENSIONS],
+                                const size_t local_sizes[DIMENSIONS],
+                                const size_t start_coords[DIMENSIONS]);
+
+// MPI counts are ints, so whole-rank arrays travel in chunks of this many
+// floats
+#define DC_MPI_CHUNK ((size_t)1 << 30)
+
+void dc_send_floats(const float *data, size_t count, int destination,
+                    MPI_Comm comm);
+void dc_receive_floats(float *data, size_t count, int source, MPI_Comm comm);
+
+// Fill `header` with the record of the cells this rank owns after
+// `iteration` iterations (see rank_file.h) and, unless `fields` is NULL, pack
+// their p and then q into it. Returns the cells per field.
+size_t dc_rank_pack(const dc_process_t *process, uint64_t iteration,
+                    dc_rank_header_t *header, float *fields);
+
+// Write the cells this rank owns to its own file of the per-rank output set
+// of `output_file`, deflated at zlib `level` when it is not 0
+void dc_write_rank_results(const dc_process_t *process,
+                           const char *output_file, uint64_t iteration,
+                           int level);
+
+// Collective: write the fields in the chunked format (see chunked.h), the
+// coordinator gathering one layer of chunks at a time from the ranks holding
+// it and compressing them when `arguments` ask for it
+void dc_gather_and_write_chunked(const dc_process_t *process, MPI_Comm comm,
+                                 const dc_arguments_t *arguments);
 
 void dc_receive_and_write_results(dc_process_t coordinator_process,
                                   MPI_Comm comm, size_t global_sx,
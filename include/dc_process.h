@@ -2,20 +2,122 @@
 
 #include "definitions.h"
 #include "precomp.h"
+#include "stencil.h"
 #include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+  // Every neighbour region read by the stencil is exchanged directly
+  DC_HALO_NEIGHBOURHOOD = 0,
+  // x, then y, then z faces only; edges and corners travel through the
+  // ghosts received in the earlier phases
+  DC_HALO_STAGED,
+  // Neighbourhood exchange where ranks on the same node copy each other's
+  // boundaries straight out of a shared-memory window
+  DC_HALO_SHARED,
+  // Neighbourhood exchange where boundaries are written straight into the
+  // neighbours' ghost cells with MPI_Put inside post-start-complete-wait
+  // epochs
+  DC_HALO_RMA,
+  // One message per rank whose box touches ours, built from the list of
+  // every rank's box; the only mode for non-Cartesian decompositions
+  DC_HALO_LIST,
+} dc_halo_mode_t;
+
+typedef enum {
+  // Slabs along each axis of a Cartesian process grid
+  DC_DECOMPOSITION_CARTESIAN = 0,
+  // Recursive coordinate bisection: near-cubic boxes for any rank count,
+  // with irregular neighbours
+  DC_DECOMPOSITION_BISECTION,
+} dc_decomposition_t;
+
+typedef enum {
+  // x-fastest rows, planes and slabs over the whole local box
+  DC_LAYOUT_FLAT = 0,
+  // Contiguous DC_BRICK^3 bricks (see brick.h), propagated brick by brick
+  DC_LAYOUT_BRICKED,
+  // Flat, with the p and q of every cell side by side (see
+  // sample_compute_pq.h)
+  DC_LAYOUT_INTERLEAVED,
+} dc_layout_t;
+
+struct dc_io_client;
+
+typedef struct {
+  size_t messages_sent;
+  size_t messages_received;
+  size_t bytes_sent;
+  size_t bytes_received;
+  size_t bytes_shared;
+  double seconds;
+} dc_halo_stats_t;
 
 typedef struct {
   int rank;
   int coordinates[DIMENSIONS];
   int neighbours[NEIGHBOURHOOD];
+  dc_stencil_footprint_t footprint;
+  dc_halo_mode_t halo_mode;
+  dc_decomposition_t decomposition;
+  // Layout of the arrays the kernels work on; the process arrays stay flat
+  dc_layout_t layout;
+  // Whether the OpenMP kernels give DC_BRICK^3 tiles whose cells share one
+  // coefficient tuple a kernel taking it as scalars (see device_data.h)
+  int uniform_tiles;
+  // Operator the kernels evaluate (see physics.h); AUTO, before
+  // dc_physics_select has run, evaluates TTI
+  dc_physics_t physics;
+  // Iterations advanced per wavefront pass over the box (see temporal.h), 1
+  // for one sweep per iteration
+  unsigned int temporal_steps;
+  // Iterations between load balance checks (0 disables them) and the compute
+  // imbalance that makes planes migrate
+  unsigned int rebalance_interval;
+  double rebalance_threshold;
+  // Iterations between snapshots of the fields (see snapshot.h), 0 for
+  // none; they go to an I/O server through io_client when there is one, and
+  // to this rank's file of <output_file>.<iteration> otherwise, deflated at
+  // zlib level output_compression when it is not 0
+  unsigned int snapshot_interval;
+  struct dc_io_client *io_client;
+  const char *output_file;
+  int output_compression;
+  // Snapshots taken and the seconds they held this rank up
+  unsigned int snapshots;
+  double snapshot_seconds;
+  // Neighbours whose halos are read from node shared memory instead of sent
+  unsigned char shared_neighbours[NEIGHBOURHOOD];
   int topology[DIMENSIONS];
   unsigned int iterations;
-  int source_index;
+  // Local index of the source, or -1 when this rank's box does not hold it
+  ptrdiff_t source_index;
   float dx, dy, dz, dt;
   size_t sizes[DIMENSIONS];
+  // Padded global position of local cell (0, 0, 0)
+  size_t start_coords[DIMENSIONS];
+  // Padded global box, and the width of the sponge in its absorbing band
+  // (see sponge.h), 0 when the band has random velocities, with the velocity
+  // its damping is scaled by
+  size_t global_sizes[DIMENSIONS];
+  size_t sponge_width;
+  float sponge_speed;
   dc_anisotropy_t anisotropy_vars;
   dc_precomp_vars precomp_vars;
+  // With a quantized model (see materials.h), precomp_vars and
+  // anisotropy_vars are freed and each cell's coefficients are entry
+  // material_ids[cell] of the material_count long columns of materials;
+  // material_ids is NULL otherwise
+  dc_precomp_vars materials;
+  size_t material_count;
+  uint16_t *material_ids;
+  // Read-only file mapping backing the model arrays when they came from the
+  // model cache, NULL when they were allocated
+  void *model_mapping;
+  size_t model_mapping_size;
   float *pp, *pc, *qp, *qc;
-  char *hostnames;
+  // Position among the ranks sharing this node, for device selection
+  int node_rank, node_size;
   size_t num_workers;
+  dc_halo_stats_t halo_stats;
 } dc_process_t;
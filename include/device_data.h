@@ -11,15 +11,47 @@ extern "C" {
 typedef struct {
   float *pp, *pc, *qp, *qc;
   float *vpz, *vsv;
+  // Per-cell coefficients, or the material table indexed by material_ids
   dc_precomp_vars precomp_vars;
+  const uint16_t *material_ids;
+  dc_layout_t layout;
+  dc_physics_t physics;
+  size_t sizes[DIMENSIONS];
+  // Bricks per axis in the bricked layout, which also tile the other layouts
+  size_t bricks[DIMENSIONS];
+  // With uniform tiles, the coefficient index shared by the computed cells of
+  // each tile, in brick order, or DC_TILE_VARYING; NULL otherwise
+  size_t *tile_coefficients;
+  // With a sponge boundary, the damping factors along each axis and the range
+  // of local indices where they are 1 (see sponge.h); NULL otherwise
+  float *damping[DIMENSIONS];
+  size_t undamped[DIMENSIONS][2];
 } dc_device_data;
 
+#define DC_TILE_VARYING SIZE_MAX
+
 dc_device_data *dc_device_data_init(dc_process_t *process);
 
 void dc_device_data_free(dc_device_data *data);
 
+// Whether the field arrays in dc_device_data are plain flat host memory that
+// MPI can access in place
+int dc_device_fields_on_host(const dc_process_t *process);
+
+// Whether the kernels can take their coefficients from a material table
+int dc_device_material_tables(void);
+
+// Whether the kernels can apply a sponge boundary
+int dc_device_sponge(void);
+
+// Copy the fields into the flat process arrays, allocating them for layouts
+// that free them while the kernels run
 void dc_device_data_get_results(dc_process_t *process, dc_device_data *data);
 
+// Free what dc_device_data_get_results allocated, once the results are read
+void dc_device_data_release_results(dc_process_t *process,
+                                    dc_device_data *data);
+
 void dc_device_swap_arrays(dc_device_data *data);
 
 void dc_device_add_source(dc_device_data *data, size_t index, float source);
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "dc_process.h"
+#include "device_data.h"
+#include "worker.h"
+#include <mpi.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Staged exchange state for the axis currently in flight: one receive and one
+// send per face neighbour along that axis
+typedef struct {
+  int axis;
+  size_t count;
+  MPI_Request requests[2 * 2];
+  float *buffers[2 * 2];
+  MPI_Datatype types[2 * 2];
+  size_t starts[2 * 2][DIMENSIONS];
+  size_t ends[2 * 2][DIMENSIONS];
+  int is_receive[2 * 2];
+} dc_staged_phase_t;
+
+// Shared-memory state: this rank's pp, pc, qp and qc live back to back in a
+// window shared with the other ranks of its node
+typedef struct {
+  MPI_Comm node_comm;
+  MPI_Win window;
+  float *fields;
+  float *neighbour_fields[NEIGHBOURHOOD];
+  size_t neighbour_sizes[NEIGHBOURHOOD][DIMENSIONS];
+  unsigned int iteration;
+} dc_shared_halos_t;
+
+// One-sided state: the fields live in an RMA window, and each exchanged
+// neighbour has a pair of datatypes mapping our boundary cells onto its
+// ghost cells, for pp and qp at once
+typedef struct {
+  MPI_Win window;
+  MPI_Group group;
+  float *fields;
+  size_t neighbour_counts[NEIGHBOURHOOD];
+  MPI_Datatype origin_types[NEIGHBOURHOOD];
+  MPI_Datatype target_types[NEIGHBOURHOOD];
+  size_t region_sizes[NEIGHBOURHOOD];
+  unsigned int iteration;
+} dc_rma_halos_t;
+
+// One rank whose box touches ours. Regions are local [start, end) corners,
+// one per stencil direction the footprint reads; the buffers hold the pp
+// cells of each region followed by its qp cells.
+typedef struct {
+  int rank;
+  size_t send_count, receive_count;
+  size_t send_regions[NEIGHBOURHOOD][2 * DIMENSIONS];
+  size_t receive_regions[NEIGHBOURHOOD][2 * DIMENSIONS];
+  size_t send_cells, receive_cells;
+  float *send_buffer, *receive_buffer;
+} dc_list_neighbour_t;
+
+// List-based state, rebuilt from every rank's box whenever the boxes change
+typedef struct {
+  size_t count;
+  dc_list_neighbour_t *neighbours;
+  MPI_Request *requests;
+  int request_count;
+} dc_list_halos_t;
+
+typedef struct {
+  dc_halo_mode_t mode;
+  worker_halos_t halos;
+  worker_requests_t send_requests;
+  dc_staged_phase_t phase;
+  dc_shared_halos_t shared;
+  dc_rma_halos_t rma;
+  dc_list_halos_t list;
+} dc_halo_exchange_t;
+
+const char *dc_halo_mode_name(dc_halo_mode_t mode);
+int dc_halo_mode_parse(const char *name, dc_halo_mode_t *mode);
+
+// Must run before dc_device_data_init, as some modes move the process fields
+// into MPI-allocated memory; dc_halo_exchange_free moves them back.
+void dc_halo_exchange_init(dc_halo_exchange_t *exchange, dc_process_t *process,
+                           MPI_Comm comm);
+void dc_halo_exchange_free(dc_halo_exchange_t *exchange,
+                           dc_process_t *process);
+
+// The exchange of one iteration's pp/qp halos is split around the
+// computation: post before the boundaries are computed, start once they are,
+// and finish after the interior, right before the arrays are swapped.
+void dc_halo_exchange_post(dc_halo_exchange_t *exchange, dc_process_t *process,
+                           MPI_Comm comm, dc_device_data *data);
+void dc_halo_exchange_start(dc_halo_exchange_t *exchange,
+                            dc_process_t *process, MPI_Comm comm,
+                            dc_device_data *data);
+void dc_halo_exchange_finish(dc_halo_exchange_t *exchange,
+                             dc_process_t *process, MPI_Comm comm,
+                             dc_device_data *data);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <mpi.h>
+
+#include "coordinator.h"
+#include "dc_process.h"
+#include "rank_file.h"
+
+// I/O servers: the last ranks of MPI_COMM_WORLD take no part in the
+// computation. Compute rank c hands its snapshots and final fields to server
+// c % servers with nonblocking sends and carries on; a server appends the
+// records it receives, deflated when asked, to one file per set, so a set of
+// C compute ranks lands in <output>.0 ... <output>.<servers - 1> (snapshots
+// in <output>.<iteration>.0 ...), which dc-merge reads like per-rank output
+// (see rank_file.h).
+#define DC_IO_SNAPSHOT_TAG 21
+#define DC_IO_FINAL_TAG 22
+#define DC_IO_DONE_TAG 23
+#define DC_IO_DATA_TAG 24
+
+typedef struct dc_io_client {
+  // Duplicate of MPI_COMM_WORLD the records travel over, and the world rank
+  // of our server
+  MPI_Comm comm;
+  int server;
+  // Records alternate between two buffers, so packing one only waits for the
+  // sends of the one before it
+  dc_rank_header_t headers[2];
+  float *buffers[2];
+  size_t capacities[2];
+  MPI_Request *requests[2];
+  int pending[2];
+  int current;
+  // Seconds spent waiting for earlier records to leave
+  double waiting;
+} dc_io_client_t;
+
+// Collective over MPI_COMM_WORLD: set the last `servers` ranks apart. Every
+// rank gets the communicator records travel over in *io; compute ranks get
+// the communicator they compute over in *compute. Returns whether the
+// calling rank is a server.
+int dc_io_split(int servers, MPI_Comm *compute, MPI_Comm *io);
+
+// Receive and write records until every compute rank this server collects
+// from is done
+void dc_io_server_run(MPI_Comm io, int servers,
+                      const dc_arguments_t *arguments);
+
+void dc_io_client_init(dc_io_client_t *client, MPI_Comm io, int servers);
+
+// Post the record of the cells this rank owns after `iteration` iterations,
+// a snapshot or the final fields; the process arrays may change as soon as
+// this returns
+void dc_io_client_send(dc_io_client_t *client, const dc_process_t *process,
+                       uint64_t iteration, int final);
+
+// Wait for the records in flight and tell the server this rank is done
+void dc_io_client_finish(dc_io_client_t *client);
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "dc_process.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest table a 16-bit material ID can index
+#define DC_MAX_MATERIALS 65536
+
+// Replace the process's per-cell coefficient arrays with a table of at most
+// `max_materials` coefficient tuples and a material ID per cell. Tuples are
+// deduplicated exactly when few enough are distinct, and otherwise
+// quantized on a uniform grid per coefficient, as fine as the table size
+// allows, each entry being the mean of its cells. The quantization error is
+// logged. The per-cell model is freed afterwards.
+void dc_materials_build(dc_process_t *process, size_t max_materials);
+
+void dc_materials_free(dc_process_t *process);
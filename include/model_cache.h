@@ -0,0 +1,40 @@
+#pragma once
+
+#include "dc_process.h"
+#include "definitions.h"
+#include <stddef.h>
+
+// Bumped whenever the synthetic model or the boundary randomization changes,
+// so stale cache files are never reused
+#define DC_MODEL_VERSION 2
+
+// Everything that determines one rank's model and coefficient arrays
+typedef struct {
+  size_t problem_sizes[DIMENSIONS];
+  size_t absorption_size;
+  // Nonzero with a sponge, which leaves the band's velocities alone
+  size_t sponge_width;
+  size_t start_coords[DIMENSIONS];
+  size_t sizes[DIMENSIONS];
+} dc_model_key_t;
+
+// Map the anisotropy and precomputed arrays of `key` from `directory`.
+// Returns 0 when no valid cache file exists, leaving the process untouched.
+int dc_model_cache_load(dc_process_t *process, const char *directory,
+                        const dc_model_key_t *key);
+
+// Write the process's model arrays for `key`; later runs map them read-only,
+// and ranks of a node mapping the same directory share the page cache
+void dc_model_cache_store(const dc_process_t *process, const char *directory,
+                          const dc_model_key_t *key);
+
+// Free or unmap the anisotropy and precomputed arrays
+void dc_model_free(dc_process_t *process);
+
+// Give back the precomputed arrays while the kernels read their own copy:
+// computed ones are freed, mapped ones lose their pages, which fault back in
+// from the cache file if read again
+void dc_model_release_precomp(dc_process_t *process);
+
+// Recompute the precomputed arrays if dc_model_release_precomp freed them
+void dc_model_restore_precomp(dc_process_t *process);
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "definitions.h"
+#include <stddef.h>
+
+// Partition of the computed cells (the padded grid minus its STENCIL ghosts).
+// Cartesian partitions are slabs along each axis, which may differ in size;
+// every rank sharing a coordinate along an axis shares that slab. Bisection
+// partitions give every rank its own box instead, over a 1D process grid.
+typedef struct {
+  int topology[DIMENSIONS];
+  // Computed cells of the slab at each coordinate, and where that slab
+  // starts inside the computed region
+  size_t *extents[DIMENSIONS];
+  size_t *starts[DIMENSIONS];
+  // Bisection only: {start x, y, z, extent x, y, z} of every rank's computed
+  // cells, in the same coordinates as `starts`
+  size_t (*boxes)[2 * DIMENSIONS];
+} dc_partition_t;
+
+// `weights` holds the relative throughput of every rank in row-major order
+// of its Cartesian coordinates (the Cartesian rank order), or NULL for
+// equal ranks. Slabs are sized in proportion to the summed throughput of the
+// ranks in them, and leftover cells are handed out one at a time.
+dc_partition_t dc_partition_create(const int topology[DIMENSIONS],
+                                   const size_t global_sizes[DIMENSIONS],
+                                   const double *weights);
+
+// Recursive coordinate bisection: the longest axis is cut in proportion to
+// the weights of the two halves of the rank range until every rank has a box.
+// Consecutive ranks end up in neighbouring boxes.
+dc_partition_t dc_partition_bisect(int num_ranks,
+                                   const size_t global_sizes[DIMENSIONS],
+                                   const double *weights);
+void dc_partition_free(dc_partition_t *partition);
+
+// Local array sizes (ghosts included) of the rank at `coordinates`, and the
+// padded global position of its first local cell
+void dc_partition_local(const dc_partition_t *partition,
+                        const int coordinates[DIMENSIONS],
+                        size_t local_sizes[DIMENSIONS],
+                        size_t start_coords[DIMENSIONS]);
+
+// Log the slab widths along every axis and the predicted ratio between the
+// slowest and fastest rank's iteration time
+void dc_partition_log(int rank, const dc_partition_t *partition,
+                      const double *weights);
+
+// Cells a rank hands out when migrating or filling deep halos: its computed
+// box, extended over the outer ghosts where it touches the edge of the grid.
+// These tile the padded grid, so every cell of any box has exactly one owner.
+// `box` is ghost-inclusive, as {start x, y, z, size x, y, z}.
+void dc_owned_region(const unsigned long box[2 * DIMENSIONS],
+                  const size_t global_sizes[DIMENSIONS], size_t lo[DIMENSIONS],
+                  size_t hi[DIMENSIONS]);
+
+// Intersection [lo, hi) of [a_lo, a_hi) with the box `b`, and its cell count,
+// 0 when they do not meet
+size_t dc_box_overlap(const size_t a_lo[DIMENSIONS],
+                      const size_t a_hi[DIMENSIONS],
+                      const unsigned long b[2 * DIMENSIONS],
+                      size_t lo[DIMENSIONS], size_t hi[DIMENSIONS]);
+
+// Weight of ranks on `hostname` in a "host=weight,host=weight" list, or 1
+// when the host is not listed. Returns 0 on a malformed list.
+int dc_parse_host_weight(const char *list, const char *hostname,
+                         double *weight);
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "dc_process.h"
+#include "precomp.h"
+#include <mpi.h>
+
+const char *dc_physics_name(dc_physics_t physics);
+int dc_physics_parse(const char *name, dc_physics_t *physics);
+
+// Axis combinations the kernel for `physics` reads; AUTO, whose kernel is
+// only known once the model is, gets the TTI footprint
+dc_stencil_footprint_t dc_physics_footprint(dc_physics_t physics);
+
+// Fewest terms this rank's model needs: isotropic when v2px = v2pn = v2pz
+// everywhere, VTI when every cell is untilted (ch1dzz = 1, the other ch1d* 0),
+// TTI otherwise. The material table is checked instead when there is one.
+dc_physics_t dc_physics_detect(const dc_process_t *process);
+
+// Set the process's kernel to `requested`, or with AUTO to the most general
+// one any rank's model needs, so every rank runs the same operator. Logs the
+// choice, and when a requested kernel drops terms the model has. Narrows the
+// halo footprint to the kernel's, so call it before setting up the exchange.
+void dc_physics_select(dc_process_t *process, dc_physics_t requested,
+                       MPI_Comm comm);
@@ -1,8 +1,21 @@
 #pragma once
 
+#include <stddef.h>
+
 #define SIGMA 0.75
 #define MAX_SIGMA 10.0
 
+// Terms of the TTI operator a kernel evaluates, from fewest to most; AUTO
+// picks the fewest the model needs (see physics.h)
+typedef enum {
+  DC_PHYSICS_AUTO = 0,
+  // epsilon = delta = 0: p = q and the acoustic Laplacian
+  DC_PHYSICS_ISOTROPIC,
+  // theta = 0: no cross derivatives
+  DC_PHYSICS_VTI,
+  DC_PHYSICS_TTI,
+} dc_physics_t;
+
 typedef struct {
   float *ch1dxx;
   float *ch1dyy;
@@ -16,6 +29,21 @@ typedef struct {
   float *v2pn;
 } dc_precomp_vars;
 
+// One cell's coefficients, passed by value where a whole tile shares them
+typedef struct {
+  float ch1dxx, ch1dyy, ch1dzz, ch1dxy, ch1dyz, ch1dxz;
+  float v2px, v2pz, v2sz, v2pn;
+} dc_coefficients_t;
+
+static inline dc_coefficients_t dc_precomp_at(const dc_precomp_vars *vars,
+                                              size_t m) {
+  dc_coefficients_t coefficients = {
+      vars->ch1dxx[m], vars->ch1dyy[m], vars->ch1dzz[m], vars->ch1dxy[m],
+      vars->ch1dyz[m], vars->ch1dxz[m], vars->v2px[m],   vars->v2pz[m],
+      vars->v2sz[m],   vars->v2pn[m]};
+  return coefficients;
+}
+
 typedef struct {
   float *theta;
   float *phi;
@@ -25,8 +53,8 @@ typedef struct {
   float *delta;
 } dc_anisotropy_t;
 
-dc_precomp_vars dc_compute_precomp_vars(int sx, int sy, int sz,
+dc_precomp_vars dc_compute_precomp_vars(size_t sx, size_t sy, size_t sz,
                                         dc_anisotropy_t anisotropy);
-dc_anisotropy_t dc_compute_anisotropy_vars(int sx, int sy, int sz);
+dc_anisotropy_t dc_compute_anisotropy_vars(size_t sx, size_t sy, size_t sz);
 void dc_free_precomp_vars(dc_precomp_vars *vars);
 void dc_free_anisotropy_vars(dc_anisotropy_t *anisotropy);
@@ -18,6 +18,10 @@ void dc_propagate(const size_t start_coords[DIMENSIONS],
                   const float dx, const float dy, const float dz,
                   const float dt);
 
+// Whether a kernel built for this local box size (see KERNEL_SIZES in the
+// Makefile) handles the flat layout
+int dc_propagate_specialized(const size_t sizes[DIMENSIONS]);
+
 #endif // DC_PROPAGATE_H
 
 #ifdef __cplusplus
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "codec.h"
+#include "definitions.h"
+
+// Per-rank output: one record per rank holding the cells it owns, its box
+// without ghosts, as this header followed by p and then q over that box, x
+// fastest, stored together with the header's codec. A set's records live in
+// <output>.0, <output>.1, ... back to back: one per file when every rank
+// writes its own, several when I/O servers collect them (see io_server.h).
+// dc-merge assembles a set into the shared output layout, or reads
+// sub-volumes straight out of it.
+#define DC_RANK_MAGIC "DCRANK"
+#define DC_RANK_VERSION 2
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  // Number of records in the set
+  uint32_t ranks;
+  // Padded global box, and the global position and sizes of the cells held
+  uint64_t global_sizes[DIMENSIONS];
+  uint64_t starts[DIMENSIONS];
+  uint64_t sizes[DIMENSIONS];
+  // Iterations run when the fields were taken
+  uint64_t iteration;
+  // A dc_codec_t, and the bytes p and q take after the header
+  uint32_t codec;
+  uint32_t reserved;
+  uint64_t bytes;
+} dc_rank_header_t;
+
+static inline void dc_rank_file_path(char *path, size_t length,
+                                     const char *output_file, int rank) {
+  snprintf(path, length, "%s.%d", output_file, rank);
+}
+
+// Cells held by a record
+static inline uint64_t dc_rank_cells(const dc_rank_header_t *header) {
+  return header->sizes[0] * header->sizes[1] * header->sizes[2];
+}
+
+// Append a record of `header` with `fields`, p then q, stored with the
+// header's codec at zlib `level`; sets header->bytes. Returns 0 on failure.
+int dc_rank_record_write(FILE *file, dc_rank_header_t *header,
+                         const float *fields, int level);
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "dc_process.h"
+#include "definitions.h"
+#include <mpi.h>
+
+// Cells of the problem domain, without the ghosts and absorbing zone, to
+// output: every stride[i]-th one from lo[i] up to, excluding, hi[i]
+typedef struct {
+  size_t lo[DIMENSIONS];
+  size_t hi[DIMENSIONS];
+  size_t stride[DIMENSIONS];
+} dc_region_t;
+
+// Selected cells along each axis
+void dc_region_sizes(const dc_region_t *region, size_t sizes[DIMENSIONS]);
+
+// Collective: every rank writes the selected cells it owns straight into
+// their place in `output_file`, a raw grid of the selection's sizes holding
+// p and then q, x fastest. `padding` is the number of cells before the
+// problem domain on each axis.
+void dc_region_write(const dc_process_t *process, MPI_Comm comm,
+                     const dc_region_t *region, size_t padding,
+                     const char *output_file);
@@ -17,13 +17,158 @@
 #define V2PX_FACTOR 1.48f  // 1 + 2*epsilon
 #define V2PN_FACTOR 1.2f   // 1 + 2*delta
 
+// Full TTI operator, for sample_compute_cell
+static inline HOST_DEVICE void
+sample_compute_tti(const float *pc, const float *qc, int c, int strideX,
+                   int strideY, int strideZ, float dx, float dy, float dz,
+                   float dt, float *pp, float *qp, const float *ch1dxx,
+                   const float *ch1dyy, const float *ch1dzz,
+                   const float *ch1dxy, const float *ch1dyz,
+                   const float *ch1dxz, const float *v2px, const float *v2pz,
+                   const float *v2sz, const float *v2pn, size_t i, size_t m) {
+  // Calculate inverse values for derivatives
+  const float dxxinv = 1.0f / (dx * dx);
+  const float dyyinv = 1.0f / (dy * dy);
+  const float dzzinv = 1.0f / (dz * dz);
+  const float dxyinv = 1.0f / (dx * dy);
+  const float dxzinv = 1.0f / (dx * dz);
+  const float dyzinv = 1.0f / (dy * dz);
+
+  // p derivatives, H1(p) and H2(p)
+  const float pxx = der2(pc, c, strideX, dxxinv);
+  const float pyy = der2(pc, c, strideY, dyyinv);
+  const float pzz = der2(pc, c, strideZ, dzzinv);
+  const float pxy = derCross(pc, c, strideX, strideY, dxyinv);
+  const float pyz = derCross(pc, c, strideY, strideZ, dyzinv);
+  const float pxz = derCross(pc, c, strideX, strideZ, dxzinv);
+
+  const float cpxx = ch1dxx[m] * pxx;
+  const float cpyy = ch1dyy[m] * pyy;
+  const float cpzz = ch1dzz[m] * pzz;
+  const float cpxy = ch1dxy[m] * pxy;
+  const float cpxz = ch1dxz[m] * pxz;
+  const float cpyz = ch1dyz[m] * pyz;
+  const float h1p = cpxx + cpyy + cpzz + cpxy + cpxz + cpyz;
+  const float h2p = pxx + pyy + pzz - h1p;
+
+  // q derivatives, H1(q) and H2(q)
+  const float qxx = der2(qc, c, strideX, dxxinv);
+  const float qyy = der2(qc, c, strideY, dyyinv);
+  const float qzz = der2(qc, c, strideZ, dzzinv);
+  const float qxy = derCross(qc, c, strideX, strideY, dxyinv);
+  const float qyz = derCross(qc, c, strideY, strideZ, dyzinv);
+  const float qxz = derCross(qc, c, strideX, strideZ, dxzinv);
+
+  const float cqxx = ch1dxx[m] * qxx;
+  const float cqyy = ch1dyy[m] * qyy;
+  const float cqzz = ch1dzz[m] * qzz;
+  const float cqxy = ch1dxy[m] * qxy;
+  const float cqxz = ch1dxz[m] * qxz;
+  const float cqyz = ch1dyz[m] * qyz;
+  const float h1q = cqxx + cqyy + cqzz + cqxy + cqxz + cqyz;
+  const float h2q = qxx + qyy + qzz - h1q;
+
+  // p-q derivatives, H1(p-q)
+  const float h1pmq = h1p - h1q;
+  const float h2pmq = h2p - h2q;
+
+  // rhs of p and q equations
+  float rhsp = v2px[m] * h2p + v2pz[m] * h1q +
+               v2sz[m] * h1pmq;
+  float rhsq = v2pn[m] * h2p + v2pz[m] * h1q -
+               v2sz[m] * h2pmq;
+
+  // new p and q
+  pp[i] = 2.0f * pc[c] - pp[i] + rhsp * dt * dt;
+  qp[i] = 2.0f * qc[c] - qp[i] + rhsq * dt * dt;
+}
+
+// VTI: with no tilt, H1 is the z derivative alone and the cross derivatives
+// drop out; the rest is evaluated as in sample_compute_tti
+static inline HOST_DEVICE void
+sample_compute_vti(const float *pc, const float *qc, int c, int strideX,
+                   int strideY, int strideZ, float dx, float dy, float dz,
+                   float dt, float *pp, float *qp, const float *v2px,
+                   const float *v2pz, const float *v2sz, const float *v2pn,
+                   size_t i, size_t m) {
+  const float dxxinv = 1.0f / (dx * dx);
+  const float dyyinv = 1.0f / (dy * dy);
+  const float dzzinv = 1.0f / (dz * dz);
+
+  const float pxx = der2(pc, c, strideX, dxxinv);
+  const float pyy = der2(pc, c, strideY, dyyinv);
+  const float pzz = der2(pc, c, strideZ, dzzinv);
+  const float h1p = pzz;
+  const float h2p = pxx + pyy + pzz - h1p;
+
+  const float qxx = der2(qc, c, strideX, dxxinv);
+  const float qyy = der2(qc, c, strideY, dyyinv);
+  const float qzz = der2(qc, c, strideZ, dzzinv);
+  const float h1q = qzz;
+  const float h2q = qxx + qyy + qzz - h1q;
+
+  const float h1pmq = h1p - h1q;
+  const float h2pmq = h2p - h2q;
+
+  float rhsp = v2px[m] * h2p + v2pz[m] * h1q + v2sz[m] * h1pmq;
+  float rhsq = v2pn[m] * h2p + v2pz[m] * h1q - v2sz[m] * h2pmq;
+
+  pp[i] = 2.0f * pc[c] - pp[i] + rhsp * dt * dt;
+  qp[i] = 2.0f * qc[c] - qp[i] + rhsq * dt * dt;
+}
+
+// Isotropic: with epsilon = delta = 0, p and q stay equal and follow the
+// acoustic wave equation, so only p is read and q is set to the new p
+static inline HOST_DEVICE void
+sample_compute_isotropic(const float *pc, int c, int strideX, int strideY,
+                         int strideZ, float dx, float dy, float dz, float dt,
+                         float *pp, float *qp, const float *v2pz, size_t i,
+                         size_t m) {
+  const float laplacian = der2(pc, c, strideX, 1.0f / (dx * dx)) +
+                          der2(pc, c, strideY, 1.0f / (dy * dy)) +
+                          der2(pc, c, strideZ, 1.0f / (dz * dz));
+  pp[i] = 2.0f * pc[c] - pp[i] + v2pz[m] * laplacian * dt * dt;
+  qp[i] = pp[i];
+}
+
+// Updates pp/qp at cell `i` from the pc/qc neighbourhood of cell `c`, with
+// the coefficients at index `m`, using the kernel for `physics`. The field
+// indices differ when pc and qc are read from a gathered tile (see brick.h),
+// and `m` is a material ID when the coefficients come from a material table
+// (see materials.h).
+static inline HOST_DEVICE void
+sample_compute_cell(const float *pc, const float *qc, int c, int strideX,
+                    int strideY, int strideZ, float dx, float dy, float dz,
+                    float dt, float *pp, float *qp, const float *ch1dxx,
+                    const float *ch1dyy, const float *ch1dzz,
+                    const float *ch1dxy, const float *ch1dyz,
+                    const float *ch1dxz, const float *v2px, const float *v2pz,
+                    const float *v2sz, const float *v2pn, size_t i, size_t m,
+                    dc_physics_t physics) {
+  switch (physics) {
+  case DC_PHYSICS_ISOTROPIC:
+    sample_compute_isotropic(pc, c, strideX, strideY, strideZ, dx, dy, dz, dt,
+                             pp, qp, v2pz, i, m);
+    break;
+  case DC_PHYSICS_VTI:
+    sample_compute_vti(pc, qc, c, strideX, strideY, strideZ, dx, dy, dz, dt,
+                       pp, qp, v2px, v2pz, v2sz, v2pn, i, m);
+    break;
+  default:
+    sample_compute_tti(pc, qc, c, strideX, strideY, strideZ, dx, dy, dz, dt,
+                       pp, qp, ch1dxx, ch1dyy, ch1dzz, ch1dxy, ch1dyz, ch1dxz,
+                       v2px, v2pz, v2sz, v2pn, i, m);
+  }
+}
+
 // Optimized version: takes vpz/vsv and computes v2* on-the-fly
 static inline HOST_DEVICE void
 sample_compute_optimized(size_t x, size_t y, size_t z, size_t size_x, size_t size_y, size_t size_z,
                int process_coord_x, int process_coord_y, int process_coord_z,
                int topology_x, int topology_y, int topology_z, float dx,
                float dy, float dz, float dt, const float *pc, const float *qc,
-               float *pp, float *qp, const float *vpz, const float *vsv) {
+               float *pp, float *qp, const float *vpz, const float *vsv,
+               dc_physics_t physics) {
 
   // Calculate strides for each dimension
   const int strideX =
@@ -44,8 +189,17 @@ sample_compute_optimized(size_t x, size_t y, size_t z, size_t size_x, size_t siz
   const float dxzinv = 1.0f / (dx * dz);
   const float dyzinv = 1.0f / (dy * dz);
 
-  // Calculate index for current position
-  const int i = dc_get_index_for_coordinates(x, y, z, size_x, size_y, size_z);
+  // Calculate index for current position, relative to its z plane (see
+  // dc_local_offsets_fit)
+  const size_t plane =
+      dc_get_index_for_coordinates(0, 0, z, size_x, size_y, size_z);
+  pc += plane;
+  qc += plane;
+  pp += plane;
+  qp += plane;
+  vpz += plane;
+  vsv += plane;
+  const int i = dc_get_index_for_coordinates(x, y, 0, size_x, size_y, size_z);
 
   // Compute v2* values on-the-fly from vpz/vsv
   const float v2pz = vpz[i] * vpz[i];
@@ -53,6 +207,17 @@ sample_compute_optimized(size_t x, size_t y, size_t z, size_t size_x, size_t siz
   const float v2px = v2pz * V2PX_FACTOR;
   const float v2pn = v2pz * V2PN_FACTOR;
 
+  if (physics == DC_PHYSICS_ISOTROPIC) {
+    sample_compute_isotropic(pc, i, strideX, strideY, strideZ, dx, dy, dz, dt,
+                             pp, qp, &v2pz, i, 0);
+    return;
+  }
+  if (physics == DC_PHYSICS_VTI) {
+    sample_compute_vti(pc, qc, i, strideX, strideY, strideZ, dx, dy, dz, dt,
+                       pp, qp, &v2px, &v2pz, &v2sz, &v2pn, i, 0);
+    return;
+  }
+
   // p derivatives, H1(p) and H2(p)
   const float pxx = der2(pc, i, strideX, dxxinv);
   const float pyy = der2(pc, i, strideY, dyyinv);
@@ -110,7 +275,7 @@ sample_compute(size_t x, size_t y, size_t z, size_t size_x, size_t size_y, size_
                float *pp, float *qp, const float *ch1dxx, const float *ch1dyy,
                const float *ch1dzz, const float *ch1dxy, const float *ch1dyz,
                const float *ch1dxz, const float *v2px, const float *v2pz,
-               const float *v2sz, const float *v2pn) {
+               const float *v2sz, const float *v2pn, dc_physics_t physics) {
 
 
   // Calculate strides for each dimension
@@ -124,62 +289,40 @@ sample_compute(size_t x, size_t y, size_t z, size_t size_x, size_t size_y, size_
       dc_get_index_for_coordinates(0, 0, 1, size_x, size_y, size_z) -
       dc_get_index_for_coordinates(0, 0, 0, size_x, size_y, size_z);
 
-  // Calculate inverse values for derivatives
-  const float dxxinv = 1.0f / (dx * dx);
-  const float dyyinv = 1.0f / (dy * dy);
-  const float dzzinv = 1.0f / (dz * dz);
-  const float dxyinv = 1.0f / (dx * dy);
-  const float dxzinv = 1.0f / (dx * dz);
-  const float dyzinv = 1.0f / (dy * dz);
+  // Calculate index for current position, relative to its z plane (see
+  // dc_local_offsets_fit)
+  const size_t plane =
+      dc_get_index_for_coordinates(0, 0, z, size_x, size_y, size_z);
+  pc += plane;
+  qc += plane;
+  pp += plane;
+  qp += plane;
+  ch1dxx += plane;
+  ch1dyy += plane;
+  ch1dzz += plane;
+  ch1dxy += plane;
+  ch1dyz += plane;
+  ch1dxz += plane;
+  v2px += plane;
+  v2pz += plane;
+  v2sz += plane;
+  v2pn += plane;
+  const int i = dc_get_index_for_coordinates(x, y, 0, size_x, size_y, size_z);
 
-  // Calculate index for current position
-  const int i = dc_get_index_for_coordinates(x, y, z, size_x, size_y, size_z);
-
-  // p derivatives, H1(p) and H2(p)
-  const float pxx = der2(pc, i, strideX, dxxinv);
-  const float pyy = der2(pc, i, strideY, dyyinv);
-  const float pzz = der2(pc, i, strideZ, dzzinv);
-  const float pxy = derCross(pc, i, strideX, strideY, dxyinv);
-  const float pyz = derCross(pc, i, strideY, strideZ, dyzinv);
-  const float pxz = derCross(pc, i, strideX, strideZ, dxzinv);
-
-  const float cpxx = ch1dxx[i] * pxx;
-  const float cpyy = ch1dyy[i] * pyy;
-  const float cpzz = ch1dzz[i] * pzz;
-  const float cpxy = ch1dxy[i] * pxy;
-  const float cpxz = ch1dxz[i] * pxz;
-  const float cpyz = ch1dyz[i] * pyz;
-  const float h1p = cpxx + cpyy + cpzz + cpxy + cpxz + cpyz;
-  const float h2p = pxx + pyy + pzz - h1p;
-
-  // q derivatives, H1(q) and H2(q)
-  const float qxx = der2(qc, i, strideX, dxxinv);
-  const float qyy = der2(qc, i, strideY, dyyinv);
-  const float qzz = der2(qc, i, strideZ, dzzinv);
-  const float qxy = derCross(qc, i, strideX, strideY, dxyinv);
-  const float qyz = derCross(qc, i, strideY, strideZ, dyzinv);
-  const float qxz = derCross(qc, i, strideX, strideZ, dxzinv);
-
-  const float cqxx = ch1dxx[i] * qxx;
-  const float cqyy = ch1dyy[i] * qyy;
-  const float cqzz = ch1dzz[i] * qzz;
-  const float cqxy = ch1dxy[i] * qxy;
-  const float cqxz = ch1dxz[i] * qxz;
-  const float cqyz = ch1dyz[i] * qyz;
-  const float h1q = cqxx + cqyy + cqzz + cqxy + cqxz + cqyz;
-  const float h2q = qxx + qyy + qzz - h1q;
-
-  // p-q derivatives, H1(p-q)
-  const float h1pmq = h1p - h1q;
-  const float h2pmq = h2p - h2q;
-
-  // rhs of p and q equations
-  float rhsp = v2px[i] * h2p + v2pz[i] * h1q +
-               v2sz[i] * h1pmq;
-  float rhsq = v2pn[i] * h2p + v2pz[i] * h1q -
-               v2sz[i] * h2pmq;
+  sample_compute_cell(pc, qc, i, strideX, strideY, strideZ, dx, dy, dz, dt, pp,
+                      qp, ch1dxx, ch1dyy, ch1dzz, ch1dxy, ch1dyz, ch1dxz,
+                      v2px, v2pz, v2sz, v2pn, i, i, physics);
+}
 
-  // new p and q
-  pp[i] = 2.0f * pc[i] - pp[i] + rhsp * dt * dt;
-  qp[i] = 2.0f * qc[i] - qp[i] + rhsq * dt * dt;
+// sample_compute_cell with one coefficient tuple for every cell: taken by
+// value, it stays in registers instead of being streamed from memory
+static inline HOST_DEVICE void
+sample_compute_uniform(const float *pc, const float *qc, int c, int strideX,
+                       int strideY, int strideZ, float dx, float dy, float dz,
+                       float dt, float *pp, float *qp, dc_coefficients_t k,
+                       size_t i, dc_physics_t physics) {
+  sample_compute_cell(pc, qc, c, strideX, strideY, strideZ, dx, dy, dz, dt, pp,
+                      qp, &k.ch1dxx, &k.ch1dyy, &k.ch1dzz, &k.ch1dxy,
+                      &k.ch1dyz, &k.ch1dxz, &k.v2px, &k.v2pz, &k.v2sz,
+                      &k.v2pn, i, 0, physics);
 }
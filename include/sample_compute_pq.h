@@ -0,0 +1,195 @@
+#pragma once
+
+#include <string.h>
+
+#include "derivatives.h"
+#include "precomp.h"
+
+// Interleaved layout: p and q of a cell sit next to each other, p first, so
+// pc[2 * i] is p and pc[2 * i + 1] is q. The kernel below evaluates both
+// fields in the two lanes of a GCC vector, loading every neighbour pair once;
+// each lane performs the same operations in the same order as sample_compute.
+typedef float dc_pq_t __attribute__((vector_size(2 * sizeof(float))));
+
+static inline dc_pq_t dc_pq_load(const float *pq, int i) {
+  dc_pq_t pair;
+  memcpy(&pair, pq + 2 * (ptrdiff_t)i, sizeof(pair));
+  return pair;
+}
+
+static inline void dc_pq_store(float *pq, int i, dc_pq_t pair) {
+  memcpy(pq + 2 * (ptrdiff_t)i, &pair, sizeof(pair));
+}
+
+#define PQ(offset) dc_pq_load(pq, i + (offset))
+
+static inline dc_pq_t der2_pq(const float *pq, int i, int s, float d2inv) {
+  return (K0 * PQ(0) + K1 * (PQ(s) + PQ(-s)) + K2 * (PQ(2 * s) + PQ(-2 * s)) +
+          K3 * (PQ(3 * s) + PQ(-3 * s)) + K4 * (PQ(4 * s) + PQ(-4 * s))) *
+         d2inv;
+}
+
+static inline dc_pq_t derCross_pq(const float *pq, int i, int s11, int s21,
+                                  float dinv) {
+  return (L11 * (PQ(s21 + s11) - PQ(s21 - s11) - PQ(-s21 + s11) +
+                 PQ(-s21 - s11)) +
+          L12 * (PQ(s21 + (2 * s11)) - PQ(s21 - (2 * s11)) -
+                 PQ(-s21 + (2 * s11)) + PQ(-s21 - (2 * s11)) +
+                 PQ((2 * s21) + s11) - PQ((2 * s21) - s11) -
+                 PQ(-(2 * s21) + s11) + PQ(-(2 * s21) - s11)) +
+          L13 * (PQ(s21 + (3 * s11)) - PQ(s21 - (3 * s11)) -
+                 PQ(-s21 + (3 * s11)) + PQ(-s21 - (3 * s11)) +
+                 PQ((3 * s21) + s11) - PQ((3 * s21) - s11) -
+                 PQ(-(3 * s21) + s11) + PQ(-(3 * s21) - s11)) +
+          L14 * (PQ(s21 + (4 * s11)) - PQ(s21 - (4 * s11)) -
+                 PQ(-s21 + (4 * s11)) + PQ(-s21 - (4 * s11)) +
+                 PQ((4 * s21) + s11) - PQ((4 * s21) - s11) -
+                 PQ(-(4 * s21) + s11) + PQ(-(4 * s21) - s11)) +
+          L22 * (PQ((2 * s21) + (2 * s11)) - PQ((2 * s21) - (2 * s11)) -
+                 PQ(-(2 * s21) + (2 * s11)) + PQ(-(2 * s21) - (2 * s11))) +
+          L23 * (PQ((2 * s21) + (3 * s11)) - PQ((2 * s21) - (3 * s11)) -
+                 PQ(-(2 * s21) + (3 * s11)) + PQ(-(2 * s21) - (3 * s11)) +
+                 PQ((3 * s21) + (2 * s11)) - PQ((3 * s21) - (2 * s11)) -
+                 PQ(-(3 * s21) + (2 * s11)) + PQ(-(3 * s21) - (2 * s11))) +
+          L24 * (PQ((2 * s21) + (4 * s11)) - PQ((2 * s21) - (4 * s11)) -
+                 PQ(-(2 * s21) + (4 * s11)) + PQ(-(2 * s21) - (4 * s11)) +
+                 PQ((4 * s21) + (2 * s11)) - PQ((4 * s21) - (2 * s11)) -
+                 PQ(-(4 * s21) + (2 * s11)) + PQ(-(4 * s21) - (2 * s11))) +
+          L33 * (PQ((3 * s21) + (3 * s11)) - PQ((3 * s21) - (3 * s11)) -
+                 PQ(-(3 * s21) + (3 * s11)) + PQ(-(3 * s21) - (3 * s11))) +
+          L34 * (PQ((3 * s21) + (4 * s11)) - PQ((3 * s21) - (4 * s11)) -
+                 PQ(-(3 * s21) + (4 * s11)) + PQ(-(3 * s21) - (4 * s11)) +
+                 PQ((4 * s21) + (3 * s11)) - PQ((4 * s21) - (3 * s11)) -
+                 PQ(-(4 * s21) + (3 * s11)) + PQ(-(4 * s21) - (3 * s11))) +
+          L44 * (PQ((4 * s21) + (4 * s11)) - PQ((4 * s21) - (4 * s11)) -
+                 PQ(-(4 * s21) + (4 * s11)) + PQ(-(4 * s21) - (4 * s11)))) *
+         dinv;
+}
+
+#undef PQ
+
+// Full TTI operator, for sample_compute_pq
+static inline void
+sample_compute_pq_tti(const float *pqc, int i, int strideX, int strideY,
+                      int strideZ, float dx, float dy, float dz, float dt,
+                      float *pqp, const float *ch1dxx, const float *ch1dyy,
+                      const float *ch1dzz, const float *ch1dxy,
+                      const float *ch1dyz, const float *ch1dxz,
+                      const float *v2px, const float *v2pz, const float *v2sz,
+                      const float *v2pn, size_t m) {
+  // Calculate inverse values for derivatives
+  const float dxxinv = 1.0f / (dx * dx);
+  const float dyyinv = 1.0f / (dy * dy);
+  const float dzzinv = 1.0f / (dz * dz);
+  const float dxyinv = 1.0f / (dx * dy);
+  const float dxzinv = 1.0f / (dx * dz);
+  const float dyzinv = 1.0f / (dy * dz);
+
+  // p and q derivatives, H1 and H2 of both
+  const dc_pq_t xx = der2_pq(pqc, i, strideX, dxxinv);
+  const dc_pq_t yy = der2_pq(pqc, i, strideY, dyyinv);
+  const dc_pq_t zz = der2_pq(pqc, i, strideZ, dzzinv);
+  const dc_pq_t xy = derCross_pq(pqc, i, strideX, strideY, dxyinv);
+  const dc_pq_t yz = derCross_pq(pqc, i, strideY, strideZ, dyzinv);
+  const dc_pq_t xz = derCross_pq(pqc, i, strideX, strideZ, dxzinv);
+
+  const dc_pq_t cxx = ch1dxx[m] * xx;
+  const dc_pq_t cyy = ch1dyy[m] * yy;
+  const dc_pq_t czz = ch1dzz[m] * zz;
+  const dc_pq_t cxy = ch1dxy[m] * xy;
+  const dc_pq_t cxz = ch1dxz[m] * xz;
+  const dc_pq_t cyz = ch1dyz[m] * yz;
+  const dc_pq_t h1 = cxx + cyy + czz + cxy + cxz + cyz;
+  const dc_pq_t h2 = xx + yy + zz - h1;
+
+  // p-q derivatives, H1(p-q)
+  const float h1pmq = h1[0] - h1[1];
+  const float h2pmq = h2[0] - h2[1];
+
+  // rhs of p and q equations
+  const dc_pq_t rhs = {v2px[m] * h2[0] + v2pz[m] * h1[1] + v2sz[m] * h1pmq,
+                       v2pn[m] * h2[0] + v2pz[m] * h1[1] - v2sz[m] * h2pmq};
+
+  // new p and q
+  dc_pq_store(pqp, i,
+              2.0f * dc_pq_load(pqc, i) - dc_pq_load(pqp, i) + rhs * dt * dt);
+}
+
+// VTI and isotropic kernels, lane by lane as sample_compute_vti and
+// sample_compute_isotropic
+static inline void sample_compute_pq_vti(const float *pqc, int i, int strideX,
+                                         int strideY, int strideZ, float dx,
+                                         float dy, float dz, float dt,
+                                         float *pqp, const float *v2px,
+                                         const float *v2pz, const float *v2sz,
+                                         const float *v2pn, size_t m) {
+  const dc_pq_t xx = der2_pq(pqc, i, strideX, 1.0f / (dx * dx));
+  const dc_pq_t yy = der2_pq(pqc, i, strideY, 1.0f / (dy * dy));
+  const dc_pq_t zz = der2_pq(pqc, i, strideZ, 1.0f / (dz * dz));
+  const dc_pq_t h1 = zz;
+  const dc_pq_t h2 = xx + yy + zz - h1;
+
+  const float h1pmq = h1[0] - h1[1];
+  const float h2pmq = h2[0] - h2[1];
+
+  const dc_pq_t rhs = {v2px[m] * h2[0] + v2pz[m] * h1[1] + v2sz[m] * h1pmq,
+                       v2pn[m] * h2[0] + v2pz[m] * h1[1] - v2sz[m] * h2pmq};
+
+  dc_pq_store(pqp, i,
+              2.0f * dc_pq_load(pqc, i) - dc_pq_load(pqp, i) + rhs * dt * dt);
+}
+
+static inline void sample_compute_pq_isotropic(const float *pqc, int i,
+                                               int strideX, int strideY,
+                                               int strideZ, float dx, float dy,
+                                               float dz, float dt, float *pqp,
+                                               const float *v2pz, size_t m) {
+  const dc_pq_t laplacian = der2_pq(pqc, i, strideX, 1.0f / (dx * dx)) +
+                            der2_pq(pqc, i, strideY, 1.0f / (dy * dy)) +
+                            der2_pq(pqc, i, strideZ, 1.0f / (dz * dz));
+  const float p = 2.0f * pqc[2 * (ptrdiff_t)i] - pqp[2 * (ptrdiff_t)i] +
+                  v2pz[m] * laplacian[0] * dt * dt;
+  const dc_pq_t pq = {p, p};
+  dc_pq_store(pqp, i, pq);
+}
+
+// Updates the pp/qp pair of cell `i` from the interleaved pc/qc around it,
+// with the coefficients at index `m` and the kernel for `physics` (see
+// sample_compute_cell)
+static inline void
+sample_compute_pq(const float *pqc, int i, int strideX, int strideY,
+                  int strideZ, float dx, float dy, float dz, float dt,
+                  float *pqp, const float *ch1dxx, const float *ch1dyy,
+                  const float *ch1dzz, const float *ch1dxy,
+                  const float *ch1dyz, const float *ch1dxz, const float *v2px,
+                  const float *v2pz, const float *v2sz, const float *v2pn,
+                  size_t m, dc_physics_t physics) {
+  switch (physics) {
+  case DC_PHYSICS_ISOTROPIC:
+    sample_compute_pq_isotropic(pqc, i, strideX, strideY, strideZ, dx, dy, dz,
+                                dt, pqp, v2pz, m);
+    break;
+  case DC_PHYSICS_VTI:
+    sample_compute_pq_vti(pqc, i, strideX, strideY, strideZ, dx, dy, dz, dt,
+                          pqp, v2px, v2pz, v2sz, v2pn, m);
+    break;
+  default:
+    sample_compute_pq_tti(pqc, i, strideX, strideY, strideZ, dx, dy, dz, dt,
+                          pqp, ch1dxx, ch1dyy, ch1dzz, ch1dxy, ch1dyz, ch1dxz,
+                          v2px, v2pz, v2sz, v2pn, m);
+  }
+}
+
+// sample_compute_pq with one coefficient tuple for every cell (see
+// sample_compute_uniform)
+static inline void sample_compute_pq_uniform(const float *pqc, int i,
+                                             int strideX, int strideY,
+                                             int strideZ, float dx, float dy,
+                                             float dz, float dt, float *pqp,
+                                             dc_coefficients_t k,
+                                             dc_physics_t physics) {
+  sample_compute_pq(pqc, i, strideX, strideY, strideZ, dx, dy, dz, dt, pqp,
+                    &k.ch1dxx, &k.ch1dyy, &k.ch1dzz, &k.ch1dxy, &k.ch1dyz,
+                    &k.ch1dxz, &k.v2px, &k.v2pz, &k.v2sz, &k.v2pn, 0,
+                    physics);
+}
@@ -15,8 +15,13 @@ typedef enum {
 
 #include "dc_process.h"
 
-void dc_mpi_world_init(MPI_Comm *communicator, const int topology[DIMENSIONS]);
+// Cartesian communicator over the ranks of `world`, ordered by `key`
+void dc_mpi_world_init(MPI_Comm *communicator, MPI_Comm world,
+                       const int topology[DIMENSIONS], int key);
 dc_process_t dc_process_init(MPI_Comm communicator, int rank,
                              size_t num_workers, int topology[DIMENSIONS],
                              size_t sx, size_t sy, size_t sz, float dx,
-                             float dy, float dz, float dt);
+                             float dy, float dz, float dt,
+                             dc_stencil_footprint_t footprint);
+int dc_halo_region_exchanged(const dc_process_t *process, size_t face_index);
+int dc_halo_region_messaged(const dc_process_t *process, size_t face_index);
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <mpi.h>
+
+#include "dc_process.h"
+#include "device_data.h"
+
+// Snapshots: every snapshot_interval iterations, short of the last, each
+// rank records the cells it owns in the per-rank set <output>.<iteration>
+// (see rank_file.h), handing them to its I/O server when there is one (see
+// io_server.h) and writing them itself otherwise
+
+// Whether a snapshot falls after `iteration` iterations
+int dc_snapshot_due(const dc_process_t *process, unsigned int iteration);
+
+// Record the process arrays, which hold the fields after `iteration`
+// iterations
+void dc_snapshot_write(dc_process_t *process, unsigned int iteration);
+
+// Record the fields of `data` after `iteration` iterations
+void dc_snapshot_take(dc_process_t *process, dc_device_data *data,
+                      unsigned int iteration);
+
+// Collective: log on the coordinator what the snapshots cost the ranks over
+// a run of `seconds`
+void dc_snapshot_report(const dc_process_t *process, MPI_Comm comm,
+                        double seconds);
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <mpi.h>
+
+#include "dc_process.h"
+#include "definitions.h"
+
+// Amplitude a wave crossing the sponge and back is left with, which sets the
+// damping rate of a sponge of width L cells of spacing h:
+// d0 = 3 v ln(1 / R) / (2 L h), v being the fastest velocity of the model
+#define DC_SPONGE_REFLECTION 1e-3f
+
+// Find the fastest velocity of the model over all ranks, which the damping
+// profile is scaled by, and log the sponge. Does nothing without a sponge.
+void dc_sponge_init(dc_process_t *process, MPI_Comm comm);
+
+// Damping factor of every local index along `axis`, 1 outside the sponge; a
+// cell d cells deep into the sponge (d = 1 next to the interior, L at the
+// ghosts) gets exp(-d0 (d / L)^2 dt), by which the propagator scales the
+// change of p and q over the step. `undamped` receives the local range of
+// indices whose factor is 1.
+float *dc_sponge_factors(const dc_process_t *process, int axis,
+                         size_t undamped[2]);
@@ -0,0 +1,37 @@
+#pragma once
+
+// A stencil footprint records which combinations of axes a stencil reads
+// offsets along. Bit (1 << axes) is set when some point read by the stencil
+// is displaced along exactly the axes in the mask `axes` (x = 1, y = 2,
+// z = 4). A neighbour region with displacement (dx, dy, dz) only needs to be
+// exchanged when its own axis combination is part of the footprint.
+typedef unsigned int dc_stencil_footprint_t;
+
+#define DC_AXIS_X 1
+#define DC_AXIS_Y 2
+#define DC_AXIS_Z 4
+
+// der2 reads along a single axis
+#define DER2_FOOTPRINT(axis) (1u << (axis))
+// derCross reads along both axes alone and on the plane they span
+#define DERCROSS_FOOTPRINT(axis1, axis2)                                       \
+  (DER2_FOOTPRINT(axis1) | DER2_FOOTPRINT(axis2) |                             \
+   (1u << ((axis1) | (axis2))))
+
+// The isotropic and VTI kernels evaluate der2 along x, y and z only
+#define DC_AXES_FOOTPRINT                                                      \
+  (DER2_FOOTPRINT(DC_AXIS_X) | DER2_FOOTPRINT(DC_AXIS_Y) |                     \
+   DER2_FOOTPRINT(DC_AXIS_Z))
+
+// The TTI kernel adds derCross on xy, yz and xz
+#define DC_TTI_FOOTPRINT                                                       \
+  (DC_AXES_FOOTPRINT | DERCROSS_FOOTPRINT(DC_AXIS_X, DC_AXIS_Y) |              \
+   DERCROSS_FOOTPRINT(DC_AXIS_Y, DC_AXIS_Z) |                                  \
+   DERCROSS_FOOTPRINT(DC_AXIS_X, DC_AXIS_Z))
+
+static inline int dc_footprint_reads_region(dc_stencil_footprint_t footprint,
+                                            int dx, int dy, int dz) {
+  unsigned int axes = (dx != 0 ? DC_AXIS_X : 0) | (dy != 0 ? DC_AXIS_Y : 0) |
+                      (dz != 0 ? DC_AXIS_Z : 0);
+  return (footprint >> axes) & 1u;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "dc_process.h"
+#include "definitions.h"
+#include "device_data.h"
+#include <mpi.h>
+
+// Planes per band of the temporal wavefront. Bands sit on z multiples of it,
+// which keeps them on brick boundaries, and every band but the last holds at
+// least STENCIL planes, which the skew relies on (see dc_temporal_advance).
+#define DC_TEMPORAL_BAND (2 * STENCIL)
+
+// A pass of s steps reads s * STENCIL cells around the box where one
+// iteration reads STENCIL, so the kernels run on an extended box: the rank's
+// box grown by temporal_steps * STENCIL cells on every side, clipped to the
+// grid. Before each pass the cells of it that other ranks own are copied from
+// them, and step k of s computes the rank's cells plus the (s - 1 - k) *
+// STENCIL around them, which is all step k + 1 reads. Cells near the box are
+// thus computed by every rank whose extended box holds them, which buys one
+// exchange per pass instead of one per iteration.
+typedef struct {
+  // The extended box as a process of its own, with its sizes, start
+  // coordinates, source index, fields and model; the device data is built
+  // from it
+  dc_process_t extended;
+  int num_ranks;
+  // Per rank, the cells of ours in its extended box and the cells of its in
+  // ours, as padded global {lo x, y, z, hi x, y, z}
+  size_t (*send_regions)[2 * DIMENSIONS];
+  size_t (*recv_regions)[2 * DIMENSIONS];
+  // In cells of all exchanged fields, for MPI_Alltoallv
+  int *send_counts, *send_displs, *recv_counts, *recv_displs;
+  float *send_buffer, *recv_buffer;
+} dc_temporal_t;
+
+// Collective over `comm`: build the extended box, copy its model and fields
+// from their owners and log its working set. The process's own fields and
+// model are freed; dc_temporal_get_results rebuilds the fields. Rebalancing,
+// which would move the boxes, is disabled.
+void dc_temporal_init(dc_temporal_t *temporal, dc_process_t *process,
+                      MPI_Comm comm);
+
+void dc_temporal_free(dc_temporal_t *temporal);
+
+// Collective over `comm`: refresh the halo of the extended box, then advance
+// `steps` (at most temporal_steps) iterations from iteration `first` in one
+// pass over it: z bands are swept in a wavefront where step k + 1 follows one
+// band behind step k, so a band is revisited by every step while it is still
+// in cache. Each step keeps the pp/pc roles of dc_device_swap_arrays and gets
+// its source just before its first band that reads the source cell; the
+// arrays end up swapped `steps` times, as after as many iterations.
+void dc_temporal_advance(dc_temporal_t *temporal, dc_process_t *process,
+                         dc_device_data *data, MPI_Comm comm,
+                         unsigned int first, unsigned int steps);
+
+// Copy the rank's box of the fields into the process arrays, allocating them
+void dc_temporal_get_results(dc_temporal_t *temporal, dc_process_t *process,
+                             dc_device_data *data);
+
+// Free the process arrays again once the results are read
+void dc_temporal_release_results(dc_process_t *process);
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "definitions.h"
+#include "stencil.h"
+#include <mpi.h>
+#include <stddef.h>
+
+// Bytes a rank at `coordinates` sends per iteration under `topology`, for a
+// padded global grid of `global_sizes` (STENCIL ghosts included)
+double dc_predict_halo_bytes(const int topology[DIMENSIONS],
+                             const int coordinates[DIMENSIONS],
+                             const size_t global_sizes[DIMENSIONS],
+                             dc_stencil_footprint_t footprint);
+
+// Factor `num_processes` into the Cartesian topology that minimises the
+// total halo volume for the grid and stencil footprint
+void dc_select_topology(int num_processes,
+                        const size_t global_sizes[DIMENSIONS],
+                        dc_stencil_footprint_t footprint,
+                        int topology[DIMENSIONS]);
+
+// Key ordering the ranks of `world` so that consecutive Cartesian ranks form
+// node-sized blocks of the process grid, keeping the heaviest halo traffic
+// inside nodes. Returns the calling rank's rank in `world` when no such
+// blocking exists.
+int dc_node_aware_rank_key(MPI_Comm world, const int topology[DIMENSIONS],
+                           const size_t global_sizes[DIMENSIONS]);
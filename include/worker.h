@@ -1,19 +1,28 @@
 #pragma once
 
+#include "coordinator.h"
 #include "dc_process.h"
 #include "device_data.h"
 #include "mpi.h"
+#include "partition.h"
 #include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-#define PP_TAG 3
-#define QP_TAG 6
+#define HALO_TAG 3
 #define PC_TAG 9
 #define QC_TAG 12
 
+// pp and qp travel together: every halo buffer holds the pp face followed by
+// the qp face of the same region
+#define HALO_FIELDS 2
+
+// Computed cells per axis and timed iterations of the calibration run
+#define CALIBRATION_SIZE 64
+#define CALIBRATION_ITERATIONS 5
+
 typedef struct {
   size_t count;
   MPI_Request *requests;
@@ -23,19 +32,26 @@ typedef struct {
 typedef struct {
   worker_requests_t requests;
   size_t halo_count;
+  // Cells per field; halo_data entries hold HALO_FIELDS times as many floats
   size_t *halo_sizes;
   float **halo_data;
   int (*halo_dirs)[DIMENSIONS];
 } worker_halos_t;
 
-void dc_worker_init_from_partition_info(dc_process_t *process, MPI_Comm comm);
+// Every rank derives its box, source index and model from the arguments and
+// its own coordinates; no startup messages are needed
+void dc_worker_init(dc_process_t *process, const dc_partition_t *partition,
+                    dc_arguments_t arguments);
 double dc_worker_process(dc_process_t *process, MPI_Comm comm);
+// Msamples/s of this rank propagating a CALIBRATION_SIZE cube without any
+// halo exchange
+double dc_worker_calibrate(const dc_process_t *process);
 void dc_worker_free(dc_process_t process);
 
-void dc_send_halo_to_neighbours(dc_process_t process, MPI_Comm comm, int tag,
-                                dc_device_data *data, float *from,
-                                worker_requests_t *requests);
-worker_halos_t dc_receive_halos(dc_process_t process, MPI_Comm comm, int tag);
+void dc_send_halo_to_neighbours(dc_process_t *process, MPI_Comm comm, int tag,
+                                dc_device_data *data, float *from_p,
+                                float *from_q, worker_requests_t *requests);
+worker_halos_t dc_receive_halos(dc_process_t *process, MPI_Comm comm, int tag);
 void dc_send_data_to_coordinator(dc_process_t process, MPI_Comm comm);
 
 void dc_compute_boundaries(const dc_process_t *process, dc_device_data *data);
@@ -50,7 +66,9 @@ void dc_worker_swap_arrays(dc_process_t *process);
 
 void dc_worker_insert_halos(const dc_process_t *process,
                             const worker_halos_t *halos, dc_device_data *data,
-                            float *to_array);
+                            float *to_p, float *to_q);
+
+void dc_log_halo_stats(const dc_process_t *process);
 
 #ifdef __cplusplus
 }
@@ -14,11 +14,11 @@
       version = "0.1.0";
       src = ../.;
       nativeBuildInputs = with pkgs; [gnumake] ++ extraNativeBuildInputs;
-      buildInputs = with pkgs; [openmpi] ++ extraBuildInputs;
+      buildInputs = with pkgs; [openmpi zlib] ++ extraBuildInputs;
       buildPhase = "make all BACKEND=${backend} PROFILE=${profile}";
       installPhase = ''
         mkdir -p $out/bin
-        cp bin/dc $out/bin
+        cp bin/dc bin/dc-* $out/bin
       '';
     };
 
@@ -34,7 +34,7 @@
       version = "0.1.0";
       src = ../.;
       nativeBuildInputs = [pkgs.cudatoolkit] ++ extraNativeBuildInputs;
-      buildInputs = [pkgs.openmpi] ++ extraBuildInputs;
+      buildInputs = [pkgs.openmpi pkgs.zlib] ++ extraBuildInputs;
       buildPhase = "make all BACKEND=${backend} PROFILE=${profile}";
       unpackPhase = ''
         mkdir source
@@ -43,7 +43,7 @@
       '';
       installPhase = ''
         mkdir -p $out/bin
-        cp bin/dc $out/bin/dc
+        cp bin/dc bin/dc-* $out/bin
       '';
     };
 in {
@@ -69,7 +69,7 @@ in {
     version = "0.1.0";
     src = ../.;
     nativeBuildInputs = with pkgs; [gnumake simgrid];
-    buildInputs = with pkgs; [openmpi llvmPackages.openmp];
+    buildInputs = with pkgs; [openmpi llvmPackages.openmp zlib];
     buildPhase = "make all BACKEND=simgrid";
     installPhase = ''
       mkdir -p $out/bin
@@ -84,7 +84,7 @@ in {
     version = "0.1.0";
     src = ../.;
     nativeBuildInputs = with pkgs; [simgrid cudatoolkit];
-    buildInputs = with pkgs; [openmpi];
+    buildInputs = with pkgs; [openmpi zlib];
     buildPhase = "make all BACKEND=simgrid_cuda";
     unpackPhase = ''
       mkdir source
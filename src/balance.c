@@ -0,0 +1,327 @@
+#include <limits.h>
+#include <mpi.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "balance.h"
+#include "coordinator.h"
+#include "indexing.h"
+#include "log.h"
+#include "model_cache.h"
+
+// pp, pc, qp and qc followed by the model data
+#define MIGRATED_ARRAYS 20
+
+static void dc_migrated_arrays(dc_process_t *process,
+                               float **arrays[MIGRATED_ARRAYS]) {
+  float **all[MIGRATED_ARRAYS] = {
+      &process->pp,
+      &process->pc,
+      &process->qp,
+      &process->qc,
+      &process->anisotropy_vars.theta,
+      &process->anisotropy_vars.phi,
+      &process->anisotropy_vars.vsv,
+      &process->anisotropy_vars.vpz,
+      &process->anisotropy_vars.epsilon,
+      &process->anisotropy_vars.delta,
+      &process->precomp_vars.ch1dxx,
+      &process->precomp_vars.ch1dyy,
+      &process->precomp_vars.ch1dzz,
+      &process->precomp_vars.ch1dxy,
+      &process->precomp_vars.ch1dyz,
+      &process->precomp_vars.ch1dxz,
+      &process->precomp_vars.v2px,
+      &process->precomp_vars.v2pz,
+      &process->precomp_vars.v2sz,
+      &process->precomp_vars.v2pn,
+  };
+  memcpy(arrays, all, sizeof(all));
+}
+
+// Copy the global region [lo, hi) of every migrated array between a buffer
+// and arrays whose ghost-inclusive box is `box`
+static float *dc_copy_region(float **arrays[MIGRATED_ARRAYS],
+                             const unsigned long box[2 * DIMENSIONS],
+                             const size_t lo[DIMENSIONS],
+                             const size_t hi[DIMENSIONS], float *buffer,
+                             int to_buffer) {
+  for (int a = 0; a < MIGRATED_ARRAYS; a++) {
+    float *array = *arrays[a];
+    for (size_t z = lo[2]; z < hi[2]; z++) {
+      for (size_t y = lo[1]; y < hi[1]; y++) {
+        size_t index = dc_get_index_for_coordinates(
+            lo[0] - box[0], y - box[1], z - box[2], box[3], box[4], box[5]);
+        size_t length = hi[0] - lo[0];
+        if (to_buffer)
+          memcpy(buffer, array + index, length * sizeof(float));
+        else
+          memcpy(array + index, buffer, length * sizeof(float));
+        buffer += length;
+      }
+    }
+  }
+  return buffer;
+}
+
+static void dc_global_sizes(const dc_balance_t *balance,
+                            size_t global_sizes[DIMENSIONS]) {
+  for (int i = 0; i < DIMENSIONS; i++) {
+    global_sizes[i] = 0;
+    for (int r = 0; r < balance->num_ranks; r++) {
+      size_t end = balance->boxes[r][i] + balance->boxes[r][DIMENSIONS + i];
+      if (end > global_sizes[i])
+        global_sizes[i] = end;
+    }
+  }
+}
+
+void dc_balance_init(dc_balance_t *balance, MPI_Comm comm) {
+  memset(balance, 0, sizeof(*balance));
+  MPI_Comm_size(comm, &balance->num_ranks);
+  balance->boxes = malloc(balance->num_ranks * sizeof(*balance->boxes));
+  if (balance->boxes == NULL) {
+    dc_log_error(COORDINATOR, "OOM: could not allocate memory for boxes in "
+                              "dc_balance_init");
+    MPI_Finalize();
+    exit(1);
+  }
+  balance->window_start_time = MPI_Wtime();
+}
+
+void dc_balance_free(dc_balance_t *balance) {
+  free(balance->boxes);
+  balance->boxes = NULL;
+}
+
+int dc_balance_check(dc_balance_t *balance, dc_process_t *process,
+                     MPI_Comm comm, unsigned int iteration) {
+  int size = balance->num_ranks;
+  unsigned long box[2 * DIMENSIONS];
+  for (int i = 0; i < DIMENSIONS; i++) {
+    box[i] = process->start_coords[i];
+    box[DIMENSIONS + i] = process->sizes[i];
+  }
+  MPI_Allgather(box, 2 * DIMENSIONS, MPI_UNSIGNED_LONG, balance->boxes,
+                2 * DIMENSIONS, MPI_UNSIGNED_LONG, comm);
+  double *seconds = malloc(size * sizeof(double));
+  double *weights = malloc(size * sizeof(double));
+  if (seconds == NULL || weights == NULL) {
+    dc_log_error(process->rank, "OOM: could not allocate memory for timings "
+                                "in dc_balance_check");
+    MPI_Finalize();
+    exit(1);
+  }
+  MPI_Allgather(&balance->compute_seconds, 1, MPI_DOUBLE, seconds, 1,
+                MPI_DOUBLE, comm);
+
+  double mean = 0, slowest = 0;
+  for (int r = 0; r < size; r++) {
+    mean += seconds[r] / size;
+    if (seconds[r] > slowest)
+      slowest = seconds[r];
+  }
+  double imbalance = mean > 0 ? slowest / mean : 1;
+  unsigned int window = iteration - balance->window_start;
+  double iteration_ms =
+      (MPI_Wtime() - balance->window_start_time) * 1000.0 / window;
+
+  if (process->rank != COORDINATOR) {
+    balance->previous_imbalance = 0;
+  } else if (balance->previous_imbalance > 0) {
+    dc_log_info(process->rank,
+                "Iterations %u-%u after rebalancing: %.3lf ms per iteration, "
+                "compute imbalance %.3lf (was %.3lf)",
+                balance->window_start, iteration - 1, iteration_ms, imbalance,
+                balance->previous_imbalance);
+    balance->previous_imbalance = 0;
+  } else {
+    dc_log_info(process->rank,
+                "Iterations %u-%u: %.3lf ms per iteration, compute imbalance "
+                "%.3lf",
+                balance->window_start, iteration - 1, iteration_ms, imbalance);
+  }
+
+  int migrate = 0;
+  if (imbalance > process->rebalance_threshold) {
+    // Throughput in cells per second, falling back to the cell count for a
+    // rank too fast to time
+    for (int r = 0; r < size; r++) {
+      double cells = 1;
+      for (int i = 0; i < DIMENSIONS; i++)
+        cells *= balance->boxes[r][DIMENSIONS + i] - 2 * STENCIL;
+      weights[r] = seconds[r] > 0 ? cells / seconds[r] : cells;
+    }
+    size_t global_sizes[DIMENSIONS];
+    dc_global_sizes(balance, global_sizes);
+    if (process->decomposition == DC_DECOMPOSITION_BISECTION)
+      balance->target = dc_partition_bisect(size, global_sizes, weights);
+    else
+      balance->target =
+          dc_partition_create(process->topology, global_sizes, weights);
+
+    for (int r = 0; r < size && !migrate; r++) {
+      int coordinates[DIMENSIONS];
+      size_t sizes[DIMENSIONS], starts[DIMENSIONS];
+      MPI_Cart_coords(comm, r, DIMENSIONS, coordinates);
+      dc_partition_local(&balance->target, coordinates, sizes, starts);
+      for (int i = 0; i < DIMENSIONS; i++) {
+        if (sizes[i] != balance->boxes[r][DIMENSIONS + i] ||
+            starts[i] != balance->boxes[r][i])
+          migrate = 1;
+      }
+    }
+
+    if (migrate) {
+      if (process->rank == COORDINATOR) {
+        dc_log_info(process->rank,
+                    "Rebalancing before iteration %u: compute imbalance "
+                    "%.3lf exceeds %.3lf",
+                    iteration, imbalance, process->rebalance_threshold);
+        dc_partition_log(process->rank, &balance->target, weights);
+      }
+      balance->previous_imbalance = imbalance;
+    } else {
+      if (process->rank == COORDINATOR)
+        dc_log_info(process->rank,
+                  "Compute imbalance %.3lf exceeds %.3lf but no whole plane "
+                  "can move",
+                  imbalance, process->rebalance_threshold);
+      dc_partition_free(&balance->target);
+    }
+  }
+  free(seconds);
+  free(weights);
+
+  balance->compute_seconds = 0;
+  balance->window_start = iteration;
+  balance->window_start_time = MPI_Wtime();
+  return migrate;
+}
+
+void dc_balance_migrate(dc_balance_t *balance, dc_process_t *process,
+                        MPI_Comm comm) {
+  int size = balance->num_ranks;
+  int rank = process->rank;
+  size_t global_sizes[DIMENSIONS];
+  dc_global_sizes(balance, global_sizes);
+
+  unsigned long(*targets)[2 * DIMENSIONS] = malloc(size * sizeof(*targets));
+  int *send_counts = malloc(4 * size * sizeof(int));
+  if (targets == NULL || send_counts == NULL) {
+    dc_log_error(rank, "OOM: could not allocate memory for the migration "
+                       "plan in dc_balance_migrate");
+    MPI_Finalize();
+    exit(1);
+  }
+  int *send_displs = send_counts + size;
+  int *recv_counts = send_counts + 2 * size;
+  int *recv_displs = send_counts + 3 * size;
+
+  for (int r = 0; r < size; r++) {
+    int coordinates[DIMENSIONS];
+    size_t sizes[DIMENSIONS], starts[DIMENSIONS];
+    MPI_Cart_coords(comm, r, DIMENSIONS, coordinates);
+    dc_partition_local(&balance->target, coordinates, sizes, starts);
+    for (int i = 0; i < DIMENSIONS; i++) {
+      targets[r][i] = starts[i];
+      targets[r][DIMENSIONS + i] = sizes[i];
+    }
+  }
+
+  size_t own_lo[DIMENSIONS], own_hi[DIMENSIONS];
+  size_t lo[DIMENSIONS], hi[DIMENSIONS];
+  dc_owned_region(balance->boxes[rank], global_sizes, own_lo, own_hi);
+  // Counts and displacements are in cells of all migrated arrays, which keeps
+  // them within MPI's int range for any box the kernels can address
+  size_t send_total = 0, recv_total = 0;
+  for (int r = 0; r < size; r++) {
+    size_t source_lo[DIMENSIONS], source_hi[DIMENSIONS];
+    dc_owned_region(balance->boxes[r], global_sizes, source_lo, source_hi);
+    send_counts[r] = dc_box_overlap(own_lo, own_hi, targets[r], lo, hi);
+    recv_counts[r] =
+        dc_box_overlap(source_lo, source_hi, targets[rank], lo, hi);
+    send_displs[r] = send_total;
+    recv_displs[r] = recv_total;
+    send_total += send_counts[r];
+    recv_total += recv_counts[r];
+  }
+  if (send_total > INT_MAX || recv_total > INT_MAX) {
+    dc_log_error(rank, "Migration of %zu cells exceeds the MPI count range",
+                 send_total > recv_total ? send_total : recv_total);
+    MPI_Finalize();
+    exit(1);
+  }
+
+  float *send_buffer = malloc(MIGRATED_ARRAYS * send_total * sizeof(float));
+  float *recv_buffer = malloc(MIGRATED_ARRAYS * recv_total * sizeof(float));
+  if (send_buffer == NULL || recv_buffer == NULL) {
+    dc_log_error(rank, "OOM: could not allocate migration buffers");
+    MPI_Finalize();
+    exit(1);
+  }
+
+  // The bricked layout frees the flat coefficients while it runs
+  dc_model_restore_precomp(process);
+  float **arrays[MIGRATED_ARRAYS];
+  dc_migrated_arrays(process, arrays);
+  for (int r = 0; r < size; r++) {
+    if (dc_box_overlap(own_lo, own_hi, targets[r], lo, hi) > 0)
+      dc_copy_region(arrays, balance->boxes[rank], lo, hi,
+                     send_buffer + MIGRATED_ARRAYS * send_displs[r], 1);
+  }
+
+  MPI_Datatype cell;
+  MPI_Type_contiguous(MIGRATED_ARRAYS, MPI_FLOAT, &cell);
+  MPI_Type_commit(&cell);
+  MPI_Alltoallv(send_buffer, send_counts, send_displs, cell, recv_buffer,
+                recv_counts, recv_displs, cell, comm);
+  MPI_Type_free(&cell);
+  free(send_buffer);
+
+  size_t new_sizes[DIMENSIONS] = {targets[rank][3], targets[rank][4],
+                                  targets[rank][5]};
+  size_t count = dc_compute_count_from_sizes(new_sizes);
+  for (int a = 0; a < 4; a++)
+    free(*arrays[a]);
+  // The migrated model no longer matches any cache file, so it is allocated
+  dc_model_free(process);
+  for (int a = 0; a < MIGRATED_ARRAYS; a++) {
+    *arrays[a] = malloc(count * sizeof(float));
+    if (*arrays[a] == NULL) {
+      dc_log_error(rank, "OOM: could not allocate migrated arrays");
+      MPI_Finalize();
+      exit(1);
+    }
+  }
+  for (int r = 0; r < size; r++) {
+    size_t source_lo[DIMENSIONS], source_hi[DIMENSIONS];
+    dc_owned_region(balance->boxes[r], global_sizes, source_lo, source_hi);
+    if (dc_box_overlap(source_lo, source_hi, targets[rank], lo, hi) > 0)
+      dc_copy_region(arrays, targets[rank], lo, hi,
+                     recv_buffer + MIGRATED_ARRAYS * recv_displs[r], 0);
+  }
+  free(recv_buffer);
+
+  for (int i = 0; i < DIMENSIONS; i++) {
+    process->start_coords[i] = targets[rank][i];
+    process->sizes[i] = targets[rank][DIMENSIONS + i];
+  }
+  process->source_index = dc_local_source_index(
+      global_sizes, process->sizes, process->start_coords);
+  if (!dc_local_offsets_fit(process->sizes)) {
+    dc_log_error(rank, "Planes of %zu x %zu cells are too large for 32-bit "
+                       "kernel offsets",
+                 process->sizes[0], process->sizes[1]);
+    MPI_Finalize();
+    exit(1);
+  }
+  dc_log_info(rank, "Now holding %zu x %zu x %zu cells from %zu %zu %zu",
+              process->sizes[0], process->sizes[1], process->sizes[2],
+              process->start_coords[0], process->start_coords[1],
+              process->start_coords[2]);
+
+  free(targets);
+  free(send_counts);
+  dc_partition_free(&balance->target);
+}
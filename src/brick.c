@@ -0,0 +1,42 @@
+#include <string.h>
+
+#include "brick.h"
+
+void dc_brick_pack(const float *bricked, const size_t bricks[DIMENSIONS],
+                   const size_t starts[DIMENSIONS],
+                   const size_t ends[DIMENSIONS], float *buffer, size_t row,
+                   size_t plane) {
+  for (size_t z = starts[2]; z < ends[2]; z++) {
+    for (size_t y = starts[1]; y < ends[1]; y++) {
+      float *to = buffer + (z - starts[2]) * plane + (y - starts[1]) * row;
+      for (size_t x = starts[0]; x < ends[0];) {
+        size_t run = DC_BRICK - x % DC_BRICK;
+        if (run > ends[0] - x)
+          run = ends[0] - x;
+        memcpy(to + (x - starts[0]), bricked + dc_brick_index(x, y, z, bricks),
+               run * sizeof(float));
+        x += run;
+      }
+    }
+  }
+}
+
+void dc_brick_unpack(float *bricked, const size_t bricks[DIMENSIONS],
+                     const size_t starts[DIMENSIONS],
+                     const size_t ends[DIMENSIONS], const float *buffer,
+                     size_t row, size_t plane) {
+  for (size_t z = starts[2]; z < ends[2]; z++) {
+    for (size_t y = starts[1]; y < ends[1]; y++) {
+      const float *from =
+          buffer + (z - starts[2]) * plane + (y - starts[1]) * row;
+      for (size_t x = starts[0]; x < ends[0];) {
+        size_t run = DC_BRICK - x % DC_BRICK;
+        if (run > ends[0] - x)
+          run = ends[0] - x;
+        memcpy(bricked + dc_brick_index(x, y, z, bricks), from + (x - starts[0]),
+               run * sizeof(float));
+        x += run;
+      }
+    }
+  }
+}
@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chunked.h"
+
+void dc_chunked_counts(const dc_chunked_header_t *header,
+                       uint64_t chunks[DIMENSIONS]) {
+  for (int i = 0; i < DIMENSIONS; i++)
+    chunks[i] = (header->sizes[i] + header->chunk[i] - 1) / header->chunk[i];
+}
+
+static uint64_t dc_chunked_total(const dc_chunked_t *chunked) {
+  return chunked->chunks[0] * chunked->chunks[1] * chunked->chunks[2];
+}
+
+// Global position and sizes of chunk `c`
+static uint64_t dc_chunk_box(const dc_chunked_t *chunked, uint64_t c,
+                             uint64_t start[DIMENSIONS],
+                             uint64_t sizes[DIMENSIONS]) {
+  const uint64_t position[DIMENSIONS] = {
+      c % chunked->chunks[0], c / chunked->chunks[0] % chunked->chunks[1],
+      c / (chunked->chunks[0] * chunked->chunks[1])};
+  uint64_t count = 1;
+  for (int i = 0; i < DIMENSIONS; i++) {
+    start[i] = position[i] * chunked->header.chunk[i];
+    sizes[i] = chunked->header.sizes[i] - start[i] < chunked->header.chunk[i]
+                   ? chunked->header.sizes[i] - start[i]
+                   : chunked->header.chunk[i];
+    count *= sizes[i];
+  }
+  return count;
+}
+
+int dc_chunked_create(dc_chunked_t *chunked, const char *path,
+                      const dc_chunked_header_t *header, int level) {
+  memset(chunked, 0, sizeof(*chunked));
+  chunked->header = *header;
+  chunked->level = level;
+  dc_chunked_counts(header, chunked->chunks);
+  chunked->index = (dc_chunk_entry_t *)calloc(
+      header->fields * dc_chunked_total(chunked), sizeof(dc_chunk_entry_t));
+  chunked->file = fopen(path, "wb");
+  if (chunked->index == NULL || chunked->file == NULL ||
+      fwrite(header, sizeof(*header), 1, chunked->file) != 1) {
+    dc_chunked_close(chunked);
+    return 0;
+  }
+  return 1;
+}
+
+int dc_chunked_write(dc_chunked_t *chunked, int field, uint64_t c,
+                     const float *cells) {
+  uint64_t start[DIMENSIONS], sizes[DIMENSIONS];
+  const uint64_t count = dc_chunk_box(chunked, c, start, sizes);
+  dc_chunk_entry_t *entry =
+      &chunked->index[field * dc_chunked_total(chunked) + c];
+  entry->offset = ftell(chunked->file);
+
+  unsigned char *stored = (unsigned char *)malloc(dc_codec_bound(count));
+  if (stored == NULL)
+    return 0;
+  entry->bytes = dc_codec_encode((dc_codec_t)chunked->header.codec,
+                                 chunked->level, cells, count, stored);
+  int written = fwrite(stored, 1, entry->bytes, chunked->file) == entry->bytes;
+  free(stored);
+  return written;
+}
+
+int dc_chunked_finish(dc_chunked_t *chunked) {
+  const uint64_t entries = chunked->header.fields * dc_chunked_total(chunked);
+  chunked->header.index_offset = ftell(chunked->file);
+  int written = fwrite(chunked->index, sizeof(dc_chunk_entry_t), entries,
+                       chunked->file) == entries &&
+                fseek(chunked->file, 0, SEEK_SET) == 0 &&
+                fwrite(&chunked->header, sizeof(chunked->header), 1,
+                       chunked->file) == 1;
+  written = fclose(chunked->file) == 0 && written;
+  chunked->file = NULL;
+  dc_chunked_close(chunked);
+  return written;
+}
+
+int dc_chunked_open(dc_chunked_t *chunked, const char *path) {
+  memset(chunked, 0, sizeof(*chunked));
+  chunked->file = fopen(path, "rb");
+  if (chunked->file == NULL ||
+      fread(&chunked->header, sizeof(chunked->header), 1, chunked->file) !=
+          1 ||
+      memcmp(chunked->header.magic, DC_CHUNKED_MAGIC,
+             sizeof(DC_CHUNKED_MAGIC)) != 0 ||
+      chunked->header.version != DC_CHUNKED_VERSION ||
+      chunked->header.fields > DC_CHUNKED_FIELDS) {
+    dc_chunked_close(chunked);
+    return 0;
+  }
+  for (int i = 0; i < DIMENSIONS; i++) {
+    if (chunked->header.chunk[i] == 0) {
+      dc_chunked_close(chunked);
+      return 0;
+    }
+  }
+  dc_chunked_counts(&chunked->header, chunked->chunks);
+  const uint64_t entries = chunked->header.fields * dc_chunked_total(chunked);
+  chunked->index =
+      (dc_chunk_entry_t *)malloc(entries * sizeof(dc_chunk_entry_t));
+  if (chunked->index == NULL ||
+      fseek(chunked->file, chunked->header.index_offset, SEEK_SET) != 0 ||
+      fread(chunked->index, sizeof(dc_chunk_entry_t), entries,
+            chunked->file) != entries) {
+    dc_chunked_close(chunked);
+    return 0;
+  }
+  return 1;
+}
+
+int dc_chunked_read_box(dc_chunked_t *chunked, int field,
+                        const uint64_t lo[DIMENSIONS],
+                        const uint64_t hi[DIMENSIONS], float *cells) {
+  uint64_t first[DIMENSIONS], last[DIMENSIONS], out[DIMENSIONS];
+  for (int i = 0; i < DIMENSIONS; i++) {
+    if (lo[i] >= hi[i] || hi[i] > chunked->header.sizes[i])
+      return 0;
+    first[i] = lo[i] / chunked->header.chunk[i];
+    last[i] = (hi[i] - 1) / chunked->header.chunk[i];
+    out[i] = hi[i] - lo[i];
+  }
+  const int descriptor = fileno(chunked->file);
+  const uint64_t across[DIMENSIONS] = {last[0] - first[0] + 1,
+                                       last[1] - first[1] + 1,
+                                       last[2] - first[2] + 1};
+  const uint64_t touched = across[0] * across[1] * across[2];
+  const size_t largest = chunked->header.chunk[0] * chunked->header.chunk[1] *
+                         chunked->header.chunk[2] * sizeof(float);
+  int failed = 0;
+
+#pragma omp parallel reduction(| : failed)
+  {
+    // Stored bytes, then the shuffled bytes, then the cells
+    unsigned char *scratch = (unsigned char *)malloc(3 * largest);
+    failed = scratch == NULL;
+#pragma omp for schedule(dynamic)
+    for (uint64_t t = 0; t < touched; t++) {
+      if (failed)
+        continue;
+      const uint64_t c =
+          (first[2] + t / (across[0] * across[1])) * chunked->chunks[0] *
+              chunked->chunks[1] +
+          (first[1] + t / across[0] % across[1]) * chunked->chunks[0] +
+          first[0] + t % across[0];
+      uint64_t start[DIMENSIONS], sizes[DIMENSIONS];
+      const uint64_t count = dc_chunk_box(chunked, c, start, sizes);
+      const uint64_t raw = count * sizeof(float);
+      const dc_chunk_entry_t *entry =
+          &chunked->index[field * dc_chunked_total(chunked) + c];
+      if (entry->bytes > raw ||
+          pread(descriptor, scratch, entry->bytes, entry->offset) !=
+              (ssize_t)entry->bytes) {
+        failed = 1;
+        continue;
+      }
+      float *chunk = (float *)(scratch + 2 * largest);
+      if (!dc_codec_decode(scratch, entry->bytes, count, chunk,
+                           scratch + largest)) {
+        failed = 1;
+        continue;
+      }
+
+      uint64_t from[DIMENSIONS], to[DIMENSIONS];
+      for (int i = 0; i < DIMENSIONS; i++) {
+        from[i] = start[i] > lo[i] ? start[i] : lo[i];
+        to[i] = start[i] + sizes[i] < hi[i] ? start[i] + sizes[i] : hi[i];
+      }
+      for (uint64_t z = from[2]; z < to[2]; z++) {
+        for (uint64_t y = from[1]; y < to[1]; y++) {
+          memcpy(cells + ((z - lo[2]) * out[1] + (y - lo[1])) * out[0] +
+                     (from[0] - lo[0]),
+                 chunk + ((z - start[2]) * sizes[1] + (y - start[1])) *
+                             sizes[0] +
+                     (from[0] - start[0]),
+                 (to[0] - from[0]) * sizeof(float));
+        }
+      }
+    }
+    free(scratch);
+  }
+  return !failed;
+}
+
+void dc_chunked_close(dc_chunked_t *chunked) {
+  if (chunked->file != NULL)
+    fclose(chunked->file);
+  free(chunked->index);
+  chunked->file = NULL;
+  chunked->index = NULL;
+}
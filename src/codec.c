@@ -0,0 +1,58 @@
+#include <string.h>
+#include <zlib.h>
+
+#include "codec.h"
+
+// Byte planes of the floats one after the other, which leaves the exponents
+// and high mantissa bytes in long similar runs
+static void dc_shuffle(const float *cells, size_t count,
+                       unsigned char *bytes) {
+  const unsigned char *from = (const unsigned char *)cells;
+  for (size_t i = 0; i < count; i++)
+    for (size_t b = 0; b < sizeof(float); b++)
+      bytes[b * count + i] = from[i * sizeof(float) + b];
+}
+
+static void dc_unshuffle(const unsigned char *bytes, size_t count,
+                         float *cells) {
+  unsigned char *to = (unsigned char *)cells;
+  for (size_t i = 0; i < count; i++)
+    for (size_t b = 0; b < sizeof(float); b++)
+      to[i * sizeof(float) + b] = bytes[b * count + i];
+}
+
+size_t dc_codec_bound(size_t count) {
+  const size_t raw = count * sizeof(float);
+  // The shuffled copy sits in front of the compressed bytes
+  return raw + compressBound(raw);
+}
+
+size_t dc_codec_encode(dc_codec_t codec, int level, const float *cells,
+                       size_t count, unsigned char *stored) {
+  const size_t raw = count * sizeof(float);
+  if (codec == DC_CODEC_DEFLATE) {
+    unsigned char *shuffled = stored + compressBound(raw);
+    uLongf bytes = compressBound(raw);
+    dc_shuffle(cells, count, shuffled);
+    if (compress2(stored, &bytes, shuffled, raw, level) == Z_OK &&
+        bytes < raw)
+      return bytes;
+  }
+  memcpy(stored, cells, raw);
+  return raw;
+}
+
+int dc_codec_decode(const unsigned char *stored, size_t bytes, size_t count,
+                    float *cells, unsigned char *scratch) {
+  const size_t raw = count * sizeof(float);
+  if (bytes == raw) {
+    memcpy(cells, stored, raw);
+    return 1;
+  }
+  uLongf decoded = raw;
+  if (bytes > raw || uncompress(scratch, &decoded, stored, bytes) != Z_OK ||
+      decoded != raw)
+    return 0;
+  dc_unshuffle(scratch, count, cells);
+  return 1;
+}
@@ -1,11 +1,12 @@
-#include <math.h>
 #include <mpi.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "chunked.h"
 #include "coordinator.h"
 #include "indexing.h"
 #include "log.h"
+#include "rank_file.h"
 #include "stdlib.h"
 
 void dc_determine_source(size_t size_x, size_t size_y, size_t size_z,
@@ -15,102 +16,97 @@ void dc_determine_source(size_t size_x, size_t size_y, size_t size_z,
   *source_z = size_z / 2;
 }
 
-// Lightweight distribution: only sends partition info, workers compute locally
-void dc_distribute_partition_info(MPI_Comm comm, unsigned int *topology,
-                                  dc_arguments_t arguments,
-                                  size_t num_workers) {
-  size_t global_sx =
-      arguments.size_x + 2 * arguments.absorption_size + 2 * STENCIL;
-  size_t global_sy =
-      arguments.size_y + 2 * arguments.absorption_size + 2 * STENCIL;
-  size_t global_sz =
-      arguments.size_z + 2 * arguments.absorption_size + 2 * STENCIL;
-
-  size_t partition_size_x = (global_sx - 2 * STENCIL) / topology[0];
-  size_t partition_size_y = (global_sy - 2 * STENCIL) / topology[1];
-  size_t partition_size_z = (global_sz - 2 * STENCIL) / topology[2];
-  size_t remainder_x = (global_sx - 2 * STENCIL) % topology[0];
-  size_t remainder_y = (global_sy - 2 * STENCIL) % topology[1];
-  size_t remainder_z = (global_sz - 2 * STENCIL) % topology[2];
-
-  unsigned int iterations = ceil(arguments.time_max / arguments.dt);
-
-  size_t source_x, source_y, source_z;
-  dc_determine_source(global_sx, global_sy, global_sz, &source_x, &source_y,
-                      &source_z);
-
-  dc_log_info(COORDINATOR, "Distributing partition info to %zu workers...",
-              num_workers);
-  dc_log_info(COORDINATOR, "Global sizes: %zu x %zu x %zu", global_sx,
-              global_sy, global_sz);
-  dc_log_info(COORDINATOR, "Partition sizes: %zu x %zu x %zu", partition_size_x,
-              partition_size_y, partition_size_z);
-
-  for (size_t worker_z = 0; worker_z < topology[2]; worker_z++) {
-    for (size_t worker_y = 0; worker_y < topology[1]; worker_y++) {
-      for (size_t worker_x = 0; worker_x < topology[0]; worker_x++) {
-        int process_coordinates[DIMENSIONS] = {(int)worker_x, (int)worker_y,
-                                               (int)worker_z};
-        int worker;
-        MPI_Cart_rank(comm, process_coordinates, &worker);
-
-        if (worker == COORDINATOR)
-          continue;
-
-        size_t local_size_x = (worker_x == topology[0] - 1)
-                                  ? partition_size_x + remainder_x
-                                  : partition_size_x;
-        size_t local_size_y = (worker_y == topology[1] - 1)
-                                  ? partition_size_y + remainder_y
-                                  : partition_size_y;
-        size_t local_size_z = (worker_z == topology[2] - 1)
-                                  ? partition_size_z + remainder_z
-                                  : partition_size_z;
-        local_size_x += 2 * STENCIL;
-        local_size_y += 2 * STENCIL;
-        local_size_z += 2 * STENCIL;
-
-        size_t start_x = worker_x * partition_size_x;
-        size_t start_y = worker_y * partition_size_y;
-        size_t start_z = worker_z * partition_size_z;
-
-        int source_index = -1;
-        if (source_x >= start_x && source_x < start_x + local_size_x &&
-            source_y >= start_y && source_y < start_y + local_size_y &&
-            source_z >= start_z && source_z < start_z + local_size_z) {
-          size_t local_source_x = source_x - start_x;
-          size_t local_source_y = source_y - start_y;
-          size_t local_source_z = source_z - start_z;
-          source_index = (int)dc_get_index_for_coordinates(
-              local_source_x, local_source_y, local_source_z, local_size_x,
-              local_size_y, local_size_z);
-          dc_log_info(COORDINATOR,
-                      "Worker %d will handle source at local index %d", worker,
-                      source_index);
-        }
+ptrdiff_t dc_local_source_index(const size_t global_sizes[DIMENSIONS],
+                                const size_t local_sizes[DIMENSIONS],
+                                const size_t start_coords[DIMENSIONS]) {
+  size_t source[DIMENSIONS];
+  dc_determine_source(global_sizes[0], global_sizes[1], global_sizes[2],
+                      &source[0], &source[1], &source[2]);
+  for (int i = 0; i < DIMENSIONS; i++) {
+    if (source[i] < start_coords[i] ||
+        source[i] >= start_coords[i] + local_sizes[i])
+      return -1;
+  }
+  return (ptrdiff_t)dc_get_index_for_coordinates(
+      source[0] - start_coords[0], source[1] - start_coords[1],
+      source[2] - start_coords[2], local_sizes[0], local_sizes[1],
+      local_sizes[2]);
+}
 
-        dc_partition_info_t info;
-        info.local_sizes[0] = local_size_x;
-        info.local_sizes[1] = local_size_y;
-        info.local_sizes[2] = local_size_z;
-        info.global_sizes[0] = global_sx;
-        info.global_sizes[1] = global_sy;
-        info.global_sizes[2] = global_sz;
-        info.start_coords[0] = start_x;
-        info.start_coords[1] = start_y;
-        info.start_coords[2] = start_z;
-        info.problem_sizes[0] = arguments.size_x;
-        info.problem_sizes[1] = arguments.size_y;
-        info.problem_sizes[2] = arguments.size_z;
-        info.iterations = iterations;
-        info.source_index = source_index;
-        info.absorption_size = arguments.absorption_size;
-
-        MPI_Send(&info, sizeof(dc_partition_info_t), MPI_BYTE, worker, 0, comm);
-        dc_log_info(COORDINATOR, "Sent partition info to worker %d", worker);
-      }
+void dc_send_floats(const float *data, size_t count, int destination,
+                    MPI_Comm comm) {
+  for (size_t sent = 0; sent < count; sent += DC_MPI_CHUNK) {
+    size_t chunk = count - sent < DC_MPI_CHUNK ? count - sent : DC_MPI_CHUNK;
+    MPI_Send(data + sent, (int)chunk, MPI_FLOAT, destination, 0, comm);
+  }
+}
+
+void dc_receive_floats(float *data, size_t count, int source, MPI_Comm comm) {
+  for (size_t received = 0; received < count; received += DC_MPI_CHUNK) {
+    size_t chunk =
+        count - received < DC_MPI_CHUNK ? count - received : DC_MPI_CHUNK;
+    MPI_Recv(data + received, (int)chunk, MPI_FLOAT, source, 0, comm,
+             MPI_STATUS_IGNORE);
+  }
+}
+
+size_t dc_rank_pack(const dc_process_t *process, uint64_t iteration,
+                    dc_rank_header_t *header, float *fields) {
+  const dc_rank_header_t empty = {DC_RANK_MAGIC, DC_RANK_VERSION};
+  *header = empty;
+  header->ranks = (uint32_t)process->num_workers;
+  header->iteration = iteration;
+  for (int i = 0; i < DIMENSIONS; i++) {
+    header->global_sizes[i] = process->global_sizes[i];
+    header->starts[i] = process->start_coords[i] + STENCIL;
+    header->sizes[i] = process->sizes[i] - 2 * STENCIL;
+  }
+  const size_t count = dc_rank_cells(header);
+  if (fields == NULL)
+    return count;
+
+  float *p = fields;
+  float *q = p + count;
+  const size_t row = header->sizes[0];
+  for (size_t z = 0; z < header->sizes[2]; z++) {
+    for (size_t y = 0; y < header->sizes[1]; y++) {
+      size_t from = dc_get_index_for_coordinates(
+          STENCIL, y + STENCIL, z + STENCIL, process->sizes[0],
+          process->sizes[1], process->sizes[2]);
+      size_t to = (z * header->sizes[1] + y) * row;
+      memcpy(p + to, process->pc + from, row * sizeof(float));
+      memcpy(q + to, process->qc + from, row * sizeof(float));
     }
   }
+  return count;
+}
+
+void dc_write_rank_results(const dc_process_t *process,
+                           const char *output_file, uint64_t iteration,
+                           int level) {
+  dc_rank_header_t header;
+  const size_t count = dc_rank_pack(process, iteration, &header, NULL);
+  float *fields = (float *)malloc(2 * count * sizeof(float));
+  if (fields == NULL) {
+    dc_log_error(process->rank,
+                 "OOM: could not allocate memory in dc_write_rank_results");
+    MPI_Finalize();
+    exit(1);
+  }
+  dc_rank_pack(process, iteration, &header, fields);
+  header.codec = level > 0 ? DC_CODEC_DEFLATE : DC_CODEC_NONE;
+
+  char path[4096];
+  dc_rank_file_path(path, sizeof(path), output_file, process->rank);
+  FILE *output = fopen(path, "wb");
+  if (output == NULL ||
+      !dc_rank_record_write(output, &header, fields, level) ||
+      fclose(output) != 0) {
+    dc_log_error(process->rank, "Failed to write output file: %s", path);
+    MPI_Finalize();
+    exit(1);
+  }
+  free(fields);
 }
 
 void dc_receive_and_write_results(dc_process_t coordinator_process,
@@ -130,13 +126,6 @@ void dc_receive_and_write_results(dc_process_t coordinator_process,
   fseek(output, (2 * total_size - 1) * sizeof(float), SEEK_SET);
   fwrite(&zero, sizeof(float), 1, output);
 
-  size_t partition_size_x =
-      (global_sx - 2 * STENCIL) / coordinator_process.topology[0];
-  size_t partition_size_y =
-      (global_sy - 2 * STENCIL) / coordinator_process.topology[1];
-  size_t partition_size_z =
-      (global_sz - 2 * STENCIL) / coordinator_process.topology[2];
-
   for (int worker_x = 0; worker_x < coordinator_process.topology[0];
        worker_x++) {
     for (int worker_y = 0; worker_y < coordinator_process.topology[1];
@@ -148,6 +137,7 @@ void dc_receive_and_write_results(dc_process_t coordinator_process,
         MPI_Cart_rank(comm, worker_coords, &worker_rank);
 
         size_t worker_sizes[DIMENSIONS];
+        size_t worker_starts[DIMENSIONS];
         float *pc, *qc;
         size_t worker_count;
         int need_free = 0;
@@ -155,12 +145,16 @@ void dc_receive_and_write_results(dc_process_t coordinator_process,
         if (worker_rank == COORDINATOR) {
           memcpy(worker_sizes, coordinator_process.sizes,
                  sizeof(size_t) * DIMENSIONS);
+          memcpy(worker_starts, coordinator_process.start_coords,
+                 sizeof(size_t) * DIMENSIONS);
           pc = coordinator_process.pc;
           qc = coordinator_process.qc;
           worker_count = dc_compute_count_from_sizes(worker_sizes);
         } else {
           MPI_Recv(worker_sizes, DIMENSIONS, MPI_UNSIGNED_LONG, worker_rank, 0,
                    comm, MPI_STATUS_IGNORE);
+          MPI_Recv(worker_starts, DIMENSIONS, MPI_UNSIGNED_LONG, worker_rank,
+                   0, comm, MPI_STATUS_IGNORE);
           worker_count = dc_compute_count_from_sizes(worker_sizes);
 
           pc = (float *)malloc(worker_count * sizeof(float));
@@ -174,25 +168,18 @@ void dc_receive_and_write_results(dc_process_t coordinator_process,
           }
           need_free = 1;
 
-          MPI_Recv(pc, worker_count, MPI_FLOAT, worker_rank, 0, comm,
-                   MPI_STATUS_IGNORE);
-          MPI_Recv(qc, worker_count, MPI_FLOAT, worker_rank, 0, comm,
-                   MPI_STATUS_IGNORE);
+          dc_receive_floats(pc, worker_count, worker_rank, comm);
+          dc_receive_floats(qc, worker_count, worker_rank, comm);
         }
 
         for (size_t z = STENCIL; z < worker_sizes[2] - STENCIL; z++) {
           for (size_t y = STENCIL; y < worker_sizes[1] - STENCIL; y++) {
             for (size_t x = STENCIL; x < worker_sizes[0] - STENCIL; x++) {
-              size_t local_x = x - STENCIL;
-              size_t local_y = y - STENCIL;
-              size_t local_z = z - STENCIL;
               size_t worker_index = dc_get_index_for_coordinates(
                   x, y, z, worker_sizes[0], worker_sizes[1], worker_sizes[2]);
               size_t global_index = dc_get_index_for_coordinates(
-                  STENCIL + worker_coords[0] * partition_size_x + local_x,
-                  STENCIL + worker_coords[1] * partition_size_y + local_y,
-                  STENCIL + worker_coords[2] * partition_size_z + local_z,
-                  global_sx, global_sy, global_sz);
+                  worker_starts[0] + x, worker_starts[1] + y,
+                  worker_starts[2] + z, global_sx, global_sy, global_sz);
 
               fseek(output, global_index * sizeof(float), SEEK_SET);
               fwrite(&pc[worker_index], sizeof(float), 1, output);
@@ -217,3 +204,167 @@ void dc_receive_and_write_results(dc_process_t coordinator_process,
 
   fclose(output);
 }
+
+// Cells a rank owns: its box without ghosts
+static void dc_owned_box(const size_t start_coords[DIMENSIONS],
+                         const size_t sizes[DIMENSIONS],
+                         uint64_t box[2 * DIMENSIONS]) {
+  for (int i = 0; i < DIMENSIONS; i++) {
+    box[i] = start_coords[i] + STENCIL;
+    box[DIMENSIONS + i] = sizes[i] - 2 * STENCIL;
+  }
+}
+
+// Rows of planes [z0, z1) of an owned box, p then q, from a rank's arrays
+static void dc_pack_planes(const dc_process_t *process,
+                           const uint64_t box[2 * DIMENSIONS], uint64_t z0,
+                           uint64_t z1, float *buffer) {
+  const uint64_t row = box[DIMENSIONS], rows = box[DIMENSIONS + 1];
+  const size_t count = (z1 - z0) * rows * row;
+  for (uint64_t z = z0; z < z1; z++) {
+    for (uint64_t y = 0; y < rows; y++) {
+      size_t from = dc_get_index_for_coordinates(
+          STENCIL, y + STENCIL, z - process->start_coords[2],
+          process->sizes[0], process->sizes[1], process->sizes[2]);
+      size_t to = ((z - z0) * rows + y) * row;
+      memcpy(buffer + to, process->pc + from, row * sizeof(float));
+      memcpy(buffer + count + to, process->qc + from, row * sizeof(float));
+    }
+  }
+}
+
+void dc_gather_and_write_chunked(const dc_process_t *process, MPI_Comm comm,
+                                 const dc_arguments_t *arguments) {
+  int ranks;
+  MPI_Comm_size(comm, &ranks);
+  uint64_t own[2 * DIMENSIONS];
+  dc_owned_box(process->start_coords, process->sizes, own);
+  uint64_t *boxes = (uint64_t *)malloc(ranks * sizeof(own));
+  if (boxes == NULL) {
+    dc_log_error(process->rank, "OOM: could not allocate the rank boxes");
+    MPI_Finalize();
+    exit(1);
+  }
+  MPI_Gather(own, 2 * DIMENSIONS, MPI_UINT64_T, boxes, 2 * DIMENSIONS,
+             MPI_UINT64_T, COORDINATOR, comm);
+
+  dc_chunked_header_t header = {
+      .magic = DC_CHUNKED_MAGIC,
+      .version = DC_CHUNKED_VERSION,
+      .fields = DC_CHUNKED_FIELDS,
+      .field_names = {"p", "q"},
+      .padding = arguments->absorption_size + STENCIL,
+      .dx = process->dx,
+      .dy = process->dy,
+      .dz = process->dz,
+      .dt = process->dt,
+      .iteration = process->iterations,
+      .codec = arguments->output_compression != 0 ? DC_CODEC_DEFLATE
+                                                  : DC_CODEC_NONE,
+  };
+  for (int i = 0; i < DIMENSIONS; i++) {
+    header.sizes[i] = process->global_sizes[i];
+    header.chunk[i] = arguments->output_chunk;
+  }
+  const uint64_t *sizes = header.sizes, depth = header.chunk[2];
+  const size_t plane = sizes[0] * sizes[1];
+
+  // Buffers: the received planes of one rank, and on the coordinator one
+  // layer of the global grid and one chunk
+  float *received = (float *)malloc(2 * depth * plane * sizeof(float));
+  float *layer = NULL, *chunk = NULL;
+  dc_chunked_t chunked;
+  if (process->rank == COORDINATOR) {
+    layer = (float *)malloc(2 * depth * plane * sizeof(float));
+    chunk = (float *)malloc(header.chunk[0] * header.chunk[1] * depth *
+                            sizeof(float));
+    if (layer != NULL && chunk != NULL &&
+        !dc_chunked_create(&chunked, arguments->output_file, &header,
+                           arguments->output_compression)) {
+      dc_log_error(COORDINATOR, "Failed to open output file: %s",
+                   arguments->output_file);
+      MPI_Abort(comm, 1);
+    }
+  }
+  if (received == NULL || (process->rank == COORDINATOR &&
+                           (layer == NULL || chunk == NULL))) {
+    dc_log_error(process->rank,
+                 "OOM: could not allocate the output layer buffers");
+    MPI_Finalize();
+    exit(1);
+  }
+
+  for (uint64_t z0 = 0; z0 < sizes[2]; z0 += depth) {
+    const uint64_t z1 = z0 + depth < sizes[2] ? z0 + depth : sizes[2];
+    if (process->rank != COORDINATOR) {
+      uint64_t from = own[2] > z0 ? own[2] : z0;
+      uint64_t to = own[2] + own[5] < z1 ? own[2] + own[5] : z1;
+      if (from < to) {
+        dc_pack_planes(process, own, from, to, received);
+        dc_send_floats(received, 2 * (to - from) * own[3] * own[4],
+                       COORDINATOR, comm);
+      }
+      continue;
+    }
+
+    float *p = layer, *q = layer + (z1 - z0) * plane;
+    memset(layer, 0, 2 * (z1 - z0) * plane * sizeof(float));
+    for (int r = 0; r < ranks; r++) {
+      const uint64_t *box = boxes + 2 * DIMENSIONS * r;
+      uint64_t from = box[2] > z0 ? box[2] : z0;
+      uint64_t to = box[2] + box[5] < z1 ? box[2] + box[5] : z1;
+      if (from >= to)
+        continue;
+      const size_t count = (to - from) * box[3] * box[4];
+      if (r == COORDINATOR)
+        dc_pack_planes(process, box, from, to, received);
+      else
+        dc_receive_floats(received, 2 * count, r, comm);
+      for (uint64_t z = from; z < to; z++) {
+        for (uint64_t y = 0; y < box[4]; y++) {
+          size_t source = ((z - from) * box[4] + y) * box[3];
+          size_t target = (z - z0) * plane + (box[1] + y) * sizes[0] + box[0];
+          memcpy(p + target, received + source, box[3] * sizeof(float));
+          memcpy(q + target, received + count + source,
+                 box[3] * sizeof(float));
+        }
+      }
+    }
+
+    // Cut the layer into its chunks
+    const uint64_t chunks_x = chunked.chunks[0], chunks_y = chunked.chunks[1];
+    for (uint64_t c = 0; c < chunks_x * chunks_y; c++) {
+      const uint64_t x0 = c % chunks_x * header.chunk[0];
+      const uint64_t y0 = c / chunks_x * header.chunk[1];
+      const uint64_t nx =
+          sizes[0] - x0 < header.chunk[0] ? sizes[0] - x0 : header.chunk[0];
+      const uint64_t ny =
+          sizes[1] - y0 < header.chunk[1] ? sizes[1] - y0 : header.chunk[1];
+      const uint64_t index = z0 / depth * chunks_x * chunks_y + c;
+      for (int field = 0; field < DC_CHUNKED_FIELDS; field++) {
+        const float *from = field == 0 ? p : q;
+        for (uint64_t z = 0; z < z1 - z0; z++)
+          for (uint64_t y = 0; y < ny; y++)
+            memcpy(chunk + (z * ny + y) * nx,
+                   from + z * plane + (y0 + y) * sizes[0] + x0,
+                   nx * sizeof(float));
+        if (!dc_chunked_write(&chunked, field, index, chunk)) {
+          dc_log_error(COORDINATOR, "Failed to write output file: %s",
+                       arguments->output_file);
+          MPI_Abort(comm, 1);
+        }
+      }
+    }
+  }
+
+  if (process->rank == COORDINATOR &&
+      !dc_chunked_finish(&chunked)) {
+    dc_log_error(COORDINATOR, "Failed to write output file: %s",
+                 arguments->output_file);
+    MPI_Abort(comm, 1);
+  }
+  free(received);
+  free(layer);
+  free(chunk);
+  free(boxes);
+}
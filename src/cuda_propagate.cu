@@ -14,7 +14,8 @@ propagate_kernel(const size_t start_x, const size_t start_y, const size_t start_
                  const int topology_x, const int topology_y, const int topology_z,
                  const float dx, const float dy, const float dz, const float dt,
                  float *pp, float *pc, float *qp, float *qc,
-                 const float *vpz, const float *vsv) {
+                 const float *vpz, const float *vsv,
+                 const dc_physics_t physics) {
   const size_t x = start_x + blockIdx.x * blockDim.x + threadIdx.x;
   const size_t y = start_y + blockIdx.y * blockDim.y + threadIdx.y;
 
@@ -25,10 +26,16 @@ propagate_kernel(const size_t start_x, const size_t start_y, const size_t start_
   for (size_t z = start_z; z < end_z; z++) {
     sample_compute_optimized(x, y, z, size_x, size_y, size_z, process_coord_x,
                              process_coord_y, process_coord_z, topology_x, topology_y,
-                             topology_z, dx, dy, dz, dt, pc, qc, pp, qp, vpz, vsv);
+                             topology_z, dx, dy, dz, dt, pc, qc, pp, qp, vpz, vsv,
+                             physics);
   }
 }
 
+// KERNEL_SIZES only builds OpenMP kernels
+extern "C" int dc_propagate_specialized(const size_t sizes[DIMENSIONS]) {
+  return 0;
+}
+
 extern "C" void dc_propagate(const size_t start_coords[DIMENSIONS],
                              const size_t end_coords[DIMENSIONS],
                              const size_t sizes[DIMENSIONS],
@@ -58,7 +65,7 @@ extern "C" void dc_propagate(const size_t start_coords[DIMENSIONS],
       process_coordinates[0], process_coordinates[1], process_coordinates[2],
       topology[0], topology[1], topology[2],
       dx, dy, dz, dt, data->pp, data->pc, data->qp, data->qc,
-      data->vpz, data->vsv);
+      data->vpz, data->vsv, data->physics);
 
   cudaDeviceSynchronize();
   cudaError_t err = cudaGetLastError();
@@ -1,11 +1,264 @@
+#include "brick.h"
 #include "device_data.h"
 #include "indexing.h"
 #include "log.h"
+#include "model_cache.h"
+#include "sponge.h"
 #include <mpi.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// Bricked copy of a flat process array, padding zeroed
+static float *dc_device_brick_array(const dc_process_t *process,
+                                    const dc_device_data *data,
+                                    const float *flat) {
+  float *bricked = (float *)calloc(dc_brick_storage(data->bricks),
+                                   sizeof(float));
+  if (bricked == NULL) {
+    dc_log_error(process->rank, "OOM: could not allocate memory for bricked "
+                                "array in dc_device_data_init");
+    MPI_Finalize();
+    exit(1);
+  }
+  const size_t origin[DIMENSIONS] = {0, 0, 0};
+  dc_brick_unpack(bricked, data->bricks, origin, process->sizes, flat,
+                  process->sizes[0], process->sizes[0] * process->sizes[1]);
+  return bricked;
+}
+
+static void dc_device_flatten_array(const dc_device_data *data,
+                                    const float *bricked, float *flat) {
+  const size_t origin[DIMENSIONS] = {0, 0, 0};
+  dc_brick_pack(bricked, data->bricks, origin, data->sizes, flat,
+                data->sizes[0], data->sizes[0] * data->sizes[1]);
+}
+
+// p and q of every cell side by side, in one allocation
+static float *dc_device_interleave(const dc_process_t *process,
+                                   const float *p, const float *q) {
+  size_t count = dc_compute_count_from_sizes(process->sizes);
+  float *pq = (float *)malloc(2 * count * sizeof(float));
+  if (pq == NULL) {
+    dc_log_error(process->rank, "OOM: could not allocate memory for "
+                                "interleaved fields in dc_device_data_init");
+    MPI_Finalize();
+    exit(1);
+  }
+  for (size_t i = 0; i < count; i++) {
+    pq[2 * i] = p[i];
+    pq[2 * i + 1] = q[i];
+  }
+  return pq;
+}
+
+static void dc_device_deinterleave(const dc_device_data *data, const float *pq,
+                                   float *p, float *q) {
+  size_t count = dc_compute_count_from_sizes(data->sizes);
+  for (size_t i = 0; i < count; i++) {
+    p[i] = pq[2 * i];
+    q[i] = pq[2 * i + 1];
+  }
+}
+
+// The bricked and interleaved layouts keep the fields in their own arrays, so
+// the flat process ones only exist while results are read out
+static void dc_device_free_flat_fields(dc_process_t *process) {
+  float **fields[] = {&process->pp, &process->pc, &process->qp, &process->qc};
+  for (int i = 0; i < 4; i++) {
+    free(*fields[i]);
+    *fields[i] = NULL;
+  }
+}
+
+static void dc_device_alloc_flat_fields(dc_process_t *process) {
+  size_t count = dc_compute_count_from_sizes(process->sizes);
+  float **fields[] = {&process->pp, &process->pc, &process->qp, &process->qc};
+  for (int i = 0; i < 4; i++) {
+    if (*fields[i] != NULL)
+      continue;
+    *fields[i] = (float *)malloc(count * sizeof(float));
+    if (*fields[i] == NULL) {
+      dc_log_error(process->rank, "OOM: could not allocate memory for flat "
+                                  "fields in dc_device_data_get_results");
+      MPI_Finalize();
+      exit(1);
+    }
+  }
+}
+
+// Distance between consecutive cells of one field in the non-bricked layouts
+static size_t dc_device_cell_stride(const dc_device_data *data) {
+  return data->layout == DC_LAYOUT_INTERLEAVED ? 2 : 1;
+}
+
+// Arrays the kernels read or write, which are bricked in the bricked layout:
+// the fields, then the per-cell coefficients unless there is a material table
+#define DEVICE_ARRAYS 14
+#define DEVICE_FIELDS 4
+
+static void dc_device_arrays(dc_device_data *data,
+                             float **arrays[DEVICE_ARRAYS]) {
+  float **all[DEVICE_ARRAYS] = {
+      &data->pp,
+      &data->pc,
+      &data->qp,
+      &data->qc,
+      &data->precomp_vars.ch1dxx,
+      &data->precomp_vars.ch1dyy,
+      &data->precomp_vars.ch1dzz,
+      &data->precomp_vars.ch1dxy,
+      &data->precomp_vars.ch1dyz,
+      &data->precomp_vars.ch1dxz,
+      &data->precomp_vars.v2px,
+      &data->precomp_vars.v2pz,
+      &data->precomp_vars.v2sz,
+      &data->precomp_vars.v2pn,
+  };
+  memcpy(arrays, all, sizeof(all));
+}
+
+// The process arrays the ones above are copied from
+static void dc_device_process_arrays(dc_process_t *process,
+                                     float **arrays[DEVICE_ARRAYS]) {
+  float **all[DEVICE_ARRAYS] = {
+      &process->pp,
+      &process->pc,
+      &process->qp,
+      &process->qc,
+      &process->precomp_vars.ch1dxx,
+      &process->precomp_vars.ch1dyy,
+      &process->precomp_vars.ch1dzz,
+      &process->precomp_vars.ch1dxy,
+      &process->precomp_vars.ch1dyz,
+      &process->precomp_vars.ch1dxz,
+      &process->precomp_vars.v2px,
+      &process->precomp_vars.v2pz,
+      &process->precomp_vars.v2sz,
+      &process->precomp_vars.v2pn,
+  };
+  memcpy(arrays, all, sizeof(all));
+}
+
+static int dc_device_bricked_arrays(const dc_device_data *data) {
+  return data->material_ids != NULL ? DEVICE_FIELDS : DEVICE_ARRAYS;
+}
+
+static uint16_t *dc_device_brick_ids(const dc_process_t *process,
+                                     const dc_device_data *data) {
+  uint16_t *bricked =
+      (uint16_t *)calloc(dc_brick_storage(data->bricks), sizeof(uint16_t));
+  if (bricked == NULL) {
+    dc_log_error(process->rank, "OOM: could not allocate memory for bricked "
+                                "material IDs in dc_device_data_init");
+    MPI_Finalize();
+    exit(1);
+  }
+  const size_t *sizes = process->sizes;
+  for (size_t z = 0; z < sizes[2]; z++)
+    for (size_t y = 0; y < sizes[1]; y++)
+      for (size_t x = 0; x < sizes[0]; x++)
+        bricked[dc_brick_index(x, y, z, data->bricks)] =
+            process->material_ids[dc_get_index_for_coordinates(
+                x, y, z, sizes[0], sizes[1], sizes[2])];
+  return bricked;
+}
+
+// Whether flat cells i and j have the same coefficients, compared bit for bit
+static int dc_device_same_coefficients(const dc_process_t *process, size_t i,
+                                       size_t j) {
+  if (process->material_ids != NULL)
+    return process->material_ids[i] == process->material_ids[j];
+  const dc_precomp_vars *vars = &process->precomp_vars;
+  const float *columns[] = {vars->ch1dxx, vars->ch1dyy, vars->ch1dzz,
+                            vars->ch1dxy, vars->ch1dyz, vars->ch1dxz,
+                            vars->v2px,   vars->v2pz,   vars->v2sz,
+                            vars->v2pn};
+  for (size_t c = 0; c < sizeof(columns) / sizeof(columns[0]); c++) {
+    if (memcmp(&columns[c][i], &columns[c][j], sizeof(float)) != 0)
+      return 0;
+  }
+  return 1;
+}
+
+// Find the tiles whose computed cells all have the first one's coefficients
+// and log how much of the model the kernels no longer stream
+static size_t *dc_device_classify_tiles(const dc_process_t *process,
+                                        const dc_device_data *data) {
+  const size_t *sizes = process->sizes;
+  const size_t *tiles = data->bricks;
+  size_t *shared =
+      (size_t *)malloc(tiles[0] * tiles[1] * tiles[2] * sizeof(size_t));
+  if (shared == NULL) {
+    dc_log_error(process->rank, "OOM: could not allocate memory for tile "
+                                "classification in dc_device_data_init");
+    MPI_Finalize();
+    exit(1);
+  }
+
+  size_t uniform = 0, varying = 0, uniform_cells = 0, cells = 0;
+  for (size_t bz = 0; bz < tiles[2]; bz++) {
+    for (size_t by = 0; by < tiles[1]; by++) {
+      for (size_t bx = 0; bx < tiles[0]; bx++) {
+        const size_t tile = (bz * tiles[1] + by) * tiles[0] + bx;
+        const size_t origin[DIMENSIONS] = {bx * DC_BRICK, by * DC_BRICK,
+                                           bz * DC_BRICK};
+        size_t lo[DIMENSIONS], hi[DIMENSIONS];
+        size_t count = 1;
+        for (int i = 0; i < DIMENSIONS; i++) {
+          lo[i] = origin[i] > STENCIL ? origin[i] : STENCIL;
+          hi[i] = origin[i] + DC_BRICK < sizes[i] - STENCIL
+                      ? origin[i] + DC_BRICK
+                      : sizes[i] - STENCIL;
+          count *= hi[i] > lo[i] ? hi[i] - lo[i] : 0;
+        }
+        shared[tile] = DC_TILE_VARYING;
+        // Only ghost cells, which are never computed
+        if (count == 0)
+          continue;
+
+        const size_t first = dc_get_index_for_coordinates(
+            lo[0], lo[1], lo[2], sizes[0], sizes[1], sizes[2]);
+        int same = 1;
+        for (size_t z = lo[2]; z < hi[2] && same; z++)
+          for (size_t y = lo[1]; y < hi[1] && same; y++)
+            for (size_t x = lo[0]; x < hi[0] && same; x++)
+              same = dc_device_same_coefficients(
+                  process, first,
+                  dc_get_index_for_coordinates(x, y, z, sizes[0], sizes[1],
+                                               sizes[2]));
+
+        cells += count;
+        if (!same) {
+          varying++;
+          continue;
+        }
+        uniform++;
+        uniform_cells += count;
+        if (process->material_ids != NULL)
+          shared[tile] = process->material_ids[first];
+        else if (data->layout == DC_LAYOUT_BRICKED)
+          shared[tile] = dc_brick_index(lo[0], lo[1], lo[2], data->bricks);
+        else
+          shared[tile] = first;
+      }
+    }
+  }
+
+  // Bytes a cell reads to find its coefficients
+  const size_t model_bytes = process->material_ids != NULL
+                                 ? sizeof(uint16_t)
+                                 : sizeof(dc_precomp_vars) / sizeof(float *) *
+                                       sizeof(float);
+  dc_log_info(process->rank,
+              "Uniform tiles: %zu of %zu tiles, %.1f%% of the cells, saving "
+              "%zu of %zu model bytes streamed per iteration",
+              uniform, uniform + varying,
+              cells != 0 ? 100.0 * uniform_cells / cells : 0.0,
+              uniform_cells * model_bytes, cells * model_bytes);
+  return shared;
+}
+
 dc_device_data *dc_device_data_init(dc_process_t *process) {
   dc_device_data *data = (dc_device_data *)malloc(sizeof(dc_device_data));
   if (data == NULL) {
@@ -16,31 +269,115 @@ dc_device_data *dc_device_data_init(dc_process_t *process) {
     exit(1);
   }
 
-  size_t total_size = dc_compute_count_from_sizes(process->sizes);
-  size_t total_size_bytes = total_size * sizeof(float);
-
   data->pp = process->pp;
   data->pc = process->pc;
   data->qp = process->qp;
   data->qc = process->qc;
   data->vpz = process->anisotropy_vars.vpz;
   data->vsv = process->anisotropy_vars.vsv;
-  data->precomp_vars = process->precomp_vars;
+  data->precomp_vars = process->material_ids != NULL ? process->materials
+                                                     : process->precomp_vars;
+  data->material_ids = process->material_ids;
+  data->layout = process->layout;
+  data->physics = process->physics;
+  memcpy(data->sizes, process->sizes, sizeof(data->sizes));
+  dc_brick_counts(process->sizes, data->bricks);
+
+  // Classified from the flat coefficients, which bricking frees
+  data->tile_coefficients = process->uniform_tiles
+                                ? dc_device_classify_tiles(process, data)
+                                : NULL;
+  for (int i = 0; i < DIMENSIONS; i++)
+    data->damping[i] =
+        process->sponge_width != 0
+            ? dc_sponge_factors(process, i, data->undamped[i])
+            : NULL;
 
+  // Each flat array is freed as soon as it is copied, so the two layouts are
+  // never held at once; migration rebuilds the coefficients it moves
+  if (data->layout == DC_LAYOUT_BRICKED) {
+    float **arrays[DEVICE_ARRAYS], **flat[DEVICE_ARRAYS];
+    dc_device_arrays(data, arrays);
+    dc_device_process_arrays(process, flat);
+    for (int i = 0; i < dc_device_bricked_arrays(data); i++) {
+      *arrays[i] = dc_device_brick_array(process, data, *flat[i]);
+      // Mapped coefficients are released together below
+      if (i < DEVICE_FIELDS || process->model_mapping == NULL) {
+        free(*flat[i]);
+        *flat[i] = NULL;
+      }
+    }
+    if (data->material_ids != NULL)
+      data->material_ids = dc_device_brick_ids(process, data);
+    else
+      dc_model_release_precomp(process);
+  } else if (data->layout == DC_LAYOUT_INTERLEAVED) {
+    // q is read and written through the same arrays, one float further
+    data->pp = dc_device_interleave(process, process->pp, process->qp);
+    free(process->pp);
+    free(process->qp);
+    data->pc = dc_device_interleave(process, process->pc, process->qc);
+    free(process->pc);
+    free(process->qc);
+    process->pp = process->pc = process->qp = process->qc = NULL;
+    data->qp = data->pp + 1;
+    data->qc = data->pc + 1;
+  }
   return data;
 }
 
 void dc_device_data_free(dc_device_data *data) {
+  if (data->layout == DC_LAYOUT_BRICKED) {
+    float **arrays[DEVICE_ARRAYS];
+    dc_device_arrays(data, arrays);
+    for (int i = 0; i < dc_device_bricked_arrays(data); i++)
+      free(*arrays[i]);
+    free((uint16_t *)data->material_ids);
+  } else if (data->layout == DC_LAYOUT_INTERLEAVED) {
+    free(data->pp);
+    free(data->pc);
+  }
+  free(data->tile_coefficients);
+  for (int i = 0; i < DIMENSIONS; i++)
+    free(data->damping[i]);
   free(data);
 }
 
+int dc_device_fields_on_host(const dc_process_t *process) {
+  return process->layout == DC_LAYOUT_FLAT;
+}
+
+int dc_device_material_tables(void) { return 1; }
+
+int dc_device_sponge(void) { return 1; }
+
 void dc_device_data_get_results(dc_process_t *process, dc_device_data *data) {
+  if (data->layout != DC_LAYOUT_FLAT)
+    dc_device_alloc_flat_fields(process);
+  if (data->layout == DC_LAYOUT_BRICKED) {
+    dc_device_flatten_array(data, data->pp, process->pp);
+    dc_device_flatten_array(data, data->pc, process->pc);
+    dc_device_flatten_array(data, data->qp, process->qp);
+    dc_device_flatten_array(data, data->qc, process->qc);
+    return;
+  }
+  if (data->layout == DC_LAYOUT_INTERLEAVED) {
+    dc_device_deinterleave(data, data->pp, process->pp, process->qp);
+    dc_device_deinterleave(data, data->pc, process->pc, process->qc);
+    return;
+  }
   process->pp = data->pp;
   process->pc = data->pc;
   process->qp = data->qp;
   process->qc = data->qc;
 }
 
+void dc_device_data_release_results(dc_process_t *process,
+                                    dc_device_data *data) {
+  if (data->layout != DC_LAYOUT_FLAT)
+    dc_device_free_flat_fields(process);
+}
+
 void dc_device_swap_arrays(dc_device_data *data) {
   float *temp;
 
@@ -54,6 +391,14 @@ void dc_device_swap_arrays(dc_device_data *data) {
 }
 
 void dc_device_add_source(dc_device_data *data, size_t index, float source) {
+  if (data->layout == DC_LAYOUT_BRICKED) {
+    size_t x, y, z;
+    dc_extract_coordinates(&x, &y, &z, data->sizes[0], data->sizes[1],
+                           data->sizes[2], index);
+    index = dc_brick_index(x, y, z, data->bricks);
+  } else {
+    index *= dc_device_cell_stride(data);
+  }
   data->pc[index] += source;
   data->qc[index] += source;
 }
@@ -63,13 +408,20 @@ void dc_device_extract_halo_face(dc_device_data *data, float *buffer,
                                  const size_t end_coords[DIMENSIONS],
                                  const size_t sizes[DIMENSIONS],
                                  const float *from_array) {
+  if (data->layout == DC_LAYOUT_BRICKED) {
+    size_t row = end_coords[0] - start_coords[0];
+    dc_brick_pack(from_array, data->bricks, start_coords, end_coords, buffer,
+                  row, row * (end_coords[1] - start_coords[1]));
+    return;
+  }
+  size_t stride = dc_device_cell_stride(data);
   size_t data_index = 0;
   for (size_t z = start_coords[2]; z < end_coords[2]; z++) {
     for (size_t y = start_coords[1]; y < end_coords[1]; y++) {
       for (size_t x = start_coords[0]; x < end_coords[0]; x++) {
         size_t from_idx =
             dc_get_index_for_coordinates(x, y, z, sizes[0], sizes[1], sizes[2]);
-        buffer[data_index++] = from_array[from_idx];
+        buffer[data_index++] = from_array[stride * from_idx];
       }
     }
   }
@@ -80,12 +432,20 @@ void dc_device_insert_halo_face(dc_device_data *data, const float *buffer,
                                 const size_t end_coords[DIMENSIONS],
                                 const size_t sizes[DIMENSIONS],
                                 float *to_array) {
+  if (data->layout == DC_LAYOUT_BRICKED) {
+    size_t row = end_coords[0] - start_coords[0];
+    dc_brick_unpack(to_array, data->bricks, start_coords, end_coords, buffer,
+                    row, row * (end_coords[1] - start_coords[1]));
+    return;
+  }
+  size_t stride = dc_device_cell_stride(data);
   size_t data_index = 0;
   for (size_t z = start_coords[2]; z < end_coords[2]; z++) {
     for (size_t y = start_coords[1]; y < end_coords[1]; y++) {
       for (size_t x = start_coords[0]; x < end_coords[0]; x++) {
-        to_array[dc_get_index_for_coordinates(x, y, z, sizes[0], sizes[1],
-                                              sizes[2])] = buffer[data_index++];
+        to_array[stride * dc_get_index_for_coordinates(x, y, z, sizes[0],
+                                                       sizes[1], sizes[2])] =
+            buffer[data_index++];
       }
     }
   }
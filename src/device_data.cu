@@ -19,17 +19,7 @@ int select_device(dc_process_t *process) {
   int device_count;
   check_cuda_error(cudaGetDeviceCount(&device_count), process->rank,
                    "cudaGetDeviceCount");
-  const int max_hostname_length = 256;
-  char *current_hostname =
-      process->hostnames + max_hostname_length * process->rank;
-  size_t current_index = 0;
-  for (int i = 0; i < process->num_workers && i != process->rank; i++) {
-    char *hostname = process->hostnames + max_hostname_length * i;
-    if (strcmp(current_hostname, hostname) == 0) {
-      current_index++;
-    }
-  }
-  return current_index % device_count;
+  return process->node_rank % device_count;
 }
 
 dc_device_data *dc_device_data_init(dc_process_t *process) {
@@ -50,6 +40,26 @@ dc_device_data *dc_device_data_init(dc_process_t *process) {
   printf("CUDA source using device (%d) %s with compute capability %d.%d\n",
          device, device_prop.name, device_prop.major, device_prop.minor);
 
+  if (process->layout != DC_LAYOUT_FLAT) {
+    fprintf(stderr,
+            "[%d] Only the flat layout is implemented on the device, using "
+            "it\n",
+            process->rank);
+    process->layout = DC_LAYOUT_FLAT;
+  }
+  data->layout = DC_LAYOUT_FLAT;
+  if (process->uniform_tiles) {
+    fprintf(stderr,
+            "[%d] Uniform tiles are not implemented on the device, ignoring "
+            "them\n",
+            process->rank);
+    process->uniform_tiles = 0;
+  }
+  data->tile_coefficients = NULL;
+  for (int i = 0; i < DIMENSIONS; i++)
+    data->damping[i] = NULL;
+  data->physics = process->physics;
+
   size_t total_size = dc_compute_count_from_sizes(process->sizes);
   size_t total_size_bytes = total_size * sizeof(float);
 
@@ -104,6 +114,13 @@ void dc_device_data_free(dc_device_data *data) {
   free(data);
 }
 
+int dc_device_fields_on_host(const dc_process_t *process) { return 0; }
+
+// The kernel derives its coefficients from vpz and vsv
+int dc_device_material_tables(void) { return 0; }
+
+int dc_device_sponge(void) { return 0; }
+
 void dc_device_data_get_results(dc_process_t *process, dc_device_data *data) {
   size_t total_size = dc_compute_count_from_sizes(process->sizes);
   size_t total_size_bytes = total_size * sizeof(float);
@@ -116,6 +133,10 @@ void dc_device_data_get_results(dc_process_t *process, dc_device_data *data) {
                    process->rank, "cudaMemcpy qc to host");
 }
 
+// The host arrays outlive the device copy
+void dc_device_data_release_results(dc_process_t *process,
+                                    dc_device_data *data) {}
+
 void dc_device_swap_arrays(dc_device_data *data) {
   float *temp;
 
@@ -0,0 +1,45 @@
+// Flat-layout kernel for one local box size fixed at build time: the Makefile
+// compiles this file once per entry of KERNEL_SIZES with DC_FIXED_SX/SY/SZ
+// set, so every neighbour offset of the stencil is a constant
+#include "propagate.h"
+#include "sample_compute.h"
+
+#if !defined(DC_FIXED_SX) || !defined(DC_FIXED_SY) || !defined(DC_FIXED_SZ)
+#error "DC_FIXED_SX, DC_FIXED_SY and DC_FIXED_SZ must be defined"
+#endif
+
+#define DC_FIXED_NAME_(sx, sy, sz) dc_propagate_fixed_##sx##_##sy##_##sz
+#define DC_FIXED_NAME(sx, sy, sz) DC_FIXED_NAME_(sx, sy, sz)
+
+void DC_FIXED_NAME(DC_FIXED_SX, DC_FIXED_SY,
+                   DC_FIXED_SZ)(const size_t start_coords[DIMENSIONS],
+                                const size_t end_coords[DIMENSIONS],
+                                dc_device_data *data, const float dx,
+                                const float dy, const float dz,
+                                const float dt) {
+  enum { strideY = DC_FIXED_SX, strideZ = DC_FIXED_SX * DC_FIXED_SY };
+  const dc_precomp_vars *vars = &data->precomp_vars;
+  const dc_physics_t physics = data->physics;
+  const uint16_t *ids = data->material_ids;
+
+#pragma omp parallel for collapse(2)
+  for (size_t z = start_coords[2]; z < end_coords[2]; z++) {
+    for (size_t y = start_coords[1]; y < end_coords[1]; y++) {
+      // Offsets as in dc_propagate_interleaved
+      const size_t plane = z * (size_t)strideZ;
+      const size_t coefficients = ids != NULL ? 0 : plane;
+      for (size_t x = start_coords[0]; x < end_coords[0]; x++) {
+        const int i = x + y * strideY;
+        sample_compute_cell(
+            data->pc + plane, data->qc + plane, i, 1, strideY, strideZ, dx, dy,
+            dz, dt, data->pp + plane, data->qp + plane,
+            vars->ch1dxx + coefficients, vars->ch1dyy + coefficients,
+            vars->ch1dzz + coefficients, vars->ch1dxy + coefficients,
+            vars->ch1dyz + coefficients, vars->ch1dxz + coefficients,
+            vars->v2px + coefficients, vars->v2pz + coefficients,
+            vars->v2sz + coefficients, vars->v2pn + coefficients, i,
+            ids != NULL ? ids[plane + i] : (size_t)i, physics);
+      }
+    }
+  }
+}
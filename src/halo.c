@@ -0,0 +1,837 @@
+#include <mpi.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "halo.h"
+#include "indexing.h"
+#include "log.h"
+#include "setup.h"
+
+static const char *halo_mode_names[] = {
+    [DC_HALO_NEIGHBOURHOOD] = "neighbourhood",
+    [DC_HALO_STAGED] = "staged",
+    [DC_HALO_SHARED] = "shared",
+    [DC_HALO_RMA] = "rma",
+    [DC_HALO_LIST] = "list",
+};
+
+const char *dc_halo_mode_name(dc_halo_mode_t mode) {
+  return halo_mode_names[mode];
+}
+
+int dc_halo_mode_parse(const char *name, dc_halo_mode_t *mode) {
+  for (size_t i = 0; i < sizeof(halo_mode_names) / sizeof(*halo_mode_names);
+       i++) {
+    if (strcmp(name, halo_mode_names[i]) == 0) {
+      *mode = (dc_halo_mode_t)i;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Region exchanged along `axis` in the staged algorithm. Axes already
+// exchanged span the whole local extent, ghosts included, so the edges and
+// corners received in earlier phases are forwarded; later axes only span the
+// computed cells.
+static void dc_staged_region(const dc_process_t *process, int axis,
+                             int direction, int is_receive,
+                             size_t starts[DIMENSIONS],
+                             size_t ends[DIMENSIONS]) {
+  const size_t radius = STENCIL;
+  const size_t *sizes = process->sizes;
+
+  for (int i = 0; i < DIMENSIONS; i++) {
+    if (i < axis) {
+      starts[i] = 0;
+      ends[i] = sizes[i];
+    } else {
+      starts[i] = radius;
+      ends[i] = sizes[i] - radius;
+    }
+  }
+  if (is_receive) {
+    starts[axis] = (direction < 0) ? 0 : sizes[axis] - radius;
+  } else {
+    starts[axis] = (direction < 0) ? radius : sizes[axis] - 2 * radius;
+  }
+  ends[axis] = starts[axis] + radius;
+}
+
+// Once x and y have been exchanged the z faces are whole xy planes, which are
+// contiguous in memory: describe both fields' planes with one datatype so
+// they travel in place, without packing
+static MPI_Datatype dc_staged_plane_type(const dc_process_t *process,
+                                         dc_device_data *data,
+                                         const size_t starts[DIMENSIONS],
+                                         const size_t ends[DIMENSIONS]) {
+  size_t offset = dc_get_index_for_coordinates(
+      0, 0, starts[2], process->sizes[0], process->sizes[1], process->sizes[2]);
+  int block_length =
+      (int)(process->sizes[0] * process->sizes[1] * (ends[2] - starts[2]));
+  int block_lengths[HALO_FIELDS] = {block_length, block_length};
+  MPI_Aint displacements[HALO_FIELDS];
+  MPI_Get_address(data->pp + offset, &displacements[0]);
+  MPI_Get_address(data->qp + offset, &displacements[1]);
+
+  MPI_Datatype type;
+  MPI_Type_create_hindexed(HALO_FIELDS, block_lengths, displacements,
+                           MPI_FLOAT, &type);
+  MPI_Type_commit(&type);
+  return type;
+}
+
+static void dc_staged_phase_begin(dc_staged_phase_t *phase,
+                                  dc_process_t *process, MPI_Comm comm,
+                                  dc_device_data *data, int axis) {
+  static const int axis_strides[DIMENSIONS] = {1, 3, 9};
+  const int centre = NEIGHBOURHOOD / 2;
+  const int in_place =
+      axis == DIMENSIONS - 1 && dc_device_fields_on_host(process);
+
+  phase->axis = axis;
+  phase->count = 0;
+
+  // Receives first, then sends, so matching messages find a posted buffer
+  for (int is_receive = 1; is_receive >= 0; is_receive--) {
+    for (int direction = -1; direction <= 1; direction += 2) {
+      int face_index = centre + direction * axis_strides[axis];
+      int neighbour_rank = process->neighbours[face_index];
+      if (neighbour_rank == MPI_PROC_NULL)
+        continue;
+
+      size_t slot = phase->count++;
+      size_t *starts = phase->starts[slot];
+      size_t *ends = phase->ends[slot];
+      dc_staged_region(process, axis, direction, is_receive, starts, ends);
+      size_t data_size = (ends[0] - starts[0]) * (ends[1] - starts[1]) *
+                         (ends[2] - starts[2]);
+      phase->is_receive[slot] = is_receive;
+      phase->buffers[slot] = NULL;
+      phase->types[slot] = MPI_DATATYPE_NULL;
+
+      if (in_place) {
+        phase->types[slot] = dc_staged_plane_type(process, data, starts, ends);
+      } else {
+        phase->buffers[slot] = malloc(HALO_FIELDS * data_size * sizeof(float));
+        if (phase->buffers[slot] == NULL) {
+          dc_log_error(process->rank,
+                       "OOM: could not allocate memory for staged halo buffer "
+                       "in dc_staged_phase_begin");
+          MPI_Finalize();
+          exit(1);
+        }
+      }
+
+      if (is_receive) {
+        if (in_place) {
+          MPI_Irecv(MPI_BOTTOM, 1, phase->types[slot], neighbour_rank,
+                    HALO_TAG, comm, &phase->requests[slot]);
+        } else {
+          MPI_Irecv(phase->buffers[slot], HALO_FIELDS * data_size, MPI_FLOAT,
+                    neighbour_rank, HALO_TAG, comm, &phase->requests[slot]);
+        }
+        process->halo_stats.messages_received++;
+        process->halo_stats.bytes_received +=
+            HALO_FIELDS * data_size * sizeof(float);
+      } else {
+        if (in_place) {
+          MPI_Isend(MPI_BOTTOM, 1, phase->types[slot], neighbour_rank,
+                    HALO_TAG, comm, &phase->requests[slot]);
+        } else {
+          dc_device_extract_halo_face(data, phase->buffers[slot], starts, ends,
+                                      process->sizes, data->pp);
+          dc_device_extract_halo_face(data, phase->buffers[slot] + data_size,
+                                      starts, ends, process->sizes, data->qp);
+          MPI_Isend(phase->buffers[slot], HALO_FIELDS * data_size, MPI_FLOAT,
+                    neighbour_rank, HALO_TAG, comm, &phase->requests[slot]);
+        }
+        process->halo_stats.messages_sent++;
+        process->halo_stats.bytes_sent +=
+            HALO_FIELDS * data_size * sizeof(float);
+      }
+    }
+  }
+}
+
+static void dc_staged_phase_end(dc_staged_phase_t *phase,
+                                dc_process_t *process, dc_device_data *data) {
+  MPI_Waitall(phase->count, phase->requests, MPI_STATUSES_IGNORE);
+
+  for (size_t slot = 0; slot < phase->count; slot++) {
+    if (phase->is_receive[slot] && phase->buffers[slot] != NULL) {
+      const size_t *starts = phase->starts[slot];
+      const size_t *ends = phase->ends[slot];
+      size_t data_size = (ends[0] - starts[0]) * (ends[1] - starts[1]) *
+                         (ends[2] - starts[2]);
+      dc_device_insert_halo_face(data, phase->buffers[slot], starts, ends,
+                                 process->sizes, data->pp);
+      dc_device_insert_halo_face(data, phase->buffers[slot] + data_size,
+                                 starts, ends, process->sizes, data->qp);
+    }
+    free(phase->buffers[slot]);
+    if (phase->types[slot] != MPI_DATATYPE_NULL) {
+      MPI_Type_free(&phase->types[slot]);
+    }
+  }
+  phase->count = 0;
+}
+
+// Window-backed modes keep pp, pc, qp and qc back to back in one block, in
+// that order. The arrays swap in lockstep, so a rank's current pp is at
+// (iteration % 2) * count and its current qp always 2 * count further.
+static void dc_fields_move_to_block(dc_process_t *process, float *block) {
+  size_t count = dc_compute_count_from_sizes(process->sizes);
+  float **fields[4] = {&process->pp, &process->pc, &process->qp, &process->qc};
+  for (int i = 0; i < 4; i++) {
+    memcpy(block + i * count, *fields[i], count * sizeof(float));
+    free(*fields[i]);
+    *fields[i] = block + i * count;
+  }
+}
+
+static void dc_fields_move_from_block(dc_process_t *process) {
+  size_t count = dc_compute_count_from_sizes(process->sizes);
+  float **fields[4] = {&process->pp, &process->pc, &process->qp, &process->qc};
+  for (int i = 0; i < 4; i++) {
+    float *field = malloc(count * sizeof(float));
+    if (field == NULL) {
+      dc_log_error(process->rank, "OOM: could not allocate memory for field "
+                                  "in dc_fields_move_from_block");
+      MPI_Finalize();
+      exit(1);
+    }
+    memcpy(field, *fields[i], count * sizeof(float));
+    *fields[i] = field;
+  }
+}
+
+static void dc_shared_init(dc_shared_halos_t *shared, dc_process_t *process,
+                           MPI_Comm comm) {
+  size_t count = dc_compute_count_from_sizes(process->sizes);
+
+  MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, process->rank, MPI_INFO_NULL,
+                      &shared->node_comm);
+  MPI_Win_allocate_shared(4 * count * sizeof(float), sizeof(float),
+                          MPI_INFO_NULL, shared->node_comm, &shared->fields,
+                          &shared->window);
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, shared->window);
+  shared->iteration = 0;
+
+  dc_fields_move_to_block(process, shared->fields);
+
+  int node_size;
+  MPI_Comm_size(shared->node_comm, &node_size);
+  unsigned long *node_sizes = malloc(node_size * DIMENSIONS * sizeof(*node_sizes));
+  if (node_sizes == NULL) {
+    dc_log_error(process->rank, "OOM: could not allocate memory for "
+                                "node_sizes in dc_shared_init");
+    MPI_Finalize();
+    exit(1);
+  }
+  unsigned long local_sizes[DIMENSIONS] = {
+      process->sizes[0], process->sizes[1], process->sizes[2]};
+  MPI_Allgather(local_sizes, DIMENSIONS, MPI_UNSIGNED_LONG, node_sizes,
+                DIMENSIONS, MPI_UNSIGNED_LONG, shared->node_comm);
+
+  MPI_Group group, node_group;
+  MPI_Comm_group(comm, &group);
+  MPI_Comm_group(shared->node_comm, &node_group);
+
+  int exchanged = 0, on_node = 0;
+  for (size_t face_index = 0; face_index < NEIGHBOURHOOD; face_index++) {
+    process->shared_neighbours[face_index] = 0;
+    shared->neighbour_fields[face_index] = NULL;
+    if (!dc_halo_region_exchanged(process, face_index))
+      continue;
+    exchanged++;
+
+    int node_rank;
+    MPI_Group_translate_ranks(group, 1, &process->neighbours[face_index],
+                              node_group, &node_rank);
+    if (node_rank == MPI_UNDEFINED)
+      continue;
+    on_node++;
+
+    MPI_Aint segment_size;
+    int displacement_unit;
+    MPI_Win_shared_query(shared->window, node_rank, &segment_size,
+                         &displacement_unit,
+                         &shared->neighbour_fields[face_index]);
+    for (int i = 0; i < DIMENSIONS; i++) {
+      shared->neighbour_sizes[face_index][i] =
+          node_sizes[node_rank * DIMENSIONS + i];
+    }
+    process->shared_neighbours[face_index] = 1;
+  }
+  free(node_sizes);
+  MPI_Group_free(&group);
+  MPI_Group_free(&node_group);
+
+  dc_log_info(process->rank,
+              "%d of %d exchanged neighbour regions are served from node "
+              "shared memory",
+              on_node, exchanged);
+}
+
+static void dc_shared_free(dc_shared_halos_t *shared, dc_process_t *process) {
+  dc_fields_move_from_block(process);
+  memset(process->shared_neighbours, 0, sizeof(process->shared_neighbours));
+
+  MPI_Win_unlock_all(shared->window);
+  MPI_Win_free(&shared->window);
+  MPI_Comm_free(&shared->node_comm);
+}
+
+// Fill the ghost regions owned by on-node neighbours by copying their freshly
+// computed boundary cells straight out of the shared window
+static void dc_shared_copy_halos(dc_shared_halos_t *shared,
+                                 dc_process_t *process, dc_device_data *data) {
+  const ptrdiff_t radius = STENCIL;
+  const size_t *sizes = process->sizes;
+
+  for (size_t face_index = 0; face_index < NEIGHBOURHOOD; face_index++) {
+    if (!process->shared_neighbours[face_index])
+      continue;
+    int displacement[DIMENSIONS] = {face_index % 3 - 1,
+                                    (face_index % 9) / 3 - 1,
+                                    face_index / 9 - 1};
+    const size_t *neighbour_sizes = shared->neighbour_sizes[face_index];
+    size_t neighbour_count = dc_compute_count_from_sizes(neighbour_sizes);
+    size_t parity = shared->iteration % 2;
+    const float *neighbour_p =
+        shared->neighbour_fields[face_index] + parity * neighbour_count;
+    const float *neighbour_q =
+        shared->neighbour_fields[face_index] + (2 + parity) * neighbour_count;
+
+    // Ghost cells of ours and the matching boundary cells of the neighbour
+    // differ by a constant offset along every displaced axis
+    size_t starts[DIMENSIONS], ends[DIMENSIONS];
+    ptrdiff_t offsets[DIMENSIONS];
+    for (int i = 0; i < DIMENSIONS; i++) {
+      if (displacement[i] == -1) {
+        starts[i] = 0;
+        ends[i] = radius;
+        offsets[i] = (ptrdiff_t)neighbour_sizes[i] - 2 * radius;
+      } else if (displacement[i] == 1) {
+        starts[i] = sizes[i] - radius;
+        ends[i] = sizes[i];
+        offsets[i] = 2 * radius - (ptrdiff_t)sizes[i];
+      } else {
+        starts[i] = radius;
+        ends[i] = sizes[i] - radius;
+        offsets[i] = 0;
+      }
+    }
+
+    size_t row = ends[0] - starts[0];
+    for (size_t z = starts[2]; z < ends[2]; z++) {
+      for (size_t y = starts[1]; y < ends[1]; y++) {
+        size_t to = dc_get_index_for_coordinates(starts[0], y, z, sizes[0],
+                                                 sizes[1], sizes[2]);
+        size_t from = dc_get_index_for_coordinates(
+            starts[0] + offsets[0], y + offsets[1], z + offsets[2],
+            neighbour_sizes[0], neighbour_sizes[1], neighbour_sizes[2]);
+        memcpy(data->pp + to, neighbour_p + from, row * sizeof(float));
+        memcpy(data->qp + to, neighbour_q + from, row * sizeof(float));
+      }
+    }
+    process->halo_stats.bytes_shared += HALO_FIELDS * row *
+                                        (ends[1] - starts[1]) *
+                                        (ends[2] - starts[2]) * sizeof(float);
+  }
+}
+
+// Cells of a neighbourhood region: the boundary cells sent towards the
+// neighbour at `displacement`, or the ghost cells received from it
+static void dc_neighbourhood_region(const size_t sizes[DIMENSIONS],
+                                    const int displacement[DIMENSIONS],
+                                    int is_receive, size_t starts[DIMENSIONS],
+                                    size_t ends[DIMENSIONS]) {
+  const size_t radius = STENCIL;
+  for (int i = 0; i < DIMENSIONS; i++) {
+    if (displacement[i] == 0) {
+      starts[i] = radius;
+      ends[i] = sizes[i] - radius;
+    } else if (displacement[i] < 0) {
+      starts[i] = is_receive ? 0 : radius;
+      ends[i] = starts[i] + radius;
+    } else {
+      starts[i] = is_receive ? sizes[i] - radius : sizes[i] - 2 * radius;
+      ends[i] = starts[i] + radius;
+    }
+  }
+}
+
+// A region of both pp and qp inside a field block of `count` cells per array
+static MPI_Datatype dc_rma_region_type(const size_t sizes[DIMENSIONS],
+                                       const size_t starts[DIMENSIONS],
+                                       const size_t ends[DIMENSIONS]) {
+  int array_sizes[DIMENSIONS], sub_sizes[DIMENSIONS], offsets[DIMENSIONS];
+  for (int i = 0; i < DIMENSIONS; i++) {
+    // MPI_ORDER_C wants the slowest axis first
+    array_sizes[DIMENSIONS - 1 - i] = sizes[i];
+    sub_sizes[DIMENSIONS - 1 - i] = ends[i] - starts[i];
+    offsets[DIMENSIONS - 1 - i] = starts[i];
+  }
+  MPI_Datatype region, type;
+  MPI_Type_create_subarray(DIMENSIONS, array_sizes, sub_sizes, offsets,
+                           MPI_ORDER_C, MPI_FLOAT, &region);
+  MPI_Type_create_hvector(HALO_FIELDS, 1,
+                          2 * dc_compute_count_from_sizes(sizes) *
+                              sizeof(float),
+                          region, &type);
+  MPI_Type_commit(&type);
+  MPI_Type_free(&region);
+  return type;
+}
+
+static void dc_rma_init(dc_rma_halos_t *rma, dc_process_t *process,
+                        MPI_Comm comm) {
+  size_t count = dc_compute_count_from_sizes(process->sizes);
+
+  MPI_Win_allocate(4 * count * sizeof(float), sizeof(float), MPI_INFO_NULL,
+                   comm, &rma->fields, &rma->window);
+  dc_fields_move_to_block(process, rma->fields);
+  rma->iteration = 0;
+
+  // Target datatypes are built from the neighbours' local sizes
+  unsigned long local_sizes[DIMENSIONS] = {
+      process->sizes[0], process->sizes[1], process->sizes[2]};
+  unsigned long neighbour_sizes[NEIGHBOURHOOD][DIMENSIONS];
+  MPI_Request requests[2 * NEIGHBOURHOOD];
+  int request_count = 0;
+  int ranks[NEIGHBOURHOOD];
+  int rank_count = 0;
+  for (size_t face_index = 0; face_index < NEIGHBOURHOOD; face_index++) {
+    rma->origin_types[face_index] = MPI_DATATYPE_NULL;
+    rma->target_types[face_index] = MPI_DATATYPE_NULL;
+    if (!dc_halo_region_exchanged(process, face_index))
+      continue;
+    int neighbour_rank = process->neighbours[face_index];
+    ranks[rank_count++] = neighbour_rank;
+    MPI_Irecv(neighbour_sizes[face_index], DIMENSIONS, MPI_UNSIGNED_LONG,
+              neighbour_rank, HALO_TAG, comm, &requests[request_count++]);
+    MPI_Isend(local_sizes, DIMENSIONS, MPI_UNSIGNED_LONG, neighbour_rank,
+              HALO_TAG, comm, &requests[request_count++]);
+  }
+  MPI_Waitall(request_count, requests, MPI_STATUSES_IGNORE);
+
+  MPI_Group group;
+  MPI_Comm_group(comm, &group);
+  MPI_Group_incl(group, rank_count, ranks, &rma->group);
+  MPI_Group_free(&group);
+
+  for (size_t face_index = 0; face_index < NEIGHBOURHOOD; face_index++) {
+    if (!dc_halo_region_exchanged(process, face_index))
+      continue;
+    int displacement[DIMENSIONS] = {face_index % 3 - 1,
+                                    (face_index % 9) / 3 - 1,
+                                    face_index / 9 - 1};
+    int opposite[DIMENSIONS] = {-displacement[0], -displacement[1],
+                                -displacement[2]};
+    size_t sizes[DIMENSIONS];
+    for (int i = 0; i < DIMENSIONS; i++) {
+      sizes[i] = neighbour_sizes[face_index][i];
+    }
+    size_t starts[DIMENSIONS], ends[DIMENSIONS];
+
+    dc_neighbourhood_region(process->sizes, displacement, 0, starts, ends);
+    rma->origin_types[face_index] =
+        dc_rma_region_type(process->sizes, starts, ends);
+    rma->region_sizes[face_index] = (ends[0] - starts[0]) *
+                                    (ends[1] - starts[1]) *
+                                    (ends[2] - starts[2]);
+
+    dc_neighbourhood_region(sizes, opposite, 1, starts, ends);
+    rma->target_types[face_index] = dc_rma_region_type(sizes, starts, ends);
+    rma->neighbour_counts[face_index] = dc_compute_count_from_sizes(sizes);
+  }
+}
+
+static void dc_rma_free(dc_rma_halos_t *rma, dc_process_t *process) {
+  dc_fields_move_from_block(process);
+  for (size_t face_index = 0; face_index < NEIGHBOURHOOD; face_index++) {
+    if (rma->origin_types[face_index] != MPI_DATATYPE_NULL) {
+      MPI_Type_free(&rma->origin_types[face_index]);
+      MPI_Type_free(&rma->target_types[face_index]);
+    }
+  }
+  MPI_Group_free(&rma->group);
+  MPI_Win_free(&rma->window);
+}
+
+// Write our freshly computed boundaries into every neighbour's current pp/qp
+// ghost cells; the access epoch is closed in dc_rma_complete
+static void dc_rma_put_halos(dc_rma_halos_t *rma, dc_process_t *process,
+                             dc_device_data *data) {
+  MPI_Win_start(rma->group, 0, rma->window);
+  for (size_t face_index = 0; face_index < NEIGHBOURHOOD; face_index++) {
+    if (rma->origin_types[face_index] == MPI_DATATYPE_NULL)
+      continue;
+    MPI_Aint target_displacement =
+        (rma->iteration % 2) * rma->neighbour_counts[face_index];
+    MPI_Put(data->pp, 1, rma->origin_types[face_index],
+            process->neighbours[face_index], target_displacement, 1,
+            rma->target_types[face_index], rma->window);
+    process->halo_stats.messages_sent++;
+    process->halo_stats.bytes_sent +=
+        HALO_FIELDS * rma->region_sizes[face_index] * sizeof(float);
+  }
+}
+
+static void dc_rma_complete(dc_rma_halos_t *rma, dc_process_t *process) {
+  MPI_Win_complete(rma->window);
+  MPI_Win_wait(rma->window);
+  for (size_t face_index = 0; face_index < NEIGHBOURHOOD; face_index++) {
+    if (rma->origin_types[face_index] == MPI_DATATYPE_NULL)
+      continue;
+    // The ghost region filled by a neighbour is as large as the boundary
+    // region we send it
+    process->halo_stats.messages_received++;
+    process->halo_stats.bytes_received +=
+        HALO_FIELDS * rma->region_sizes[face_index] * sizeof(float);
+  }
+  rma->iteration++;
+}
+
+// Regions of `ghost_box`'s ghosts, one per footprint direction, that fall in
+// `computed_box`'s computed cells, as corners local to `local_box`. Boxes are
+// ghost-inclusive, as {start x, y, z, size x, y, z} in the padded grid.
+static size_t dc_list_regions(const unsigned long ghost_box[2 * DIMENSIONS],
+                              const unsigned long computed_box[2 * DIMENSIONS],
+                              const unsigned long local_box[2 * DIMENSIONS],
+                              dc_stencil_footprint_t footprint,
+                              size_t regions[NEIGHBOURHOOD][2 * DIMENSIONS]) {
+  size_t count = 0;
+  for (int face_index = 0; face_index < NEIGHBOURHOOD; face_index++) {
+    int displacement[DIMENSIONS] = {face_index % 3 - 1,
+                                    (face_index % 9) / 3 - 1,
+                                    face_index / 9 - 1};
+    if (face_index == NEIGHBOURHOOD / 2 ||
+        !dc_footprint_reads_region(footprint, displacement[0],
+                                   displacement[1], displacement[2]))
+      continue;
+
+    int empty = 0;
+    for (int i = 0; i < DIMENSIONS && !empty; i++) {
+      size_t start = ghost_box[i], size = ghost_box[DIMENSIONS + i];
+      size_t lo = start + STENCIL, hi = start + size - STENCIL;
+      if (displacement[i] == -1) {
+        lo = start;
+        hi = start + STENCIL;
+      } else if (displacement[i] == 1) {
+        lo = start + size - STENCIL;
+        hi = start + size;
+      }
+      size_t computed_lo = computed_box[i] + STENCIL;
+      size_t computed_hi =
+          computed_box[i] + computed_box[DIMENSIONS + i] - STENCIL;
+      if (computed_lo > lo)
+        lo = computed_lo;
+      if (computed_hi < hi)
+        hi = computed_hi;
+      empty = lo >= hi;
+      regions[count][i] = lo - local_box[i];
+      regions[count][DIMENSIONS + i] = hi - local_box[i];
+    }
+    if (!empty)
+      count++;
+  }
+  return count;
+}
+
+static size_t dc_list_cells(const size_t regions[][2 * DIMENSIONS],
+                            size_t count) {
+  size_t cells = 0;
+  for (size_t r = 0; r < count; r++) {
+    cells += (regions[r][3] - regions[r][0]) * (regions[r][4] - regions[r][1]) *
+             (regions[r][5] - regions[r][2]);
+  }
+  return cells;
+}
+
+static void dc_list_init(dc_list_halos_t *list, dc_process_t *process,
+                         MPI_Comm comm) {
+  int size;
+  MPI_Comm_size(comm, &size);
+  unsigned long(*boxes)[2 * DIMENSIONS] = malloc(size * sizeof(*boxes));
+  list->neighbours = malloc(size * sizeof(dc_list_neighbour_t));
+  list->requests = malloc(2 * size * sizeof(MPI_Request));
+  if (boxes == NULL || list->neighbours == NULL || list->requests == NULL) {
+    dc_log_error(process->rank, "OOM: could not allocate memory for the "
+                                "neighbour list in dc_list_init");
+    MPI_Finalize();
+    exit(1);
+  }
+  unsigned long box[2 * DIMENSIONS];
+  for (int i = 0; i < DIMENSIONS; i++) {
+    box[i] = process->start_coords[i];
+    box[DIMENSIONS + i] = process->sizes[i];
+  }
+  MPI_Allgather(box, 2 * DIMENSIONS, MPI_UNSIGNED_LONG, boxes, 2 * DIMENSIONS,
+                MPI_UNSIGNED_LONG, comm);
+
+  list->count = 0;
+  list->request_count = 0;
+  for (int r = 0; r < size; r++) {
+    if (r == process->rank)
+      continue;
+    dc_list_neighbour_t *neighbour = &list->neighbours[list->count];
+    neighbour->rank = r;
+    neighbour->send_count = dc_list_regions(
+        boxes[r], box, box, process->footprint, neighbour->send_regions);
+    neighbour->receive_count = dc_list_regions(
+        box, boxes[r], box, process->footprint, neighbour->receive_regions);
+    if (neighbour->send_count == 0 && neighbour->receive_count == 0)
+      continue;
+
+    neighbour->send_cells =
+        dc_list_cells(neighbour->send_regions, neighbour->send_count);
+    neighbour->receive_cells =
+        dc_list_cells(neighbour->receive_regions, neighbour->receive_count);
+    neighbour->send_buffer =
+        malloc(HALO_FIELDS * neighbour->send_cells * sizeof(float));
+    neighbour->receive_buffer =
+        malloc(HALO_FIELDS * neighbour->receive_cells * sizeof(float));
+    if (neighbour->send_buffer == NULL || neighbour->receive_buffer == NULL) {
+      dc_log_error(process->rank, "OOM: could not allocate halo buffers for "
+                                  "neighbour %d in dc_list_init",
+                   r);
+      MPI_Finalize();
+      exit(1);
+    }
+    list->count++;
+  }
+  free(boxes);
+  dc_log_info(process->rank, "Exchanging halos with %zu listed neighbours",
+              list->count);
+}
+
+static void dc_list_free(dc_list_halos_t *list) {
+  for (size_t n = 0; n < list->count; n++) {
+    free(list->neighbours[n].send_buffer);
+    free(list->neighbours[n].receive_buffer);
+  }
+  free(list->neighbours);
+  free(list->requests);
+  list->neighbours = NULL;
+  list->requests = NULL;
+  list->count = 0;
+}
+
+static void dc_list_post(dc_list_halos_t *list, MPI_Comm comm) {
+  for (size_t n = 0; n < list->count; n++) {
+    dc_list_neighbour_t *neighbour = &list->neighbours[n];
+    if (neighbour->receive_cells == 0)
+      continue;
+    MPI_Irecv(neighbour->receive_buffer,
+              HALO_FIELDS * neighbour->receive_cells, MPI_FLOAT,
+              neighbour->rank, HALO_TAG, comm,
+              &list->requests[list->request_count++]);
+  }
+}
+
+static void dc_list_send(dc_list_halos_t *list, dc_process_t *process,
+                         MPI_Comm comm, dc_device_data *data) {
+  for (size_t n = 0; n < list->count; n++) {
+    dc_list_neighbour_t *neighbour = &list->neighbours[n];
+    if (neighbour->send_cells == 0)
+      continue;
+    float *buffer = neighbour->send_buffer;
+    for (size_t r = 0; r < neighbour->send_count; r++) {
+      const size_t *region = neighbour->send_regions[r];
+      size_t cells = dc_list_cells(&neighbour->send_regions[r], 1);
+      dc_device_extract_halo_face(data, buffer, region, region + DIMENSIONS,
+                                  process->sizes, data->pp);
+      dc_device_extract_halo_face(data, buffer + cells, region,
+                                  region + DIMENSIONS, process->sizes,
+                                  data->qp);
+      buffer += HALO_FIELDS * cells;
+    }
+    MPI_Isend(neighbour->send_buffer, HALO_FIELDS * neighbour->send_cells,
+              MPI_FLOAT, neighbour->rank, HALO_TAG, comm,
+              &list->requests[list->request_count++]);
+    process->halo_stats.messages_sent++;
+    process->halo_stats.bytes_sent +=
+        HALO_FIELDS * neighbour->send_cells * sizeof(float);
+  }
+}
+
+static void dc_list_insert(dc_list_halos_t *list, dc_process_t *process,
+                           dc_device_data *data) {
+  MPI_Waitall(list->request_count, list->requests, MPI_STATUSES_IGNORE);
+  list->request_count = 0;
+  for (size_t n = 0; n < list->count; n++) {
+    dc_list_neighbour_t *neighbour = &list->neighbours[n];
+    if (neighbour->receive_cells == 0)
+      continue;
+    const float *buffer = neighbour->receive_buffer;
+    for (size_t r = 0; r < neighbour->receive_count; r++) {
+      const size_t *region = neighbour->receive_regions[r];
+      size_t cells = dc_list_cells(&neighbour->receive_regions[r], 1);
+      dc_device_insert_halo_face(data, buffer, region, region + DIMENSIONS,
+                                 process->sizes, data->pp);
+      dc_device_insert_halo_face(data, buffer + cells, region,
+                                 region + DIMENSIONS, process->sizes,
+                                 data->qp);
+      buffer += HALO_FIELDS * cells;
+    }
+    process->halo_stats.messages_received++;
+    process->halo_stats.bytes_received +=
+        HALO_FIELDS * neighbour->receive_cells * sizeof(float);
+  }
+}
+
+void dc_halo_exchange_init(dc_halo_exchange_t *exchange, dc_process_t *process,
+                           MPI_Comm comm) {
+  if ((process->halo_mode == DC_HALO_SHARED ||
+       process->halo_mode == DC_HALO_RMA) &&
+      !dc_device_fields_on_host(process)) {
+    dc_log_error(process->rank,
+                 "The %s halo exchange needs flat host fields, falling back to "
+                 "neighbourhood",
+                 dc_halo_mode_name(process->halo_mode));
+    process->halo_mode = DC_HALO_NEIGHBOURHOOD;
+  }
+  if (process->decomposition != DC_DECOMPOSITION_CARTESIAN &&
+      process->halo_mode != DC_HALO_LIST) {
+    dc_log_error(process->rank,
+                 "The %s halo exchange needs a Cartesian decomposition, "
+                 "falling back to list",
+                 dc_halo_mode_name(process->halo_mode));
+    process->halo_mode = DC_HALO_LIST;
+  }
+  exchange->mode = process->halo_mode;
+  dc_log_info(process->rank, "Halo exchange mode: %s",
+              dc_halo_mode_name(exchange->mode));
+
+  switch (exchange->mode) {
+  case DC_HALO_SHARED:
+    dc_shared_init(&exchange->shared, process, comm);
+    break;
+  case DC_HALO_RMA:
+    dc_rma_init(&exchange->rma, process, comm);
+    break;
+  case DC_HALO_LIST:
+    dc_list_init(&exchange->list, process, comm);
+    break;
+  default:
+    break;
+  }
+}
+
+void dc_halo_exchange_free(dc_halo_exchange_t *exchange,
+                           dc_process_t *process) {
+  switch (exchange->mode) {
+  case DC_HALO_SHARED:
+    dc_shared_free(&exchange->shared, process);
+    break;
+  case DC_HALO_RMA:
+    dc_rma_free(&exchange->rma, process);
+    break;
+  case DC_HALO_LIST:
+    dc_list_free(&exchange->list);
+    break;
+  default:
+    break;
+  }
+}
+
+void dc_halo_exchange_post(dc_halo_exchange_t *exchange, dc_process_t *process,
+                           MPI_Comm comm, dc_device_data *data) {
+  double start_time = MPI_Wtime();
+  switch (exchange->mode) {
+  case DC_HALO_NEIGHBOURHOOD:
+  case DC_HALO_SHARED:
+    exchange->halos = dc_receive_halos(process, comm, HALO_TAG);
+    break;
+  case DC_HALO_STAGED:
+    // Nothing can be posted ahead: every phase is sized for the ghosts the
+    // previous one delivers
+    break;
+  case DC_HALO_RMA:
+    // Our pp ghosts were last read as pc ghosts, so neighbours may write them
+    MPI_Win_post(exchange->rma.group, 0, exchange->rma.window);
+    break;
+  case DC_HALO_LIST:
+    dc_list_post(&exchange->list, comm);
+    break;
+  }
+  process->halo_stats.seconds += MPI_Wtime() - start_time;
+}
+
+void dc_halo_exchange_start(dc_halo_exchange_t *exchange,
+                            dc_process_t *process, MPI_Comm comm,
+                            dc_device_data *data) {
+  double start_time = MPI_Wtime();
+  switch (exchange->mode) {
+  case DC_HALO_NEIGHBOURHOOD:
+  case DC_HALO_SHARED:
+    dc_send_halo_to_neighbours(process, comm, HALO_TAG, data, data->pp,
+                               data->qp, &exchange->send_requests);
+    break;
+  case DC_HALO_STAGED:
+    // The x phase only needs the boundaries, so it overlaps the interior
+    dc_staged_phase_begin(&exchange->phase, process, comm, data, 0);
+    break;
+  case DC_HALO_RMA:
+    dc_rma_put_halos(&exchange->rma, process, data);
+    break;
+  case DC_HALO_LIST:
+    dc_list_send(&exchange->list, process, comm, data);
+    break;
+  }
+  process->halo_stats.seconds += MPI_Wtime() - start_time;
+}
+
+void dc_halo_exchange_finish(dc_halo_exchange_t *exchange,
+                             dc_process_t *process, MPI_Comm comm,
+                             dc_device_data *data) {
+  double start_time = MPI_Wtime();
+  switch (exchange->mode) {
+  case DC_HALO_SHARED:
+    // Every rank on the node has its boundaries in place once it gets here;
+    // the syncs on both sides of the barrier order the writers' stores
+    // before our loads on weakly ordered CPUs
+    MPI_Win_sync(exchange->shared.window);
+    MPI_Barrier(exchange->shared.node_comm);
+    MPI_Win_sync(exchange->shared.window);
+    dc_shared_copy_halos(&exchange->shared, process, data);
+    // fall through: off-node neighbours still use messages
+  case DC_HALO_NEIGHBOURHOOD:
+    MPI_Waitall(exchange->halos.requests.count,
+                exchange->halos.requests.requests, MPI_STATUSES_IGNORE);
+    dc_worker_insert_halos(process, &exchange->halos, data, data->pp,
+                           data->qp);
+    dc_free_worker_halos(&exchange->halos);
+
+    MPI_Waitall(exchange->send_requests.count,
+                exchange->send_requests.requests, MPI_STATUSES_IGNORE);
+    dc_free_worker_requests(&exchange->send_requests);
+
+    if (exchange->mode == DC_HALO_SHARED) {
+      // Neighbours must be done reading our boundaries before the source
+      // is injected and the buffer is reused
+      MPI_Win_sync(exchange->shared.window);
+      MPI_Barrier(exchange->shared.node_comm);
+      MPI_Win_sync(exchange->shared.window);
+      exchange->shared.iteration++;
+    }
+    break;
+  case DC_HALO_STAGED:
+    dc_staged_phase_end(&exchange->phase, process, data);
+    for (int axis = 1; axis < DIMENSIONS; axis++) {
+      dc_staged_phase_begin(&exchange->phase, process, comm, data, axis);
+      dc_staged_phase_end(&exchange->phase, process, data);
+    }
+    break;
+  case DC_HALO_RMA:
+    dc_rma_complete(&exchange->rma, process);
+    break;
+  case DC_HALO_LIST:
+    dc_list_insert(&exchange->list, process, data);
+    break;
+  }
+  process->halo_stats.seconds += MPI_Wtime() - start_time;
+}
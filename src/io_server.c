@@ -0,0 +1,221 @@
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "io_server.h"
+#include "log.h"
+
+// A set being written: the records of one snapshot, or the final fields
+typedef struct {
+  uint64_t iteration;
+  int final;
+  FILE *file;
+  uint32_t records;
+} dc_io_set_t;
+
+int dc_io_split(int servers, MPI_Comm *compute, MPI_Comm *io) {
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  if (servers >= size) {
+    dc_log_error(rank, "%d I/O servers leave no rank to compute on",
+                 servers);
+    MPI_Finalize();
+    exit(1);
+  }
+  const int server = rank >= size - servers;
+  MPI_Comm_split(MPI_COMM_WORLD, server, rank, compute);
+  MPI_Comm_dup(MPI_COMM_WORLD, io);
+  if (server)
+    MPI_Comm_free(compute);
+  return server;
+}
+
+static dc_io_set_t *dc_io_set_open(dc_io_set_t **sets, size_t *count,
+                                   const dc_rank_header_t *header, int final,
+                                   int rank, int index,
+                                   const char *output_file) {
+  for (size_t s = 0; s < *count; s++) {
+    if ((*sets)[s].iteration == header->iteration && (*sets)[s].final == final)
+      return &(*sets)[s];
+  }
+  dc_io_set_t *grown =
+      (dc_io_set_t *)realloc(*sets, (*count + 1) * sizeof(dc_io_set_t));
+  if (grown == NULL) {
+    dc_log_error(rank, "OOM: could not allocate memory in dc_io_set_open");
+    MPI_Finalize();
+    exit(1);
+  }
+  *sets = grown;
+  dc_io_set_t *set = &grown[(*count)++];
+  set->iteration = header->iteration;
+  set->final = final;
+  set->records = 0;
+
+  // <output>.<index>, or <output>.<iteration>.<index> for a snapshot
+  char path[4096];
+  if (final)
+    dc_rank_file_path(path, sizeof(path), output_file, index);
+  else
+    snprintf(path, sizeof(path), "%s.%llu.%d", output_file,
+             (unsigned long long)header->iteration, index);
+  set->file = fopen(path, "wb");
+  if (set->file == NULL) {
+    dc_log_error(rank, "Failed to open output file: %s", path);
+    MPI_Finalize();
+    exit(1);
+  }
+  return set;
+}
+
+void dc_io_server_run(MPI_Comm io, int servers,
+                      const dc_arguments_t *arguments) {
+  int rank, size;
+  MPI_Comm_rank(io, &rank);
+  MPI_Comm_size(io, &size);
+  const int computing = size - servers;
+  const int index = rank - computing;
+  // Compute ranks c with c % servers == index
+  const uint32_t clients = (computing - index + servers - 1) / servers;
+  const int level = arguments->output_compression;
+
+  dc_io_set_t *sets = NULL;
+  size_t open_sets = 0;
+  float *fields = NULL;
+  size_t capacity = 0;
+  size_t records = 0;
+  double raw_bytes = 0, stored_bytes = 0, writing = 0;
+  double start_time = MPI_Wtime();
+
+  for (uint32_t done = 0; done < clients;) {
+    // The next message from any client starts a record: the data of the
+    // previous one was received right after its header
+    dc_rank_header_t header;
+    MPI_Status status;
+    MPI_Recv(&header, sizeof(header), MPI_BYTE, MPI_ANY_SOURCE, MPI_ANY_TAG,
+             io, &status);
+    if (status.MPI_TAG == DC_IO_DONE_TAG) {
+      done++;
+      continue;
+    }
+    const size_t count = 2 * dc_rank_cells(&header);
+    if (count > capacity) {
+      free(fields);
+      capacity = count;
+      fields = (float *)malloc(capacity * sizeof(float));
+      if (fields == NULL) {
+        dc_log_error(rank, "OOM: could not allocate an I/O server buffer");
+        MPI_Finalize();
+        exit(1);
+      }
+    }
+    for (size_t received = 0; received < count; received += DC_MPI_CHUNK) {
+      size_t chunk =
+          count - received < DC_MPI_CHUNK ? count - received : DC_MPI_CHUNK;
+      MPI_Recv(fields + received, (int)chunk, MPI_FLOAT, status.MPI_SOURCE,
+               DC_IO_DATA_TAG, io, MPI_STATUS_IGNORE);
+    }
+
+#ifndef SIMGRID
+    const int final = status.MPI_TAG == DC_IO_FINAL_TAG;
+    double write_start = MPI_Wtime();
+    dc_io_set_t *set = dc_io_set_open(&sets, &open_sets, &header, final, rank,
+                                      index, arguments->output_file);
+    header.codec = level > 0 ? DC_CODEC_DEFLATE : DC_CODEC_NONE;
+    if (!dc_rank_record_write(set->file, &header, fields, level)) {
+      dc_log_error(rank, "Failed to write a record of iteration %llu",
+                   (unsigned long long)header.iteration);
+      MPI_Finalize();
+      exit(1);
+    }
+    if (++set->records == clients) {
+      if (fclose(set->file) != 0) {
+        dc_log_error(rank, "Failed to close the output of iteration %llu",
+                     (unsigned long long)header.iteration);
+        MPI_Finalize();
+        exit(1);
+      }
+      *set = sets[--open_sets];
+    }
+    writing += MPI_Wtime() - write_start;
+    stored_bytes += header.bytes;
+#endif
+    raw_bytes += count * sizeof(float);
+    records++;
+  }
+  free(fields);
+  free(sets);
+
+  dc_log_info(rank,
+              "I/O server %d: %zu records from %u ranks, %.1f MB stored as "
+              "%.1f MB, %.3f s of %.3f s writing (%.0f MB/s)",
+              index, records, clients, raw_bytes / 1e6, stored_bytes / 1e6,
+              writing, MPI_Wtime() - start_time,
+              writing > 0 ? stored_bytes / 1e6 / writing : 0.0);
+}
+
+void dc_io_client_init(dc_io_client_t *client, MPI_Comm io, int servers) {
+  int rank, size;
+  MPI_Comm_rank(io, &rank);
+  MPI_Comm_size(io, &size);
+  *client = (dc_io_client_t){0};
+  client->comm = io;
+  // Compute ranks are the first world ranks, in order
+  client->server = size - servers + rank % servers;
+}
+
+void dc_io_client_send(dc_io_client_t *client, const dc_process_t *process,
+                       uint64_t iteration, int final) {
+  const int b = client->current;
+  if (client->pending[b] != 0) {
+    double start = MPI_Wtime();
+    MPI_Waitall(client->pending[b], client->requests[b], MPI_STATUSES_IGNORE);
+    client->waiting += MPI_Wtime() - start;
+    client->pending[b] = 0;
+  }
+
+  dc_rank_header_t *header = &client->headers[b];
+  const size_t count = 2 * dc_rank_pack(process, iteration, header, NULL);
+  if (count > client->capacities[b]) {
+    // Rebalancing may have grown the box
+    free(client->buffers[b]);
+    free(client->requests[b]);
+    client->capacities[b] = count;
+    client->buffers[b] = (float *)malloc(count * sizeof(float));
+    client->requests[b] = (MPI_Request *)malloc(
+        (1 + (count + DC_MPI_CHUNK - 1) / DC_MPI_CHUNK) * sizeof(MPI_Request));
+    if (client->buffers[b] == NULL || client->requests[b] == NULL) {
+      dc_log_error(process->rank,
+                   "OOM: could not allocate memory in dc_io_client_send");
+      MPI_Finalize();
+      exit(1);
+    }
+  }
+  dc_rank_pack(process, iteration, header, client->buffers[b]);
+
+  int requests = 0;
+  MPI_Isend(header, sizeof(*header), MPI_BYTE, client->server,
+            final ? DC_IO_FINAL_TAG : DC_IO_SNAPSHOT_TAG, client->comm,
+            &client->requests[b][requests++]);
+  for (size_t sent = 0; sent < count; sent += DC_MPI_CHUNK) {
+    size_t chunk = count - sent < DC_MPI_CHUNK ? count - sent : DC_MPI_CHUNK;
+    MPI_Isend(client->buffers[b] + sent, (int)chunk, MPI_FLOAT,
+              client->server, DC_IO_DATA_TAG, client->comm,
+              &client->requests[b][requests++]);
+  }
+  client->pending[b] = requests;
+  client->current = !b;
+}
+
+void dc_io_client_finish(dc_io_client_t *client) {
+  double start = MPI_Wtime();
+  for (int b = 0; b < 2; b++) {
+    if (client->pending[b] != 0)
+      MPI_Waitall(client->pending[b], client->requests[b],
+                  MPI_STATUSES_IGNORE);
+    free(client->buffers[b]);
+    free(client->requests[b]);
+  }
+  client->waiting += MPI_Wtime() - start;
+  MPI_Send(NULL, 0, MPI_BYTE, client->server, DC_IO_DONE_TAG, client->comm);
+}
@@ -1,16 +1,25 @@
 #include <argp.h>
-#include <math.h>
 #include <mpi.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include "boundary.h"
+#include "balance.h"
+#include "chunked.h"
 #include "coordinator.h"
-#include "indexing.h"
+#include "halo.h"
+#include "io_server.h"
 #include "log.h"
+#include "materials.h"
+#include "model_cache.h"
+#include "partition.h"
+#include "physics.h"
 #include "precomp.h"
+#include "region.h"
 #include "setup.h"
+#include "snapshot.h"
+#include "sponge.h"
+#include "topology.h"
 #include "worker.h"
 
 static struct argp_option options[] = {
@@ -23,11 +32,109 @@ static struct argp_option options[] = {
     {"dt", 134, "FLOAT", 0, "Step size in time"},
     {"time-max", 't', "FLOAT", 0, "Max time"},
     {"absorption", 'a', "INTEGER", 0, "Absorption zone size"},
+    {"boundary", 148, "KIND", 0,
+     "Absorbing zone: random (default) velocities, or a sponge damping the "
+     "waves, which needs a much thinner zone"},
     {"output-file", 'o', "PATH", 0,
      "Path to the file to output the results to"},
+    {"output-format", 150, "FORMAT", 0,
+     "raw (default) padded grid, p then q, or chunked: a header, an index "
+     "and chunks readers can fetch on their own (see dc-read)"},
+    {"output-chunk", 151, "INTEGER", 0,
+     "Edge of the chunks of chunked output, 32 by default"},
+    {"output-compression", 152, "LEVEL", 0,
+     "zlib level (1-9) chunked output, per-rank output and snapshots are "
+     "compressed with, 0 (default) for none"},
+    {"output-box", 153, "X0,Y0,Z0,X1,Y1,Z1", 0,
+     "Only output the cells from (X0, Y0, Z0) up to, excluding, (X1, Y1, Z1) "
+     "of the problem domain, without ghosts or absorbing zone"},
+    {"output-stride", 154, "K[,KY,KZ]", 0,
+     "Only output every K-th cell of the problem domain (or of the box) along "
+     "each axis"},
+    {"output-plane", 155, "AXIS=INDEX", 0,
+     "Only output the plane at INDEX of the problem domain across AXIS (x, y "
+     "or z)"},
+    {"per-rank-output", 149, 0, 0,
+     "Every rank writes its cells to PATH.<rank> instead of sending them to "
+     "the coordinator; dc-merge assembles or reads the set"},
+    {"snapshot-interval", 157, "INTEGER", 0,
+     "Also output the fields every INTEGER iterations, to the per-rank sets "
+     "PATH.<iteration>"},
+    {"io-servers", 156, "INTEGER", 0,
+     "Set the last INTEGER ranks apart to write snapshots and results, which "
+     "the others hand to them without waiting; the result is a per-rank set "
+     "of PATH.<server> files"},
+    {"halo-exchange", 135, "MODE", 0,
+     "Halo exchange algorithm: neighbourhood (default), staged, shared, rma "
+     "or list"},
+    {"mpi-dims", 136, 0, 0,
+     "Use MPI_Dims_create and MPI rank order instead of the halo-minimising, "
+     "node-aware topology"},
+    {"decomposition", 141, "KIND", 0,
+     "Domain decomposition: cartesian (default) slabs, or bisection for a "
+     "near-cubic box per rank at any rank count"},
+    {"layout", 143, "LAYOUT", 0,
+     "Memory layout the kernels work on: flat (default), bricked, in "
+     "contiguous 8x8x8 bricks, or interleaved, with p and q side by side"},
+    {"physics", 146, "MODE", 0,
+     "Operator the kernels evaluate: auto (default), the fewest terms the "
+     "model needs, or isotropic, vti or tti"},
+    {"temporal-block", 147, "STEPS", 0,
+     "Advance the box STEPS iterations per pass in a wavefront of z bands "
+     "that stays in cache, exchanging halos (STEPS - 1) x 4 cells deeper "
+     "once per pass and recomputing them on each rank that reads them; "
+     "disables --rebalance-interval and --halo-exchange"},
+    {"uniform-tiles", 145, 0, 0,
+     "Propagate 8x8x8 tiles with one coefficient tuple for all their cells "
+     "without reading the per-cell model, and log how many there are"},
+    {"model-cache", 142, "DIR", 0,
+     "Map each rank's model and coefficients from DIR, computing and storing "
+     "them there on the first run"},
+    {"materials", 144, "INTEGER", 0,
+     "Replace the per-cell coefficients with a table of at most INTEGER "
+     "materials (up to 65536), quantizing the model if needed, and a 16-bit "
+     "material ID per cell"},
+    {"host-weights", 137, "LIST", 0,
+     "Size slabs by per-rank throughput given as host=weight pairs separated "
+     "by commas; unlisted hosts weigh 1"},
+    {"calibrate", 138, 0, 0,
+     "Size slabs by per-rank throughput measured in a short calibration run "
+     "and averaged per host"},
+    {"rebalance-interval", 139, "INTEGER", 0,
+     "Check the load balance every INTEGER iterations and migrate planes "
+     "between neighbours when it is off (default: never)"},
+    {"rebalance-threshold", 140, "FLOAT", 0,
+     "Slowest rank's compute time over the mean that triggers migration "
+     "(default: 1.10)"},
     {0},
 };
 
+// Fill in the parts of the output region left out: the whole problem domain,
+// every cell, then narrow it to the plane
+static void dc_complete_region(struct argp_state *state,
+                               dc_arguments_t *arguments) {
+  if (arguments->per_rank_output || arguments->chunked_output)
+    argp_error(state, "regions are written to a single raw file");
+  dc_region_t *region = &arguments->output_region;
+  const size_t sizes[DIMENSIONS] = {arguments->size_x, arguments->size_y,
+                                    arguments->size_z};
+  for (int i = 0; i < DIMENSIONS; i++) {
+    if (region->hi[i] == 0)
+      region->hi[i] = sizes[i];
+    if (region->stride[i] == 0)
+      region->stride[i] = 1;
+    if (arguments->output_plane_axis == i + 1) {
+      if (arguments->output_plane < region->lo[i] ||
+          arguments->output_plane >= region->hi[i])
+        argp_error(state, "the output plane lies outside the output box");
+      region->lo[i] = arguments->output_plane;
+      region->hi[i] = arguments->output_plane + 1;
+    }
+    if (region->lo[i] >= region->hi[i] || region->hi[i] > sizes[i])
+      argp_error(state, "the output box must lie within the problem domain");
+  }
+}
+
 static error_t parse_opt(int key, char *arg, struct argp_state *state) {
   dc_arguments_t *arguments = state->input;
   switch (key) {
@@ -61,6 +168,144 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
   case 'o':
     arguments->output_file = strdup(arg);
     break;
+  case 136:
+    arguments->mpi_dims = 1;
+    break;
+  case 137:
+    arguments->host_weights = strdup(arg);
+    break;
+  case 138:
+    arguments->calibrate = 1;
+    break;
+  case 139:
+    arguments->rebalance_interval = atoi(arg);
+    break;
+  case 140:
+    arguments->rebalance_threshold = atof(arg);
+    break;
+  case 147:
+    arguments->temporal_steps = atoi(arg);
+    if (arguments->temporal_steps == 0) {
+      argp_error(state, "temporal-block must be at least 1");
+    }
+    break;
+  case 150:
+    if (strcmp(arg, "raw") == 0) {
+      arguments->chunked_output = 0;
+    } else if (strcmp(arg, "chunked") == 0) {
+      arguments->chunked_output = 1;
+    } else {
+      argp_error(state, "unknown output format: %s", arg);
+    }
+    break;
+  case 151:
+    arguments->output_chunk = atoi(arg);
+    if (arguments->output_chunk == 0)
+      argp_error(state, "chunks need at least one cell: %s", arg);
+    break;
+  case 152:
+    arguments->output_compression = atoi(arg);
+    if (arguments->output_compression < 0 ||
+        arguments->output_compression > 9)
+      argp_error(state, "compression levels go from 0 to 9: %s", arg);
+    break;
+  case 153:
+    if (sscanf(arg, "%zu,%zu,%zu,%zu,%zu,%zu",
+               &arguments->output_region.lo[0], &arguments->output_region.lo[1],
+               &arguments->output_region.lo[2], &arguments->output_region.hi[0],
+               &arguments->output_region.hi[1],
+               &arguments->output_region.hi[2]) != 6) {
+      argp_error(state, "malformed output box: %s", arg);
+    }
+    arguments->region_output = 1;
+    break;
+  case 154: {
+    size_t *stride = arguments->output_region.stride;
+    int read = sscanf(arg, "%zu,%zu,%zu", &stride[0], &stride[1], &stride[2]);
+    if (read == 1) {
+      stride[1] = stride[2] = stride[0];
+    } else if (read != 3) {
+      argp_error(state, "malformed output stride: %s", arg);
+    }
+    if (stride[0] == 0 || stride[1] == 0 || stride[2] == 0)
+      argp_error(state, "output strides must be positive: %s", arg);
+    arguments->region_output = 1;
+    break;
+  }
+  case 155: {
+    char axis;
+    if (sscanf(arg, "%c=%zu", &axis, &arguments->output_plane) != 2 ||
+        axis < 'x' || axis > 'z') {
+      argp_error(state, "malformed output plane: %s", arg);
+    }
+    arguments->output_plane_axis = 1 + axis - 'x';
+    arguments->region_output = 1;
+    break;
+  }
+  case 149:
+    arguments->per_rank_output = 1;
+    break;
+  case 156:
+    arguments->io_servers = atoi(arg);
+    if (arguments->io_servers < 1)
+      argp_error(state, "there must be at least one I/O server");
+    break;
+  case 157:
+    arguments->snapshot_interval = strtoul(arg, NULL, 10);
+    break;
+  case 148:
+    if (strcmp(arg, "random") == 0) {
+      arguments->sponge = 0;
+    } else if (strcmp(arg, "sponge") == 0) {
+      arguments->sponge = 1;
+    } else {
+      argp_error(state, "unknown boundary: %s", arg);
+    }
+    break;
+  case 146:
+    if (!dc_physics_parse(arg, &arguments->physics)) {
+      argp_error(state, "unknown physics: %s", arg);
+    }
+    break;
+  case 145:
+    arguments->uniform_tiles = 1;
+    break;
+  case 142:
+    arguments->model_cache = strdup(arg);
+    break;
+  case 144:
+    arguments->materials = strtoul(arg, NULL, 10);
+    if (arguments->materials == 0 ||
+        arguments->materials > DC_MAX_MATERIALS) {
+      argp_error(state, "materials must be between 1 and %d",
+                 DC_MAX_MATERIALS);
+    }
+    break;
+  case 141:
+    if (strcmp(arg, "cartesian") == 0) {
+      arguments->decomposition = DC_DECOMPOSITION_CARTESIAN;
+    } else if (strcmp(arg, "bisection") == 0) {
+      arguments->decomposition = DC_DECOMPOSITION_BISECTION;
+    } else {
+      argp_error(state, "unknown decomposition: %s", arg);
+    }
+    break;
+  case 143:
+    if (strcmp(arg, "flat") == 0) {
+      arguments->layout = DC_LAYOUT_FLAT;
+    } else if (strcmp(arg, "bricked") == 0) {
+      arguments->layout = DC_LAYOUT_BRICKED;
+    } else if (strcmp(arg, "interleaved") == 0) {
+      arguments->layout = DC_LAYOUT_INTERLEAVED;
+    } else {
+      argp_error(state, "unknown layout: %s", arg);
+    }
+    break;
+  case 135:
+    if (!dc_halo_mode_parse(arg, &arguments->halo_mode)) {
+      argp_error(state, "unknown halo exchange mode: %s", arg);
+    }
+    break;
   case ARGP_KEY_END:
     if (arguments->size_x == 0 || arguments->size_y == 0 ||
         arguments->size_z == 0 || arguments->dx == 0 || arguments->dy == 0 ||
@@ -68,6 +313,15 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
         arguments->absorption_size == 0 || arguments->output_file == NULL) {
       argp_usage(state);
     }
+    if (arguments->per_rank_output && arguments->chunked_output)
+      argp_error(state, "per-rank output files are always raw");
+    if (arguments->io_servers > 0 &&
+        (arguments->chunked_output || arguments->region_output))
+      argp_error(state, "I/O servers write per-rank output");
+    if (arguments->output_chunk == 0)
+      arguments->output_chunk = DC_CHUNKED_DEFAULT_CHUNK;
+    if (arguments->region_output)
+      dc_complete_region(state, arguments);
     break;
   default:
     return ARGP_ERR_UNKNOWN;
@@ -83,13 +337,24 @@ int main(int argc, char **argv) {
   MPI_Init(&argc, &argv);
   dc_arguments_t arguments = {0};
   argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+  // Ranks compute over `world`, MPI_COMM_WORLD less the I/O servers
+  MPI_Comm world = MPI_COMM_WORLD, io = MPI_COMM_NULL;
+  if (arguments.io_servers > 0 &&
+      dc_io_split(arguments.io_servers, &world, &io)) {
+    dc_io_server_run(io, arguments.io_servers, &arguments);
+    MPI_Comm_free(&io);
+    free(arguments.output_file);
+    free(arguments.host_weights);
+    free(arguments.model_cache);
+    MPI_Finalize();
+    return 0;
+  }
+
   MPI_Comm communicator;
   int topology[DIMENSIONS] = {0};
   int rank, size;
-  MPI_Comm_size(MPI_COMM_WORLD, &size);
-  MPI_Dims_create(size, DIMENSIONS, topology);
-  dc_mpi_world_init(&communicator, topology);
-  MPI_Comm_rank(communicator, &rank);
+  MPI_Comm_size(world, &size);
 
   const size_t sx =
       arguments.size_x + 2 * arguments.absorption_size + 2 * STENCIL;
@@ -97,105 +362,141 @@ int main(int argc, char **argv) {
       arguments.size_y + 2 * arguments.absorption_size + 2 * STENCIL;
   const size_t sz =
       arguments.size_z + 2 * arguments.absorption_size + 2 * STENCIL;
+  const size_t global_sizes[DIMENSIONS] = {sx, sy, sz};
+
+  int key;
+  if (arguments.decomposition == DC_DECOMPOSITION_BISECTION) {
+    // A 1D process grid only provides the rank order; bisection keeps
+    // consecutive ranks, and so the ranks of a node, spatially together
+    topology[0] = size;
+    topology[1] = topology[2] = 1;
+    MPI_Comm_rank(world, &key);
+  } else if (arguments.mpi_dims) {
+    MPI_Dims_create(size, DIMENSIONS, topology);
+    MPI_Comm_rank(world, &key);
+  } else {
+    dc_select_topology(size, global_sizes,
+                       dc_physics_footprint(arguments.physics), topology);
+    key = dc_node_aware_rank_key(world, topology, global_sizes);
+  }
+  dc_mpi_world_init(&communicator, world, topology, key);
+  MPI_Comm_rank(communicator, &rank);
 
   dc_process_t mpi_process =
       dc_process_init(communicator, rank, size, topology, sx, sy, sz,
-                      arguments.dx, arguments.dy, arguments.dz, arguments.dt);
-
-  if (rank == COORDINATOR) {
-    dc_log_info(rank, "Distributing partition info to workers...");
-    dc_distribute_partition_info(communicator, (unsigned int *)topology,
-                                 arguments, size);
-
-    size_t partition_size_x = (sx - 2 * STENCIL) / topology[0];
-    size_t partition_size_y = (sy - 2 * STENCIL) / topology[1];
-    size_t partition_size_z = (sz - 2 * STENCIL) / topology[2];
-    size_t remainder_x = (sx - 2 * STENCIL) % topology[0];
-    size_t remainder_y = (sy - 2 * STENCIL) % topology[1];
-    size_t remainder_z = (sz - 2 * STENCIL) % topology[2];
-
-    // Coordinator is always at position (0,0,0)
-    mpi_process.sizes[0] = partition_size_x + 2 * STENCIL;
-    mpi_process.sizes[1] = partition_size_y + 2 * STENCIL;
-    mpi_process.sizes[2] = partition_size_z + 2 * STENCIL;
-
-    // Handle remainder for last process in each dimension
-    // Coordinator at (0,0,0) doesn't get remainder unless it's also the last
-    if (topology[0] == 1)
-      mpi_process.sizes[0] += remainder_x;
-    if (topology[1] == 1)
-      mpi_process.sizes[1] += remainder_y;
-    if (topology[2] == 1)
-      mpi_process.sizes[2] += remainder_z;
-
-    size_t count = dc_compute_count_from_sizes(mpi_process.sizes);
-    mpi_process.iterations = ceil(arguments.time_max / arguments.dt);
-
-    // Check if source is in coordinator's partition
-    size_t source_x, source_y, source_z;
-    dc_determine_source(sx, sy, sz, &source_x, &source_y, &source_z);
-    if (source_x < mpi_process.sizes[0] && source_y < mpi_process.sizes[1] &&
-        source_z < mpi_process.sizes[2]) {
-      mpi_process.source_index = (int)dc_get_index_for_coordinates(
-          source_x, source_y, source_z, mpi_process.sizes[0],
-          mpi_process.sizes[1], mpi_process.sizes[2]);
-    } else {
-      mpi_process.source_index = -1;
-    }
+                      arguments.dx, arguments.dy, arguments.dz, arguments.dt,
+                      dc_physics_footprint(arguments.physics));
+  mpi_process.halo_mode = arguments.halo_mode;
+  mpi_process.decomposition = arguments.decomposition;
+  mpi_process.layout = arguments.layout;
+  mpi_process.uniform_tiles = arguments.uniform_tiles;
+  mpi_process.temporal_steps = arguments.temporal_steps;
+  mpi_process.rebalance_interval = arguments.rebalance_interval;
+  mpi_process.rebalance_threshold = arguments.rebalance_threshold != 0
+                                        ? arguments.rebalance_threshold
+                                        : DC_REBALANCE_THRESHOLD;
+  mpi_process.snapshot_interval = arguments.snapshot_interval;
+  mpi_process.output_file = arguments.output_file;
+  mpi_process.output_compression = arguments.output_compression;
+  dc_io_client_t io_client;
+  if (io != MPI_COMM_NULL) {
+    dc_io_client_init(&io_client, io, arguments.io_servers);
+    mpi_process.io_client = &io_client;
+  }
 
-    mpi_process.pp = (float *)calloc(count, sizeof(float));
-    mpi_process.pc = (float *)calloc(count, sizeof(float));
-    mpi_process.qp = (float *)calloc(count, sizeof(float));
-    mpi_process.qc = (float *)calloc(count, sizeof(float));
-    if (mpi_process.pp == NULL || mpi_process.pc == NULL ||
-        mpi_process.qp == NULL || mpi_process.qc == NULL) {
-      dc_log_error(rank, "OOM: could not allocate field arrays");
+  // Per-rank throughput in Cartesian rank order, or NULL for equal slabs
+  double *weights = NULL;
+  if (arguments.calibrate || arguments.host_weights != NULL) {
+    weights = (double *)malloc(size * sizeof(double));
+    if (weights == NULL) {
+      dc_log_error(rank, "OOM: could not allocate partition weights");
       MPI_Finalize();
       exit(1);
     }
-
-    // Compute anisotropy and precomp vars for coordinator's partition
-    mpi_process.anisotropy_vars = dc_compute_anisotropy_vars(
-        mpi_process.sizes[0], mpi_process.sizes[1], mpi_process.sizes[2]);
-    unsigned int seed = 0;
-    // Coordinator is at global position (0,0,0)
-    randomVelocityBoundaryPartition(
-        mpi_process.sizes[0], mpi_process.sizes[1],
-        mpi_process.sizes[2], // Local sizes
-        sx, sy, sz,           // Global sizes
-        0, 0, 0,              // Start coords (coordinator at origin)
-        arguments.size_x, arguments.size_y, arguments.size_z, // Problem sizes
-        STENCIL, arguments.absorption_size, mpi_process.anisotropy_vars.vpz,
-        mpi_process.anisotropy_vars.vsv, &seed);
-    mpi_process.precomp_vars = dc_compute_precomp_vars(
-        mpi_process.sizes[0], mpi_process.sizes[1], mpi_process.sizes[2],
-        mpi_process.anisotropy_vars);
-
-    dc_log_info(
-        rank, "Coordinator initialized locally with sizes %zu x %zu x %zu",
-        mpi_process.sizes[0], mpi_process.sizes[1], mpi_process.sizes[2]);
-  } else {
-    dc_log_info(rank, "Awaiting partition info from coordinator...");
-    dc_worker_init_from_partition_info(&mpi_process, communicator);
-    dc_log_info(rank, "Local initialization complete.");
+    double weight;
+    if (arguments.calibrate) {
+      // Ranks of a node share its measured throughput, averaged
+      MPI_Comm node;
+      MPI_Comm_split_type(communicator, MPI_COMM_TYPE_SHARED, rank,
+                          MPI_INFO_NULL, &node);
+      double throughput = dc_worker_calibrate(&mpi_process);
+      MPI_Allreduce(&throughput, &weight, 1, MPI_DOUBLE, MPI_SUM, node);
+      weight /= mpi_process.node_size;
+      MPI_Comm_free(&node);
+    } else {
+      char hostname[MPI_MAX_PROCESSOR_NAME] = {0};
+      int length;
+      MPI_Get_processor_name(hostname, &length);
+      if (!dc_parse_host_weight(arguments.host_weights, hostname, &weight)) {
+        dc_log_error(rank, "Malformed host weights: %s",
+                     arguments.host_weights);
+        MPI_Finalize();
+        exit(1);
+      }
+    }
+    MPI_Allgather(&weight, 1, MPI_DOUBLE, weights, 1, MPI_DOUBLE,
+                  communicator);
   }
+
+  // Every rank builds the same partition and initializes its own box
+  dc_partition_t partition =
+      arguments.decomposition == DC_DECOMPOSITION_BISECTION
+          ? dc_partition_bisect(size, global_sizes, weights)
+          : dc_partition_create(topology, global_sizes, weights);
+  if (rank == COORDINATOR)
+    dc_partition_log(rank, &partition, weights);
+  dc_worker_init(&mpi_process, &partition, arguments);
+  dc_physics_select(&mpi_process, arguments.physics, communicator);
+  dc_sponge_init(&mpi_process, communicator);
+  dc_partition_free(&partition);
+
   dc_log_info(rank, "Starting worker process...");
   double start_time = MPI_Wtime();
   double msamples_per_s = dc_worker_process(&mpi_process, communicator);
   double end_time = MPI_Wtime();
   double total_time = end_time - start_time;
-  dc_send_data_to_coordinator(mpi_process, communicator);
+  if (arguments.snapshot_interval != 0)
+    dc_snapshot_report(&mpi_process, communicator, total_time);
+  if (mpi_process.io_client != NULL) {
+    double handoff_start = MPI_Wtime();
+    dc_io_client_send(&io_client, &mpi_process, mpi_process.iterations, 1);
+    dc_io_client_finish(&io_client);
+    if (rank == COORDINATOR)
+      dc_log_info(rank, "Results handed to the I/O servers in %.3f s",
+                  MPI_Wtime() - handoff_start);
+  } else if (arguments.per_rank_output) {
 #ifndef SIMGRID
-  if (rank == COORDINATOR) {
-    dc_receive_and_write_results(mpi_process, communicator, sx, sy, sz,
-                                 arguments.output_file);
-  }
+    dc_write_rank_results(&mpi_process, arguments.output_file,
+                          mpi_process.iterations,
+                          arguments.output_compression);
+#endif
+  } else if (arguments.region_output) {
+#ifndef SIMGRID
+    dc_region_write(&mpi_process, communicator, &arguments.output_region,
+                    arguments.absorption_size + STENCIL,
+                    arguments.output_file);
+#endif
+  } else if (arguments.chunked_output) {
+#ifndef SIMGRID
+    dc_gather_and_write_chunked(&mpi_process, communicator, &arguments);
 #endif
+  } else {
+    dc_send_data_to_coordinator(mpi_process, communicator);
+#ifndef SIMGRID
+    if (rank == COORDINATOR) {
+      dc_receive_and_write_results(mpi_process, communicator, sx, sy, sz,
+                                   arguments.output_file);
+    }
+#endif
+  }
   dc_worker_free(mpi_process);
 
   free(arguments.output_file);
-  dc_free_anisotropy_vars(&mpi_process.anisotropy_vars);
-  dc_free_precomp_vars(&mpi_process.precomp_vars);
+  free(arguments.host_weights);
+  free(arguments.model_cache);
+  free(weights);
+  dc_model_free(&mpi_process);
+  dc_materials_free(&mpi_process);
 
   if (rank == COORDINATOR) {
     printf("rank,total_time,msamples_per_s\n");
@@ -214,6 +515,10 @@ int main(int argc, char **argv) {
     printf("*,%lf,%lf\n", total_time, global_msamples_per_s);
   }
 
+  if (io != MPI_COMM_NULL) {
+    MPI_Comm_free(&io);
+    MPI_Comm_free(&world);
+  }
   MPI_Finalize();
   return 0;
 }
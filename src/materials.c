@@ -0,0 +1,199 @@
+#include <math.h>
+#include <mpi.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "indexing.h"
+#include "log.h"
+#include "materials.h"
+#include "model_cache.h"
+
+#define MATERIAL_COLUMNS 10
+
+// Per-cell model bytes dropped once the table is built: the anisotropy and
+// precomputed arrays
+#define MODEL_BYTES_PER_CELL (16 * sizeof(float))
+
+static const char *column_names[MATERIAL_COLUMNS] = {
+    "ch1dxx", "ch1dyy", "ch1dzz", "ch1dxy", "ch1dyz",
+    "ch1dxz", "v2px",   "v2pz",   "v2sz",   "v2pn"};
+
+typedef struct {
+  uint32_t key[MATERIAL_COLUMNS];
+  float first[MATERIAL_COLUMNS];
+  double sum[MATERIAL_COLUMNS];
+  size_t cells;
+  uint16_t id;
+  int used;
+} dc_material_slot_t;
+
+static void dc_precomp_columns(dc_precomp_vars *vars,
+                               float **columns[MATERIAL_COLUMNS]) {
+  float **all[MATERIAL_COLUMNS] = {
+      &vars->ch1dxx, &vars->ch1dyy, &vars->ch1dzz, &vars->ch1dxy,
+      &vars->ch1dyz, &vars->ch1dxz, &vars->v2px,   &vars->v2pz,
+      &vars->v2sz,   &vars->v2pn,
+  };
+  memcpy(columns, all, sizeof(all));
+}
+
+static size_t dc_material_hash(const uint32_t key[MATERIAL_COLUMNS]) {
+  uint64_t hash = 14695981039346656037ull;
+  for (int c = 0; c < MATERIAL_COLUMNS; c++) {
+    hash ^= key[c];
+    hash *= 1099511628211ull;
+  }
+  return (size_t)(hash ^ (hash >> 32));
+}
+
+// Give every cell the ID of its key's slot, with exact keys (the float bits)
+// when `levels` is 0 and grid levels otherwise. Returns the number of
+// materials, or max_materials + 1 as soon as there are too many.
+static size_t dc_materials_assign(float *columns[MATERIAL_COLUMNS], size_t n,
+                                  unsigned int levels,
+                                  const float min[MATERIAL_COLUMNS],
+                                  const float max[MATERIAL_COLUMNS],
+                                  dc_material_slot_t *slots, size_t capacity,
+                                  size_t max_materials, uint16_t *ids,
+                                  dc_material_slot_t **order) {
+  memset(slots, 0, capacity * sizeof(*slots));
+  size_t count = 0;
+  for (size_t i = 0; i < n; i++) {
+    uint32_t key[MATERIAL_COLUMNS];
+    for (int c = 0; c < MATERIAL_COLUMNS; c++) {
+      float value = columns[c][i];
+      if (levels == 0) {
+        memcpy(&key[c], &value, sizeof(value));
+      } else if (max[c] > min[c]) {
+        key[c] = (uint32_t)lround((double)(value - min[c]) /
+                                  (max[c] - min[c]) * (levels - 1));
+      } else {
+        key[c] = 0;
+      }
+    }
+
+    size_t slot = dc_material_hash(key) & (capacity - 1);
+    while (slots[slot].used &&
+           memcmp(slots[slot].key, key, sizeof(key)) != 0)
+      slot = (slot + 1) & (capacity - 1);
+    dc_material_slot_t *material = &slots[slot];
+    if (!material->used) {
+      if (count == max_materials)
+        return max_materials + 1;
+      material->used = 1;
+      memcpy(material->key, key, sizeof(key));
+      for (int c = 0; c < MATERIAL_COLUMNS; c++)
+        material->first[c] = columns[c][i];
+      material->id = (uint16_t)count;
+      order[count++] = material;
+    }
+    for (int c = 0; c < MATERIAL_COLUMNS; c++)
+      material->sum[c] += columns[c][i];
+    material->cells++;
+    ids[i] = material->id;
+  }
+  return count;
+}
+
+void dc_materials_build(dc_process_t *process, size_t max_materials) {
+  size_t n = dc_compute_count_from_sizes(process->sizes);
+  float **model[MATERIAL_COLUMNS];
+  dc_precomp_columns(&process->precomp_vars, model);
+  float *columns[MATERIAL_COLUMNS];
+  float min[MATERIAL_COLUMNS], max[MATERIAL_COLUMNS];
+  for (int c = 0; c < MATERIAL_COLUMNS; c++) {
+    columns[c] = *model[c];
+    min[c] = max[c] = columns[c][0];
+    for (size_t i = 1; i < n; i++) {
+      if (columns[c][i] < min[c])
+        min[c] = columns[c][i];
+      if (columns[c][i] > max[c])
+        max[c] = columns[c][i];
+    }
+  }
+
+  // Open addressing at most half full
+  size_t capacity = 1;
+  while (capacity < 2 * max_materials)
+    capacity *= 2;
+  dc_material_slot_t *slots = malloc(capacity * sizeof(*slots));
+  dc_material_slot_t **order = malloc(max_materials * sizeof(*order));
+  process->material_ids = malloc(n * sizeof(uint16_t));
+  if (slots == NULL || order == NULL || process->material_ids == NULL) {
+    dc_log_error(process->rank,
+                 "OOM: could not allocate memory in dc_materials_build");
+    MPI_Finalize();
+    exit(1);
+  }
+
+  // Exact tuples first, then ever coarser grids; a single level always fits
+  unsigned int levels = 0;
+  size_t count = dc_materials_assign(columns, n, levels, min, max, slots,
+                                     capacity, max_materials,
+                                     process->material_ids, order);
+  if (count > max_materials)
+    levels = 2 * DC_MAX_MATERIALS;
+  while (count > max_materials) {
+    levels /= 2;
+    count = dc_materials_assign(columns, n, levels, min, max, slots, capacity,
+                                max_materials, process->material_ids, order);
+  }
+
+  float *block = malloc(MATERIAL_COLUMNS * count * sizeof(float));
+  if (block == NULL) {
+    dc_log_error(process->rank,
+                 "OOM: could not allocate the material table");
+    MPI_Finalize();
+    exit(1);
+  }
+  float **table[MATERIAL_COLUMNS];
+  dc_precomp_columns(&process->materials, table);
+  for (int c = 0; c < MATERIAL_COLUMNS; c++) {
+    *table[c] = block + c * count;
+    for (size_t m = 0; m < count; m++) {
+      (*table[c])[m] = levels == 0
+                           ? order[m]->first[c]
+                           : (float)(order[m]->sum[c] / order[m]->cells);
+    }
+  }
+  process->material_count = count;
+  free(slots);
+  free(order);
+
+  // Largest error relative to each coefficient's magnitude on this rank
+  double worst = 0, squares = 0;
+  int worst_column = 0;
+  for (int c = 0; c < MATERIAL_COLUMNS; c++) {
+    double scale = fmax(fabs(min[c]), fabs(max[c]));
+    if (scale == 0)
+      continue;
+    for (size_t i = 0; i < n; i++) {
+      double error =
+          fabs((*table[c])[process->material_ids[i]] - columns[c][i]) / scale;
+      squares += error * error;
+      if (error > worst) {
+        worst = error;
+        worst_column = c;
+      }
+    }
+  }
+  dc_log_info(process->rank,
+              "Material table: %zu materials (%s), model memory %zu -> %zu "
+              "bytes, quantization error %g max (%s), %g RMS, relative to "
+              "each coefficient's magnitude",
+              count, levels == 0 ? "exact" : "quantized",
+              n * MODEL_BYTES_PER_CELL,
+              n * sizeof(uint16_t) + MATERIAL_COLUMNS * count * sizeof(float),
+              worst, column_names[worst_column],
+              sqrt(squares / (MATERIAL_COLUMNS * (double)n)));
+
+  dc_model_free(process);
+}
+
+void dc_materials_free(dc_process_t *process) {
+  free(process->materials.ch1dxx);
+  free(process->material_ids);
+  memset(&process->materials, 0, sizeof(process->materials));
+  process->material_ids = NULL;
+  process->material_count = 0;
+}
@@ -0,0 +1,169 @@
+#include <fcntl.h>
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "indexing.h"
+#include "log.h"
+#include "model_cache.h"
+#include "precomp.h"
+
+#define MODEL_ARRAYS 16
+// The anisotropy arrays come first, the precomputed ones after them
+#define MODEL_ANISOTROPY_ARRAYS 6
+// Arrays start on a cache line after the header
+#define MODEL_HEADER_SIZE 128
+
+typedef struct {
+  char magic[8];
+  unsigned int version;
+  unsigned int stencil;
+  dc_model_key_t key;
+} dc_model_header_t;
+
+static void dc_model_arrays(dc_process_t *process,
+                            float **arrays[MODEL_ARRAYS]) {
+  float **all[MODEL_ARRAYS] = {
+      &process->anisotropy_vars.theta,   &process->anisotropy_vars.phi,
+      &process->anisotropy_vars.vsv,     &process->anisotropy_vars.vpz,
+      &process->anisotropy_vars.epsilon, &process->anisotropy_vars.delta,
+      &process->precomp_vars.ch1dxx,     &process->precomp_vars.ch1dyy,
+      &process->precomp_vars.ch1dzz,     &process->precomp_vars.ch1dxy,
+      &process->precomp_vars.ch1dyz,     &process->precomp_vars.ch1dxz,
+      &process->precomp_vars.v2px,       &process->precomp_vars.v2pz,
+      &process->precomp_vars.v2sz,       &process->precomp_vars.v2pn,
+  };
+  memcpy(arrays, all, sizeof(all));
+}
+
+static void dc_model_header(const dc_model_key_t *key,
+                            dc_model_header_t *header) {
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, "DCMODEL", 8);
+  header->version = DC_MODEL_VERSION;
+  header->stencil = STENCIL;
+  header->key = *key;
+}
+
+static void dc_model_path(char *path, size_t length, const char *directory,
+                          const dc_model_key_t *key) {
+  snprintf(path, length,
+           "%s/model-v%d-%zux%zux%zu-a%zu%s-at%zu,%zu,%zu-%zux%zux%zu.bin",
+           directory, DC_MODEL_VERSION, key->problem_sizes[0],
+           key->problem_sizes[1], key->problem_sizes[2], key->absorption_size,
+           key->sponge_width ? "-sponge" : "",
+           key->start_coords[0], key->start_coords[1], key->start_coords[2],
+           key->sizes[0], key->sizes[1], key->sizes[2]);
+}
+
+int dc_model_cache_load(dc_process_t *process, const char *directory,
+                        const dc_model_key_t *key) {
+  char path[4096];
+  dc_model_path(path, sizeof(path), directory, key);
+  size_t count = dc_compute_count_from_sizes(key->sizes);
+  size_t size = MODEL_HEADER_SIZE + MODEL_ARRAYS * count * sizeof(float);
+
+  int file = open(path, O_RDONLY);
+  if (file < 0)
+    return 0;
+  struct stat status;
+  if (fstat(file, &status) != 0 || (size_t)status.st_size != size) {
+    close(file);
+    return 0;
+  }
+  void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+  if (mapping == MAP_FAILED)
+    return 0;
+
+  dc_model_header_t expected;
+  dc_model_header(key, &expected);
+  if (memcmp(mapping, &expected, sizeof(expected)) != 0) {
+    munmap(mapping, size);
+    return 0;
+  }
+
+  float **arrays[MODEL_ARRAYS];
+  dc_model_arrays(process, arrays);
+  float *data = (float *)((char *)mapping + MODEL_HEADER_SIZE);
+  for (int a = 0; a < MODEL_ARRAYS; a++)
+    *arrays[a] = data + a * count;
+  process->model_mapping = mapping;
+  process->model_mapping_size = size;
+  dc_log_info(process->rank, "Mapped model from %s", path);
+  return 1;
+}
+
+void dc_model_cache_store(const dc_process_t *process, const char *directory,
+                          const dc_model_key_t *key) {
+  char path[4096], temporary[4200];
+  dc_model_path(path, sizeof(path), directory, key);
+  // Concurrent runs each write their own file and the last rename wins, so
+  // readers never see a partial file
+  snprintf(temporary, sizeof(temporary), "%s.%d.%d.tmp", path, (int)getpid(),
+           process->rank);
+
+  FILE *file = fopen(temporary, "wb");
+  if (file == NULL) {
+    dc_log_error(process->rank, "Could not write model cache file %s",
+                 temporary);
+    return;
+  }
+  char header[MODEL_HEADER_SIZE] = {0};
+  dc_model_header(key, (dc_model_header_t *)header);
+  size_t count = dc_compute_count_from_sizes(key->sizes);
+  float **arrays[MODEL_ARRAYS];
+  dc_model_arrays((dc_process_t *)process, arrays);
+  int written = fwrite(header, MODEL_HEADER_SIZE, 1, file) == 1;
+  for (int a = 0; a < MODEL_ARRAYS && written; a++)
+    written = fwrite(*arrays[a], sizeof(float), count, file) == count;
+  if (fclose(file) != 0 || !written || rename(temporary, path) != 0) {
+    dc_log_error(process->rank, "Could not write model cache file %s", path);
+    unlink(temporary);
+    return;
+  }
+  dc_log_info(process->rank, "Stored model in %s", path);
+}
+
+void dc_model_free(dc_process_t *process) {
+  if (process->model_mapping == NULL) {
+    dc_free_anisotropy_vars(&process->anisotropy_vars);
+    dc_free_precomp_vars(&process->precomp_vars);
+    return;
+  }
+  munmap(process->model_mapping, process->model_mapping_size);
+  process->model_mapping = NULL;
+  process->model_mapping_size = 0;
+  float **arrays[MODEL_ARRAYS];
+  dc_model_arrays(process, arrays);
+  for (int a = 0; a < MODEL_ARRAYS; a++)
+    *arrays[a] = NULL;
+}
+
+void dc_model_release_precomp(dc_process_t *process) {
+  if (process->model_mapping == NULL) {
+    dc_free_precomp_vars(&process->precomp_vars);
+    return;
+  }
+  // Only the pages holding nothing but precomputed arrays are dropped
+  size_t count = dc_compute_count_from_sizes(process->sizes);
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t start =
+      MODEL_HEADER_SIZE + MODEL_ANISOTROPY_ARRAYS * count * sizeof(float);
+  start = (start + page - 1) / page * page;
+  if (start < process->model_mapping_size)
+    madvise((char *)process->model_mapping + start,
+            process->model_mapping_size - start, MADV_DONTNEED);
+}
+
+void dc_model_restore_precomp(dc_process_t *process) {
+  if (process->model_mapping != NULL || process->precomp_vars.ch1dxx != NULL)
+    return;
+  process->precomp_vars =
+      dc_compute_precomp_vars(process->sizes[0], process->sizes[1],
+                              process->sizes[2], process->anisotropy_vars);
+}
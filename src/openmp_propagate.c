@@ -1,18 +1,333 @@
+#include "brick.h"
 #include "precomp.h"
 #include "propagate.h"
 #include "sample_compute.h"
+#include "sample_compute_pq.h"
 #include "setup.h"
 
-void dc_propagate(const size_t start_coords[DIMENSIONS],
-                  const size_t end_coords[DIMENSIONS],
-                  const size_t sizes[DIMENSIONS],
-                  const int process_coordinates[DIMENSIONS],
-                  const int topology[DIMENSIONS], dc_device_data *data,
-                  const float dx, const float dy, const float dz,
-                  const float dt) {
+typedef void (*dc_fixed_kernel_t)(const size_t start_coords[DIMENSIONS],
+                                  const size_t end_coords[DIMENSIONS],
+                                  dc_device_data *data, const float dx,
+                                  const float dy, const float dz,
+                                  const float dt);
+
+// Kernels of fixed_propagate.c, listed by the Makefile as X(sx, sy, sz)
+#ifdef DC_FIXED_KERNELS
+#define X(sx, sy, sz)                                                          \
+  void dc_propagate_fixed_##sx##_##sy##_##sz(                                  \
+      const size_t start_coords[DIMENSIONS],                                   \
+      const size_t end_coords[DIMENSIONS], dc_device_data *data,               \
+      const float dx, const float dy, const float dz, const float dt);
+DC_FIXED_KERNELS
+#undef X
+
+static const struct {
+  size_t sizes[DIMENSIONS];
+  dc_fixed_kernel_t kernel;
+} fixed_kernels[] = {
+#define X(sx, sy, sz) {{sx, sy, sz}, dc_propagate_fixed_##sx##_##sy##_##sz},
+    DC_FIXED_KERNELS
+#undef X
+};
+#endif
+
+static dc_fixed_kernel_t dc_fixed_kernel(const size_t sizes[DIMENSIONS]) {
+#ifdef DC_FIXED_KERNELS
+  for (size_t k = 0; k < sizeof(fixed_kernels) / sizeof(*fixed_kernels); k++) {
+    if (fixed_kernels[k].sizes[0] == sizes[0] &&
+        fixed_kernels[k].sizes[1] == sizes[1] &&
+        fixed_kernels[k].sizes[2] == sizes[2])
+      return fixed_kernels[k].kernel;
+  }
+#endif
+  return NULL;
+}
+
+int dc_propagate_specialized(const size_t sizes[DIMENSIONS]) {
+  return dc_fixed_kernel(sizes) != NULL;
+}
+
+// Bricked layout: each brick touching the region is gathered with its apron
+// into a DC_BRICK_TILE^3 tile of pc and qc, so the stencil reads stay inside
+// 32 KiB of contiguous memory, and its cells are updated in place
+static void dc_propagate_bricked(const size_t start_coords[DIMENSIONS],
+                                 const size_t end_coords[DIMENSIONS],
+                                 dc_device_data *data, const float dx,
+                                 const float dy, const float dz,
+                                 const float dt) {
+  const size_t *bricks = data->bricks;
+  const size_t first_x = start_coords[0] / DC_BRICK;
+  const size_t first_y = start_coords[1] / DC_BRICK;
+  const size_t first_z = start_coords[2] / DC_BRICK;
+  const size_t last_x = (end_coords[0] - 1) / DC_BRICK;
+  const size_t last_y = (end_coords[1] - 1) / DC_BRICK;
+  const size_t last_z = (end_coords[2] - 1) / DC_BRICK;
+  const dc_precomp_vars *vars = &data->precomp_vars;
+  const dc_physics_t physics = data->physics;
+  const uint16_t *ids = data->material_ids;
+
+#pragma omp parallel
+  {
+    float tile_p[DC_BRICK_TILE_CELLS], tile_q[DC_BRICK_TILE_CELLS];
+#pragma omp for collapse(3)
+    for (size_t bz = first_z; bz <= last_z; bz++) {
+      for (size_t by = first_y; by <= last_y; by++) {
+        for (size_t bx = first_x; bx <= last_x; bx++) {
+          const size_t origin[DIMENSIONS] = {bx * DC_BRICK, by * DC_BRICK,
+                                             bz * DC_BRICK};
+          size_t lo[DIMENSIONS], hi[DIMENSIONS];
+          size_t apron_lo[DIMENSIONS], apron_hi[DIMENSIONS];
+          for (int i = 0; i < DIMENSIONS; i++) {
+            lo[i] = origin[i] > start_coords[i] ? origin[i] : start_coords[i];
+            hi[i] = origin[i] + DC_BRICK < end_coords[i]
+                        ? origin[i] + DC_BRICK
+                        : end_coords[i];
+            apron_lo[i] = lo[i] - STENCIL;
+            apron_hi[i] = hi[i] + STENCIL;
+          }
+
+          // Tile cell (x, y, z) holds cell origin + (x, y, z) - STENCIL, so
+          // the apron's first cell lands at lo - origin
+          const size_t gathered =
+              ((lo[2] - origin[2]) * DC_BRICK_TILE + lo[1] - origin[1]) *
+                  DC_BRICK_TILE +
+              lo[0] - origin[0];
+          dc_brick_pack(data->pc, bricks, apron_lo, apron_hi,
+                        tile_p + gathered, DC_BRICK_TILE,
+                        DC_BRICK_TILE * DC_BRICK_TILE);
+          dc_brick_pack(data->qc, bricks, apron_lo, apron_hi,
+                        tile_q + gathered, DC_BRICK_TILE,
+                        DC_BRICK_TILE * DC_BRICK_TILE);
+
+          const size_t row = hi[0] - lo[0];
+          const size_t shared =
+              data->tile_coefficients != NULL
+                  ? data->tile_coefficients[(bz * bricks[1] + by) * bricks[0] +
+                                            bx]
+                  : DC_TILE_VARYING;
+          for (size_t z = lo[2]; z < hi[2]; z++) {
+            for (size_t y = lo[1]; y < hi[1]; y++) {
+              const int c = ((z - origin[2] + STENCIL) * DC_BRICK_TILE + y -
+                             origin[1] + STENCIL) *
+                                DC_BRICK_TILE +
+                            lo[0] - origin[0] + STENCIL;
+              const size_t i = dc_brick_index(lo[0], y, z, bricks);
+              if (shared != DC_TILE_VARYING) {
+                const dc_coefficients_t k = dc_precomp_at(vars, shared);
+                for (size_t x = 0; x < row; x++) {
+                  sample_compute_uniform(tile_p, tile_q, c + (int)x, 1,
+                                         DC_BRICK_TILE,
+                                         DC_BRICK_TILE * DC_BRICK_TILE, dx, dy,
+                                         dz, dt, data->pp, data->qp, k, i + x,
+                                         physics);
+                }
+                continue;
+              }
+              for (size_t x = 0; x < row; x++) {
+                sample_compute_cell(
+                    tile_p, tile_q, c + (int)x, 1, DC_BRICK_TILE,
+                    DC_BRICK_TILE * DC_BRICK_TILE, dx, dy, dz, dt, data->pp,
+                    data->qp, vars->ch1dxx, vars->ch1dyy, vars->ch1dzz,
+                    vars->ch1dxy, vars->ch1dyz, vars->ch1dxz, vars->v2px,
+                    vars->v2pz, vars->v2sz, vars->v2pn, i + x,
+                    ids != NULL ? ids[i + x] : i + x, physics);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+static void dc_propagate_interleaved(const size_t start_coords[DIMENSIONS],
+                                     const size_t end_coords[DIMENSIONS],
+                                     const size_t sizes[DIMENSIONS],
+                                     dc_device_data *data, const float dx,
+                                     const float dy, const float dz,
+                                     const float dt) {
+  const int strideY = sizes[0];
+  const int strideZ = sizes[0] * sizes[1];
+  const dc_precomp_vars *vars = &data->precomp_vars;
+  const dc_physics_t physics = data->physics;
+  const uint16_t *ids = data->material_ids;
+
+  // Rows rather than planes are shared out, so thin regions such as the
+  // bands of temporal.h still occupy every thread
+#pragma omp parallel for collapse(2)
+  for (size_t z = start_coords[2]; z < end_coords[2]; z++) {
+    for (size_t y = start_coords[1]; y < end_coords[1]; y++) {
+      // 64-bit offset to the plane, 32-bit ones from there (see
+      // dc_local_offsets_fit); a material table is not offset
+      const size_t plane = z * sizes[0] * sizes[1];
+      const size_t coefficients = ids != NULL ? 0 : plane;
+      for (size_t x = start_coords[0]; x < end_coords[0]; x++) {
+        const int i = x + y * strideY;
+        sample_compute_pq(
+            data->pc + 2 * plane, i, 1, strideY, strideZ, dx, dy, dz, dt,
+            data->pp + 2 * plane, vars->ch1dxx + coefficients,
+            vars->ch1dyy + coefficients, vars->ch1dzz + coefficients,
+            vars->ch1dxy + coefficients, vars->ch1dyz + coefficients,
+            vars->ch1dxz + coefficients, vars->v2px + coefficients,
+            vars->v2pz + coefficients, vars->v2sz + coefficients,
+            vars->v2pn + coefficients,
+            ids != NULL ? ids[plane + i] : (size_t)i, physics);
+      }
+    }
+  }
+}
+
+// Flat and interleaved layouts with uniform tiles: the region is walked tile
+// by tile so that each tile takes either the uniform kernel or the per-cell one
+static void dc_propagate_tiles(const size_t start_coords[DIMENSIONS],
+                               const size_t end_coords[DIMENSIONS],
+                               const size_t sizes[DIMENSIONS],
+                               dc_device_data *data, const float dx,
+                               const float dy, const float dz, const float dt) {
+  const size_t *tiles = data->bricks;
+  const int strideY = sizes[0];
+  const int strideZ = sizes[0] * sizes[1];
+  const int interleaved = data->layout == DC_LAYOUT_INTERLEAVED;
+  const dc_precomp_vars *vars = &data->precomp_vars;
+  const dc_physics_t physics = data->physics;
+  const uint16_t *ids = data->material_ids;
+
+#pragma omp parallel for collapse(3)
+  for (size_t bz = start_coords[2] / DC_BRICK;
+       bz <= (end_coords[2] - 1) / DC_BRICK; bz++) {
+    for (size_t by = start_coords[1] / DC_BRICK;
+         by <= (end_coords[1] - 1) / DC_BRICK; by++) {
+      for (size_t bx = start_coords[0] / DC_BRICK;
+           bx <= (end_coords[0] - 1) / DC_BRICK; bx++) {
+        const size_t origin[DIMENSIONS] = {bx * DC_BRICK, by * DC_BRICK,
+                                           bz * DC_BRICK};
+        size_t lo[DIMENSIONS], hi[DIMENSIONS];
+        for (int i = 0; i < DIMENSIONS; i++) {
+          lo[i] = origin[i] > start_coords[i] ? origin[i] : start_coords[i];
+          hi[i] = origin[i] + DC_BRICK < end_coords[i] ? origin[i] + DC_BRICK
+                                                       : end_coords[i];
+        }
+        const size_t shared =
+            data->tile_coefficients[(bz * tiles[1] + by) * tiles[0] + bx];
+
+        for (size_t z = lo[2]; z < hi[2]; z++) {
+          // Offsets as in dc_propagate_interleaved
+          const size_t plane = z * sizes[0] * sizes[1];
+          const size_t coefficients = ids != NULL ? 0 : plane;
+          const float *pc = data->pc + (interleaved ? 2 : 1) * plane;
+          float *pp = data->pp + (interleaved ? 2 : 1) * plane;
+          for (size_t y = lo[1]; y < hi[1]; y++) {
+            if (shared != DC_TILE_VARYING) {
+              const dc_coefficients_t k = dc_precomp_at(vars, shared);
+              for (size_t x = lo[0]; x < hi[0]; x++) {
+                const int i = x + y * strideY;
+                if (interleaved)
+                  sample_compute_pq_uniform(pc, i, 1, strideY, strideZ, dx, dy,
+                                            dz, dt, pp, k, physics);
+                else
+                  sample_compute_uniform(pc, data->qc + plane, i, 1, strideY,
+                                         strideZ, dx, dy, dz, dt, pp,
+                                         data->qp + plane, k, i, physics);
+              }
+              continue;
+            }
+            for (size_t x = lo[0]; x < hi[0]; x++) {
+              const int i = x + y * strideY;
+              const size_t m = ids != NULL ? ids[plane + i] : (size_t)i;
+              if (interleaved)
+                sample_compute_pq(
+                    pc, i, 1, strideY, strideZ, dx, dy, dz, dt, pp,
+                    vars->ch1dxx + coefficients, vars->ch1dyy + coefficients,
+                    vars->ch1dzz + coefficients, vars->ch1dxy + coefficients,
+                    vars->ch1dyz + coefficients, vars->ch1dxz + coefficients,
+                    vars->v2px + coefficients, vars->v2pz + coefficients,
+                    vars->v2sz + coefficients, vars->v2pn + coefficients, m,
+                    physics);
+              else
+                sample_compute_cell(
+                    pc, data->qc + plane, i, 1, strideY, strideZ, dx, dy, dz,
+                    dt, pp, data->qp + plane, vars->ch1dxx + coefficients,
+                    vars->ch1dyy + coefficients, vars->ch1dzz + coefficients,
+                    vars->ch1dxy + coefficients, vars->ch1dyz + coefficients,
+                    vars->ch1dxz + coefficients, vars->v2px + coefficients,
+                    vars->v2pz + coefficients, vars->v2sz + coefficients,
+                    vars->v2pn + coefficients, i, m, physics);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+// Flat layout with a material table: the coefficients of a cell are looked
+// up by its material ID
+static void dc_propagate_materials(const size_t start_coords[DIMENSIONS],
+                                   const size_t end_coords[DIMENSIONS],
+                                   const size_t sizes[DIMENSIONS],
+                                   dc_device_data *data, const float dx,
+                                   const float dy, const float dz,
+                                   const float dt) {
+  const int strideY = sizes[0];
+  const int strideZ = sizes[0] * sizes[1];
+  const dc_precomp_vars *vars = &data->precomp_vars;
+  const dc_physics_t physics = data->physics;
+
+#pragma omp parallel for collapse(2)
+  for (size_t z = start_coords[2]; z < end_coords[2]; z++) {
+    for (size_t y = start_coords[1]; y < end_coords[1]; y++) {
+      const size_t plane = z * sizes[0] * sizes[1];
+      const uint16_t *ids = data->material_ids + plane;
+      for (size_t x = start_coords[0]; x < end_coords[0]; x++) {
+        const int i = x + y * strideY;
+        sample_compute_cell(data->pc + plane, data->qc + plane, i, 1, strideY,
+                            strideZ, dx, dy, dz, dt, data->pp + plane,
+                            data->qp + plane, vars->ch1dxx, vars->ch1dyy,
+                            vars->ch1dzz, vars->ch1dxy, vars->ch1dyz,
+                            vars->ch1dxz, vars->v2px, vars->v2pz, vars->v2sz,
+                            vars->v2pn, i, ids[i], physics);
+      }
+    }
+  }
+}
+
+static void dc_propagate_region(const size_t start_coords[DIMENSIONS],
+                                const size_t end_coords[DIMENSIONS],
+                                const size_t sizes[DIMENSIONS],
+                                const int process_coordinates[DIMENSIONS],
+                                const int topology[DIMENSIONS],
+                                dc_device_data *data, const float dx,
+                                const float dy, const float dz,
+                                const float dt) {
+  const dc_physics_t physics = data->physics;
+  if (data->layout == DC_LAYOUT_BRICKED) {
+    dc_propagate_bricked(start_coords, end_coords, data, dx, dy, dz, dt);
+    return;
+  }
+  if (data->tile_coefficients != NULL) {
+    dc_propagate_tiles(start_coords, end_coords, sizes, data, dx, dy, dz, dt);
+    return;
+  }
+  dc_fixed_kernel_t fixed = data->layout == DC_LAYOUT_FLAT
+                                ? dc_fixed_kernel(sizes)
+                                : NULL;
+  if (fixed != NULL) {
+    fixed(start_coords, end_coords, data, dx, dy, dz, dt);
+    return;
+  }
+  if (data->layout == DC_LAYOUT_INTERLEAVED) {
+    dc_propagate_interleaved(start_coords, end_coords, sizes, data, dx, dy, dz,
+                             dt);
+    return;
+  }
+  if (data->material_ids != NULL) {
+    dc_propagate_materials(start_coords, end_coords, sizes, data, dx, dy, dz,
+                           dt);
+    return;
+  }
 #pragma omp parallel
   {
-#pragma omp for
+#pragma omp for collapse(2)
     for (size_t z = start_coords[2]; z < end_coords[2]; z++) {
       for (size_t y = start_coords[1]; y < end_coords[1]; y++) {
         for (size_t x = start_coords[0]; x < end_coords[0]; x++) {
@@ -24,9 +339,66 @@ void dc_propagate(const size_t start_coords[DIMENSIONS],
                          data->precomp_vars.ch1dzz, data->precomp_vars.ch1dxy,
                          data->precomp_vars.ch1dyz, data->precomp_vars.ch1dxz,
                          data->precomp_vars.v2px, data->precomp_vars.v2pz,
-                         data->precomp_vars.v2sz, data->precomp_vars.v2pn);
+                         data->precomp_vars.v2sz, data->precomp_vars.v2pn,
+                         physics);
         }
       }
     }
   }
 }
+
+static inline void dc_damp_cell(dc_device_data *data, size_t x, size_t y,
+                                size_t z, float factor) {
+  const size_t *sizes = data->sizes;
+  size_t i;
+  if (data->layout == DC_LAYOUT_BRICKED)
+    i = dc_brick_index(x, y, z, data->bricks);
+  else
+    i = (data->layout == DC_LAYOUT_INTERLEAVED ? 2 : 1) *
+        ((z * sizes[1] + y) * sizes[0] + x);
+  data->pp[i] = data->pc[i] + factor * (data->pp[i] - data->pc[i]);
+  data->qp[i] = data->qc[i] + factor * (data->qp[i] - data->qc[i]);
+}
+
+// Sponge boundary: scale the change of p and q over the step of the region's
+// cells inside the sponge, which damps waves but not the slow part of the
+// field a thin layer would reflect. Rows outside it in y and z only visit
+// their two x ends.
+static void dc_damp(const size_t start_coords[DIMENSIONS],
+                    const size_t end_coords[DIMENSIONS],
+                    dc_device_data *data) {
+  const size_t *undamped = data->undamped[0];
+
+#pragma omp parallel for collapse(2)
+  for (size_t z = start_coords[2]; z < end_coords[2]; z++) {
+    for (size_t y = start_coords[1]; y < end_coords[1]; y++) {
+      const float zy = data->damping[2][z] * data->damping[1][y];
+      size_t skip_lo = end_coords[0], skip_hi = end_coords[0];
+      if (zy == 1.0f) {
+        skip_lo = undamped[0] > start_coords[0] ? undamped[0] : start_coords[0];
+        skip_hi = undamped[1] > skip_lo ? undamped[1] : skip_lo;
+      }
+      for (size_t x = start_coords[0]; x < end_coords[0]; x++) {
+        if (x == skip_lo)
+          x = skip_hi;
+        if (x >= end_coords[0])
+          break;
+        dc_damp_cell(data, x, y, z, zy * data->damping[0][x]);
+      }
+    }
+  }
+}
+
+void dc_propagate(const size_t start_coords[DIMENSIONS],
+                  const size_t end_coords[DIMENSIONS],
+                  const size_t sizes[DIMENSIONS],
+                  const int process_coordinates[DIMENSIONS],
+                  const int topology[DIMENSIONS], dc_device_data *data,
+                  const float dx, const float dy, const float dz,
+                  const float dt) {
+  dc_propagate_region(start_coords, end_coords, sizes, process_coordinates,
+                      topology, data, dx, dy, dz, dt);
+  // Before the halo faces are sent, so every copy of a cell agrees
+  if (data->damping[0] != NULL)
+    dc_damp(start_coords, end_coords, data);
+}
@@ -0,0 +1,318 @@
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coordinator.h"
+#include "log.h"
+#include "partition.h"
+
+// Split `total` cells into `parts` slabs proportional to `shares`, giving
+// each slab its floor and then the leftover cells one at a time to the
+// slabs with the largest fractional parts
+static void dc_split_cells(size_t total, int parts, const double *shares,
+                           size_t *extents) {
+  double share_sum = 0;
+  for (int i = 0; i < parts; i++)
+    share_sum += shares[i];
+
+  double *fractions = malloc(parts * sizeof(double));
+  if (fractions == NULL) {
+    dc_log_error(COORDINATOR, "OOM: could not allocate memory for fractions "
+                              "in dc_split_cells");
+    MPI_Finalize();
+    exit(1);
+  }
+
+  size_t assigned = 0;
+  for (int i = 0; i < parts; i++) {
+    double ideal = total * shares[i] / share_sum;
+    extents[i] = (size_t)ideal;
+    fractions[i] = ideal - extents[i];
+    assigned += extents[i];
+  }
+  for (; assigned < total; assigned++) {
+    int largest = 0;
+    for (int i = 1; i < parts; i++) {
+      if (fractions[i] > fractions[largest])
+        largest = i;
+    }
+    extents[largest]++;
+    fractions[largest] -= 1.0;
+  }
+
+  // Slabs thinner than the stencil would send overlapping halo regions, so
+  // borrow cells from the widest slabs
+  for (int i = 0; i < parts; i++) {
+    while (extents[i] < STENCIL) {
+      int widest = 0;
+      for (int j = 1; j < parts; j++) {
+        if (extents[j] > extents[widest])
+          widest = j;
+      }
+      if (extents[widest] <= STENCIL)
+        break;
+      extents[widest]--;
+      extents[i]++;
+    }
+  }
+  free(fractions);
+}
+
+dc_partition_t dc_partition_create(const int topology[DIMENSIONS],
+                                   const size_t global_sizes[DIMENSIONS],
+                                   const double *weights) {
+  dc_partition_t partition = {0};
+  memcpy(partition.topology, topology, sizeof(int) * DIMENSIONS);
+  size_t num_ranks = (size_t)topology[0] * topology[1] * topology[2];
+
+  for (int axis = 0; axis < DIMENSIONS; axis++) {
+    partition.extents[axis] = malloc(topology[axis] * sizeof(size_t));
+    partition.starts[axis] = malloc(topology[axis] * sizeof(size_t));
+    double *shares = calloc(topology[axis], sizeof(double));
+    if (partition.extents[axis] == NULL || partition.starts[axis] == NULL ||
+        shares == NULL) {
+      dc_log_error(COORDINATOR, "OOM: could not allocate memory for the "
+                                "partition in dc_partition_create");
+      MPI_Finalize();
+      exit(1);
+    }
+
+    for (size_t rank = 0; rank < num_ranks; rank++) {
+      int coordinates[DIMENSIONS] = {
+          rank / (topology[1] * topology[2]),
+          (rank / topology[2]) % topology[1], rank % topology[2]};
+      shares[coordinates[axis]] += weights == NULL ? 1.0 : weights[rank];
+    }
+    dc_split_cells(global_sizes[axis] - 2 * STENCIL, topology[axis], shares,
+                   partition.extents[axis]);
+    free(shares);
+
+    size_t start = 0;
+    for (int i = 0; i < topology[axis]; i++) {
+      partition.starts[axis][i] = start;
+      start += partition.extents[axis][i];
+    }
+  }
+  return partition;
+}
+
+static void dc_bisect(size_t (*boxes)[2 * DIMENSIONS], const double *weights,
+                      int first, int count, const size_t lo[DIMENSIONS],
+                      const size_t hi[DIMENSIONS]) {
+  if (count == 1) {
+    for (int i = 0; i < DIMENSIONS; i++) {
+      boxes[first][i] = lo[i];
+      boxes[first][DIMENSIONS + i] = hi[i] - lo[i];
+    }
+    return;
+  }
+
+  int axis = 0;
+  for (int i = 1; i < DIMENSIONS; i++) {
+    if (hi[i] - lo[i] > hi[axis] - lo[axis])
+      axis = i;
+  }
+  int lower = count / 2;
+  double lower_weight = 0, total_weight = 0;
+  for (int rank = first; rank < first + count; rank++) {
+    double weight = weights == NULL ? 1.0 : weights[rank];
+    total_weight += weight;
+    if (rank < first + lower)
+      lower_weight += weight;
+  }
+
+  // Halves thinner than the stencil would send overlapping halo regions, so
+  // a box needs two stencils along its longest axis to be cut
+  size_t extent = hi[axis] - lo[axis];
+  if (extent < 2 * STENCIL) {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (rank == COORDINATOR)
+      dc_log_error(rank,
+                   "Cannot bisect a %zu x %zu x %zu box between %d ranks: "
+                   "every rank needs at least %d cells along the cut axis",
+                   hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2], count,
+                   STENCIL);
+    MPI_Finalize();
+    exit(1);
+  }
+  size_t cut = (size_t)(extent * lower_weight / total_weight + 0.5);
+  if (cut < STENCIL)
+    cut = STENCIL;
+  if (cut > extent - STENCIL)
+    cut = extent - STENCIL;
+
+  size_t lower_hi[DIMENSIONS], upper_lo[DIMENSIONS];
+  memcpy(lower_hi, hi, sizeof(lower_hi));
+  memcpy(upper_lo, lo, sizeof(upper_lo));
+  lower_hi[axis] = lo[axis] + cut;
+  upper_lo[axis] = lo[axis] + cut;
+  dc_bisect(boxes, weights, first, lower, lo, lower_hi);
+  dc_bisect(boxes, weights, first + lower, count - lower, upper_lo, hi);
+}
+
+dc_partition_t dc_partition_bisect(int num_ranks,
+                                   const size_t global_sizes[DIMENSIONS],
+                                   const double *weights) {
+  dc_partition_t partition = {{num_ranks, 1, 1}};
+  partition.boxes = malloc(num_ranks * sizeof(*partition.boxes));
+  if (partition.boxes == NULL) {
+    dc_log_error(COORDINATOR, "OOM: could not allocate memory for the boxes "
+                              "in dc_partition_bisect");
+    MPI_Finalize();
+    exit(1);
+  }
+  size_t lo[DIMENSIONS] = {0, 0, 0};
+  size_t hi[DIMENSIONS];
+  for (int i = 0; i < DIMENSIONS; i++)
+    hi[i] = global_sizes[i] - 2 * STENCIL;
+  dc_bisect(partition.boxes, weights, 0, num_ranks, lo, hi);
+  return partition;
+}
+
+void dc_partition_free(dc_partition_t *partition) {
+  free(partition->boxes);
+  partition->boxes = NULL;
+  for (int axis = 0; axis < DIMENSIONS; axis++) {
+    free(partition->extents[axis]);
+    free(partition->starts[axis]);
+    partition->extents[axis] = NULL;
+    partition->starts[axis] = NULL;
+  }
+}
+
+void dc_partition_local(const dc_partition_t *partition,
+                        const int coordinates[DIMENSIONS],
+                        size_t local_sizes[DIMENSIONS],
+                        size_t start_coords[DIMENSIONS]) {
+  if (partition->boxes != NULL) {
+    const int *topology = partition->topology;
+    size_t rank = ((size_t)coordinates[0] * topology[1] + coordinates[1]) *
+                      topology[2] +
+                  coordinates[2];
+    for (int axis = 0; axis < DIMENSIONS; axis++) {
+      local_sizes[axis] =
+          partition->boxes[rank][DIMENSIONS + axis] + 2 * STENCIL;
+      start_coords[axis] = partition->boxes[rank][axis];
+    }
+    return;
+  }
+  for (int axis = 0; axis < DIMENSIONS; axis++) {
+    local_sizes[axis] =
+        partition->extents[axis][coordinates[axis]] + 2 * STENCIL;
+    // The slab's first computed cell is local cell STENCIL and sits STENCIL
+    // cells into the padded grid, so both offsets cancel
+    start_coords[axis] = partition->starts[axis][coordinates[axis]];
+  }
+}
+
+static double dc_partition_imbalance(const dc_partition_t *partition,
+                                     const double *weights) {
+  const int *topology = partition->topology;
+  size_t num_ranks = (size_t)topology[0] * topology[1] * topology[2];
+  double slowest = 0, fastest = 0;
+  for (size_t rank = 0; rank < num_ranks; rank++) {
+    int coordinates[DIMENSIONS] = {rank / (topology[1] * topology[2]),
+                                   (rank / topology[2]) % topology[1],
+                                   rank % topology[2]};
+    size_t sizes[DIMENSIONS], starts[DIMENSIONS];
+    dc_partition_local(partition, coordinates, sizes, starts);
+    double cells = 1;
+    for (int axis = 0; axis < DIMENSIONS; axis++)
+      cells *= sizes[axis] - 2 * STENCIL;
+    double time = cells / (weights == NULL ? 1.0 : weights[rank]);
+    if (rank == 0 || time > slowest)
+      slowest = time;
+    if (rank == 0 || time < fastest)
+      fastest = time;
+  }
+  return fastest > 0 ? slowest / fastest : 0;
+}
+
+void dc_partition_log(int rank, const dc_partition_t *partition,
+                      const double *weights) {
+  const char axis_names[DIMENSIONS] = {'x', 'y', 'z'};
+  for (int r = 0; partition->boxes != NULL && r < partition->topology[0];
+       r++) {
+    const size_t *box = partition->boxes[r];
+    dc_log_info(rank, "Box of rank %d: %zu x %zu x %zu cells from %zu %zu %zu",
+                r, box[3], box[4], box[5], box[0], box[1], box[2]);
+  }
+  for (int axis = 0; partition->boxes == NULL && axis < DIMENSIONS; axis++) {
+    size_t length = 24 * partition->topology[axis] + 1;
+    char *widths = malloc(length);
+    if (widths == NULL) {
+      dc_log_error(rank, "OOM: could not allocate memory for widths in "
+                         "dc_partition_log");
+      MPI_Finalize();
+      exit(1);
+    }
+    size_t used = 0;
+    widths[0] = '\0';
+    for (int i = 0; i < partition->topology[axis]; i++) {
+      used += snprintf(widths + used, length - used, " %zu",
+                       partition->extents[axis][i]);
+    }
+    dc_log_info(rank, "Slab widths along %c:%s", axis_names[axis], widths);
+    free(widths);
+  }
+  dc_log_info(rank, "Predicted slowest/fastest iteration time: %.3lf",
+              dc_partition_imbalance(partition, weights));
+}
+
+int dc_parse_host_weight(const char *list, const char *hostname,
+                         double *weight) {
+  *weight = 1.0;
+  char *copy = strdup(list);
+  char *saveptr = NULL;
+  int valid = 1;
+  for (char *entry = strtok_r(copy, ",", &saveptr); entry != NULL;
+       entry = strtok_r(NULL, ",", &saveptr)) {
+    char *separator = strchr(entry, '=');
+    if (separator == NULL) {
+      valid = 0;
+      break;
+    }
+    *separator = '\0';
+    char *end;
+    double value = strtod(separator + 1, &end);
+    if (*end != '\0' || value <= 0) {
+      valid = 0;
+      break;
+    }
+    if (strcmp(entry, hostname) == 0)
+      *weight = value;
+  }
+  free(copy);
+  return valid;
+}
+
+void dc_owned_region(const unsigned long box[2 * DIMENSIONS],
+                  const size_t global_sizes[DIMENSIONS], size_t lo[DIMENSIONS],
+                  size_t hi[DIMENSIONS]) {
+  for (int i = 0; i < DIMENSIONS; i++) {
+    lo[i] = box[i] + STENCIL;
+    hi[i] = box[i] + box[DIMENSIONS + i] - STENCIL;
+    if (lo[i] == STENCIL)
+      lo[i] = 0;
+    if (hi[i] == global_sizes[i] - STENCIL)
+      hi[i] = global_sizes[i];
+  }
+}
+
+size_t dc_box_overlap(const size_t a_lo[DIMENSIONS],
+                      const size_t a_hi[DIMENSIONS],
+                      const unsigned long b[2 * DIMENSIONS],
+                      size_t lo[DIMENSIONS], size_t hi[DIMENSIONS]) {
+  size_t cells = 1;
+  for (int i = 0; i < DIMENSIONS; i++) {
+    lo[i] = a_lo[i] > b[i] ? a_lo[i] : b[i];
+    hi[i] = a_hi[i] < b[i] + b[DIMENSIONS + i] ? a_hi[i]
+                                                : b[i] + b[DIMENSIONS + i];
+    if (lo[i] >= hi[i])
+      return 0;
+    cells *= hi[i] - lo[i];
+  }
+  return cells;
+}
@@ -0,0 +1,82 @@
+#include <string.h>
+
+#include "coordinator.h"
+#include "indexing.h"
+#include "log.h"
+#include "physics.h"
+
+static const char *physics_names[] = {
+    [DC_PHYSICS_AUTO] = "auto",
+    [DC_PHYSICS_ISOTROPIC] = "isotropic",
+    [DC_PHYSICS_VTI] = "vti",
+    [DC_PHYSICS_TTI] = "tti",
+};
+
+const char *dc_physics_name(dc_physics_t physics) {
+  return physics_names[physics];
+}
+
+int dc_physics_parse(const char *name, dc_physics_t *physics) {
+  for (size_t i = 0; i < sizeof(physics_names) / sizeof(*physics_names);
+       i++) {
+    if (strcmp(name, physics_names[i]) == 0) {
+      *physics = (dc_physics_t)i;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+dc_stencil_footprint_t dc_physics_footprint(dc_physics_t physics) {
+  return physics == DC_PHYSICS_ISOTROPIC || physics == DC_PHYSICS_VTI
+             ? DC_AXES_FOOTPRINT
+             : DC_TTI_FOOTPRINT;
+}
+
+dc_physics_t dc_physics_detect(const dc_process_t *process) {
+  const dc_precomp_vars *vars = &process->precomp_vars;
+  size_t n = dc_compute_count_from_sizes(process->sizes);
+  if (process->material_ids != NULL) {
+    vars = &process->materials;
+    n = process->material_count;
+  }
+
+  int isotropic = 1, untilted = 1;
+  for (size_t i = 0; i < n && (isotropic || untilted); i++) {
+    if (vars->v2px[i] != vars->v2pz[i] || vars->v2pn[i] != vars->v2pz[i])
+      isotropic = 0;
+    if (vars->ch1dzz[i] != 1.0f || vars->ch1dxx[i] != 0.0f ||
+        vars->ch1dyy[i] != 0.0f || vars->ch1dxy[i] != 0.0f ||
+        vars->ch1dyz[i] != 0.0f || vars->ch1dxz[i] != 0.0f)
+      untilted = 0;
+  }
+  if (isotropic)
+    return DC_PHYSICS_ISOTROPIC;
+  return untilted ? DC_PHYSICS_VTI : DC_PHYSICS_TTI;
+}
+
+void dc_physics_select(dc_process_t *process, dc_physics_t requested,
+                       MPI_Comm comm) {
+  int needed = dc_physics_detect(process);
+  MPI_Allreduce(MPI_IN_PLACE, &needed, 1, MPI_INT, MPI_MAX, comm);
+  process->physics =
+      requested != DC_PHYSICS_AUTO ? requested : (dc_physics_t)needed;
+  // A requested kernel set the footprint already; the one AUTO picks may
+  // read fewer halo regions than the TTI footprint it started with
+  process->footprint = dc_physics_footprint(process->physics);
+
+  if (process->rank != COORDINATOR)
+    return;
+  dc_log_info(process->rank, "Physics: %s kernel, the model needs %s%s",
+              dc_physics_name(process->physics),
+              dc_physics_name((dc_physics_t)needed),
+              process->footprint == DC_TTI_FOOTPRINT
+                  ? ""
+                  : ", exchanging face halos only");
+  if (process->physics < (dc_physics_t)needed)
+    dc_log_error(process->rank,
+                 "The %s kernel drops terms of the %s model, results are "
+                 "approximate",
+                 dc_physics_name(process->physics),
+                 dc_physics_name((dc_physics_t)needed));
+}
@@ -0,0 +1,23 @@
+#include <stdlib.h>
+
+#include "rank_file.h"
+
+int dc_rank_record_write(FILE *file, dc_rank_header_t *header,
+                         const float *fields, int level) {
+  const size_t count = 2 * dc_rank_cells(header);
+  if (header->codec == DC_CODEC_NONE) {
+    header->bytes = count * sizeof(float);
+    return fwrite(header, sizeof(*header), 1, file) == 1 &&
+           fwrite(fields, sizeof(float), count, file) == count;
+  }
+
+  unsigned char *stored = (unsigned char *)malloc(dc_codec_bound(count));
+  if (stored == NULL)
+    return 0;
+  header->bytes = dc_codec_encode((dc_codec_t)header->codec, level, fields,
+                                  count, stored);
+  int written = fwrite(header, sizeof(*header), 1, file) == 1 &&
+                fwrite(stored, 1, header->bytes, file) == header->bytes;
+  free(stored);
+  return written;
+}
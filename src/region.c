@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "coordinator.h"
+#include "indexing.h"
+#include "log.h"
+#include "region.h"
+
+void dc_region_sizes(const dc_region_t *region, size_t sizes[DIMENSIONS]) {
+  for (int i = 0; i < DIMENSIONS; i++)
+    sizes[i] = (region->hi[i] - region->lo[i] + region->stride[i] - 1) /
+               region->stride[i];
+}
+
+void dc_region_write(const dc_process_t *process, MPI_Comm comm,
+                     const dc_region_t *region, size_t padding,
+                     const char *output_file) {
+  // Selection indices [first, last) of the cells this rank owns
+  size_t sizes[DIMENSIONS], first[DIMENSIONS], last[DIMENSIONS];
+  dc_region_sizes(region, sizes);
+  size_t count = 1, local = 1;
+  for (int i = 0; i < DIMENSIONS; i++) {
+    const size_t lo = region->lo[i] + padding, stride = region->stride[i];
+    const size_t owned_lo = process->start_coords[i] + STENCIL;
+    const size_t owned_hi =
+        process->start_coords[i] + process->sizes[i] - STENCIL;
+    first[i] = owned_lo <= lo ? 0 : (owned_lo - lo + stride - 1) / stride;
+    last[i] = owned_hi <= lo ? 0 : (owned_hi - lo + stride - 1) / stride;
+    if (last[i] > sizes[i])
+      last[i] = sizes[i];
+    if (first[i] > last[i])
+      first[i] = last[i];
+    count *= sizes[i];
+    local *= last[i] - first[i];
+  }
+
+  float *buffer = (float *)malloc((2 * local + 1) * sizeof(float));
+  if (buffer == NULL) {
+    dc_log_error(process->rank,
+                 "OOM: could not allocate memory in dc_region_write");
+    MPI_Finalize();
+    exit(1);
+  }
+  float *p = buffer, *q = buffer + local;
+  size_t packed = 0;
+  for (size_t z = first[2]; z < last[2]; z++) {
+    for (size_t y = first[1]; y < last[1]; y++) {
+      size_t from = dc_get_index_for_coordinates(
+          region->lo[0] + padding + first[0] * region->stride[0] -
+              process->start_coords[0],
+          region->lo[1] + padding + y * region->stride[1] -
+              process->start_coords[1],
+          region->lo[2] + padding + z * region->stride[2] -
+              process->start_coords[2],
+          process->sizes[0], process->sizes[1], process->sizes[2]);
+      for (size_t x = first[0]; x < last[0]; x++) {
+        p[packed] = process->pc[from];
+        q[packed++] = process->qc[from];
+        from += region->stride[0];
+      }
+    }
+  }
+
+  MPI_File file;
+  if (MPI_File_open(comm, output_file, MPI_MODE_WRONLY | MPI_MODE_CREATE,
+                    MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+    dc_log_error(process->rank, "Failed to open output file: %s",
+                 output_file);
+    MPI_Abort(comm, 1);
+  }
+  MPI_File_set_size(file, 2 * count * sizeof(float));
+
+  // Both fields' share of this rank in one view: its sub-box of p, then of q
+  MPI_Datatype view = MPI_FLOAT, row = MPI_FLOAT;
+  int rows = 0;
+  if (local != 0) {
+    int array_sizes[DIMENSIONS], sub_sizes[DIMENSIONS], offsets[DIMENSIONS];
+    for (int i = 0; i < DIMENSIONS; i++) {
+      // MPI_ORDER_C wants the slowest axis first
+      array_sizes[DIMENSIONS - 1 - i] = sizes[i];
+      sub_sizes[DIMENSIONS - 1 - i] = last[i] - first[i];
+      offsets[DIMENSIONS - 1 - i] = first[i];
+    }
+    MPI_Datatype box;
+    MPI_Type_create_subarray(DIMENSIONS, array_sizes, sub_sizes, offsets,
+                             MPI_ORDER_C, MPI_FLOAT, &box);
+    MPI_Type_create_hvector(2, 1, count * sizeof(float), box, &view);
+    MPI_Type_commit(&view);
+    MPI_Type_free(&box);
+    // Rows keep the element count an int
+    MPI_Type_contiguous(last[0] - first[0], MPI_FLOAT, &row);
+    MPI_Type_commit(&row);
+    rows = 2 * (last[1] - first[1]) * (last[2] - first[2]);
+  }
+  MPI_File_set_view(file, 0, MPI_FLOAT, view, "native", MPI_INFO_NULL);
+  int written = MPI_File_write_all(file, buffer, rows, row,
+                                   MPI_STATUS_IGNORE) == MPI_SUCCESS;
+  if (MPI_File_close(&file) != MPI_SUCCESS || !written) {
+    dc_log_error(process->rank, "Failed to write output file: %s",
+                 output_file);
+    MPI_Abort(comm, 1);
+  }
+  if (local != 0) {
+    MPI_Type_free(&view);
+    MPI_Type_free(&row);
+  }
+  free(buffer);
+
+  if (process->rank == COORDINATOR)
+    dc_log_info(process->rank,
+                "Wrote %zu x %zu x %zu cells, %zu bytes, of the region",
+                sizes[0], sizes[1], sizes[2], 2 * count * sizeof(float));
+}
@@ -2,20 +2,28 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "log.h"
 #include "setup.h"
 
-void dc_mpi_world_init(MPI_Comm *communicator, const int topology[DIMENSIONS]) {
+void dc_mpi_world_init(MPI_Comm *communicator, MPI_Comm world,
+                       const int topology[DIMENSIONS], int key) {
   const int periods[DIMENSIONS] = {0, 0, 0};
   int reorder = 0;
-  MPI_Cart_create(MPI_COMM_WORLD, DIMENSIONS, topology, periods, reorder,
+  // Ranks are placed by `key` rather than by MPI, whose reordering is
+  // usually the identity
+  MPI_Comm ordered;
+  MPI_Comm_split(world, 0, key, &ordered);
+  MPI_Cart_create(ordered, DIMENSIONS, topology, periods, reorder,
                   communicator);
+  MPI_Comm_free(&ordered);
 }
 
 dc_process_t dc_process_init(MPI_Comm communicator, int rank,
                              size_t num_workers, int topology[DIMENSIONS],
                              size_t sx, size_t sy, size_t sz, float dx,
-                             float dy, float dz, float dt) {
-  dc_process_t process;
+                             float dy, float dz, float dt,
+                             dc_stencil_footprint_t footprint) {
+  dc_process_t process = {0};
   process.rank = rank;
   process.dx = dx;
   process.dy = dy;
@@ -23,15 +31,14 @@ dc_process_t dc_process_init(MPI_Comm communicator, int rank,
   process.dt = dt;
   process.source_index = -1;
   process.num_workers = num_workers;
+  process.footprint = footprint;
 
-  process.hostnames =
-
-      calloc(num_workers, sizeof(char) * MPI_MAX_PROCESSOR_NAME);
-  char hostname[MPI_MAX_PROCESSOR_NAME] = {0};
-  int length;
-  MPI_Get_processor_name(hostname, &length);
-  MPI_Allgather(hostname, MPI_MAX_PROCESSOR_NAME, MPI_CHAR, process.hostnames,
-                MPI_MAX_PROCESSOR_NAME, MPI_CHAR, communicator);
+  MPI_Comm node;
+  MPI_Comm_split_type(communicator, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL,
+                      &node);
+  MPI_Comm_rank(node, &process.node_rank);
+  MPI_Comm_size(node, &process.node_size);
+  MPI_Comm_free(&node);
   memcpy(process.topology, topology, sizeof(int) * DIMENSIONS);
   MPI_Cart_coords(communicator, rank, DIMENSIONS, process.coordinates);
 
@@ -65,5 +72,30 @@ dc_process_t dc_process_init(MPI_Comm communicator, int rank,
     }
   }
 
+  int existing_regions = 0, exchanged_regions = 0;
+  for (size_t face_index = 0; face_index < NEIGHBOURHOOD; face_index++) {
+    if (process.neighbours[face_index] == MPI_PROC_NULL)
+      continue;
+    existing_regions++;
+    if (dc_halo_region_exchanged(&process, face_index))
+      exchanged_regions++;
+  }
+  dc_log_info(rank, "Exchanging %d of %d neighbour regions", exchanged_regions,
+              existing_regions);
+
   return process;
 }
+
+int dc_halo_region_exchanged(const dc_process_t *process, size_t face_index) {
+  if (process->neighbours[face_index] == MPI_PROC_NULL)
+    return 0;
+  int dz = face_index / 9 - 1;
+  int dy = (face_index % 9) / 3 - 1;
+  int dx = face_index % 3 - 1;
+  return dc_footprint_reads_region(process->footprint, dx, dy, dz);
+}
+
+int dc_halo_region_messaged(const dc_process_t *process, size_t face_index) {
+  return dc_halo_region_exchanged(process, face_index) &&
+         !process->shared_neighbours[face_index];
+}
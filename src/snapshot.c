@@ -0,0 +1,66 @@
+#include <stdio.h>
+
+#include "coordinator.h"
+#include "io_server.h"
+#include "log.h"
+#include "snapshot.h"
+
+int dc_snapshot_due(const dc_process_t *process, unsigned int iteration) {
+  return process->snapshot_interval != 0 &&
+         iteration % process->snapshot_interval == 0 &&
+         iteration < process->iterations;
+}
+
+void dc_snapshot_write(dc_process_t *process, unsigned int iteration) {
+  if (process->io_client != NULL) {
+    dc_io_client_send(process->io_client, process, iteration, 0);
+  } else {
+#ifndef SIMGRID
+    char prefix[4096];
+    snprintf(prefix, sizeof(prefix), "%s.%u", process->output_file,
+             iteration);
+    dc_write_rank_results(process, prefix, iteration,
+                          process->output_compression);
+#endif
+  }
+  process->snapshots++;
+}
+
+void dc_snapshot_take(dc_process_t *process, dc_device_data *data,
+                      unsigned int iteration) {
+  double start = MPI_Wtime();
+  // The process arrays alias the kernels' flat arrays, or are filled from
+  // their bricked or interleaved copies
+  dc_device_data_get_results(process, data);
+  dc_snapshot_write(process, iteration);
+  // Records sent to a server are packed in the client's own buffers
+  dc_device_data_release_results(process, data);
+  process->snapshot_seconds += MPI_Wtime() - start;
+}
+
+void dc_snapshot_report(const dc_process_t *process, MPI_Comm comm,
+                        double seconds) {
+  double local[2] = {process->snapshot_seconds,
+                     process->io_client != NULL ? process->io_client->waiting
+                                                : 0};
+  double sums[2], slowest;
+  MPI_Reduce(local, sums, 2, MPI_DOUBLE, MPI_SUM, COORDINATOR, comm);
+  MPI_Reduce(&process->snapshot_seconds, &slowest, 1, MPI_DOUBLE, MPI_MAX,
+             COORDINATOR, comm);
+  if (process->rank != COORDINATOR)
+    return;
+  const double ranks = process->num_workers;
+  dc_log_info(process->rank,
+              "Snapshots: %u, every %u iterations, %s; they held ranks up "
+              "%.3f s on average (%.1f%% of %.3f s), %.3f s at most",
+              process->snapshots, process->snapshot_interval,
+              process->io_client != NULL ? "sent to I/O servers"
+                                         : "written by every rank",
+              sums[0] / ranks, 100 * sums[0] / ranks / seconds, seconds,
+              slowest);
+  if (process->io_client != NULL)
+    dc_log_info(process->rank,
+                "Snapshots: %.3f s per rank on average waiting for the sends "
+                "of earlier ones",
+                sums[1] / ranks);
+}
@@ -0,0 +1,86 @@
+#include <math.h>
+#include <mpi.h>
+#include <stdlib.h>
+
+#include "coordinator.h"
+#include "indexing.h"
+#include "log.h"
+#include "sponge.h"
+
+static float dc_sponge_rate(const dc_process_t *process, int axis) {
+  const float spacing[DIMENSIONS] = {process->dx, process->dy, process->dz};
+  return 3.0f * process->sponge_speed * logf(1.0f / DC_SPONGE_REFLECTION) /
+         (2.0f * process->sponge_width * spacing[axis]);
+}
+
+void dc_sponge_init(dc_process_t *process, MPI_Comm comm) {
+  if (process->sponge_width == 0)
+    return;
+
+  const dc_precomp_vars *vars = &process->precomp_vars;
+  size_t n = dc_compute_count_from_sizes(process->sizes);
+  if (process->material_ids != NULL) {
+    vars = &process->materials;
+    n = process->material_count;
+  }
+  float fastest = 0;
+  for (size_t i = 0; i < n; i++) {
+    fastest = fmaxf(fastest, vars->v2px[i]);
+    fastest = fmaxf(fastest, vars->v2pz[i]);
+    fastest = fmaxf(fastest, vars->v2pn[i]);
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &fastest, 1, MPI_FLOAT, MPI_MAX, comm);
+  process->sponge_speed = sqrtf(fastest);
+
+  if (process->rank == COORDINATOR)
+    dc_log_info(process->rank,
+                "Sponge: %zu cells at %g m/s, damping %g %g %g per step at "
+                "the edge",
+                process->sponge_width, process->sponge_speed,
+                expf(-dc_sponge_rate(process, 0) * process->dt),
+                expf(-dc_sponge_rate(process, 1) * process->dt),
+                expf(-dc_sponge_rate(process, 2) * process->dt));
+}
+
+float *dc_sponge_factors(const dc_process_t *process, int axis,
+                         size_t undamped[2]) {
+  const size_t width = process->sponge_width;
+  const size_t size = process->sizes[axis];
+  const float rate = dc_sponge_rate(process, axis);
+  float *factors = (float *)malloc(size * sizeof(float));
+  if (factors == NULL) {
+    dc_log_error(process->rank,
+                 "OOM: could not allocate sponge factors in dc_sponge_factors");
+    MPI_Finalize();
+    exit(1);
+  }
+
+  // Global range of the computed cells no sponge covers
+  const size_t inner_lo = STENCIL + width;
+  const size_t inner_hi = process->global_sizes[axis] - STENCIL - width;
+  undamped[0] = size;
+  undamped[1] = 0;
+  for (size_t i = 0; i < size; i++) {
+    const size_t global = process->start_coords[axis] + i;
+    size_t depth = 0;
+    if (global < inner_lo)
+      depth = inner_lo - global;
+    else if (global >= inner_hi)
+      depth = global - inner_hi + 1;
+    // Ghost cells are never computed
+    if (depth == 0 || depth > width) {
+      factors[i] = 1.0f;
+    } else {
+      const float fraction = (float)depth / width;
+      factors[i] = expf(-rate * fraction * fraction * process->dt);
+    }
+    if (depth == 0) {
+      if (i < undamped[0])
+        undamped[0] = i;
+      undamped[1] = i + 1;
+    }
+  }
+  if (undamped[0] > undamped[1])
+    undamped[0] = undamped[1] = 0;
+  return factors;
+}
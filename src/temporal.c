@@ -0,0 +1,507 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "temporal.h"
+#include "calculate_source.h"
+#include "coordinator.h"
+#include "indexing.h"
+#include "log.h"
+#include "materials.h"
+#include "model_cache.h"
+#include "partition.h"
+#include "propagate.h"
+
+// Exchanged before every pass: both time levels of p and q
+#define TEMPORAL_FIELDS 4
+// Copied once: vpz and vsv, then the precomputed coefficients
+#define TEMPORAL_MODEL 12
+
+static void dc_temporal_fields(dc_process_t *process,
+                               float **fields[TEMPORAL_FIELDS]) {
+  float **all[TEMPORAL_FIELDS] = {&process->pp, &process->pc, &process->qp,
+                                  &process->qc};
+  memcpy(fields, all, sizeof(all));
+}
+
+static void dc_temporal_model(dc_precomp_vars *vars,
+                              dc_anisotropy_t *velocities,
+                              float **model[TEMPORAL_MODEL]) {
+  float **all[TEMPORAL_MODEL] = {
+      &velocities->vpz, &velocities->vsv, &vars->ch1dxx, &vars->ch1dyy,
+      &vars->ch1dzz,    &vars->ch1dxy,    &vars->ch1dyz, &vars->ch1dxz,
+      &vars->v2px,      &vars->v2pz,      &vars->v2sz,   &vars->v2pn,
+  };
+  memcpy(model, all, sizeof(all));
+}
+
+// Extended box of the rank whose ghost-inclusive box is `box`; the box
+// already holds STENCIL of the steps * STENCIL cells a pass reads
+static void dc_temporal_extend(const unsigned long box[2 * DIMENSIONS],
+                               const size_t global_sizes[DIMENSIONS],
+                               unsigned int steps,
+                               unsigned long extended[2 * DIMENSIONS]) {
+  const size_t grow = (steps - 1) * STENCIL;
+  for (int i = 0; i < DIMENSIONS; i++) {
+    size_t lo = box[i] > grow ? box[i] - grow : 0;
+    size_t hi = box[i] + box[DIMENSIONS + i] + grow;
+    if (hi > global_sizes[i])
+      hi = global_sizes[i];
+    extended[i] = lo;
+    extended[DIMENSIONS + i] = hi - lo;
+  }
+}
+
+// Displacements of the current counts, checked against MPI's int range, and
+// buffers for `width` floats per cell
+static void dc_temporal_buffers(dc_temporal_t *temporal, int rank, int width) {
+  size_t send_total = 0, recv_total = 0;
+  for (int r = 0; r < temporal->num_ranks; r++) {
+    temporal->send_displs[r] = send_total;
+    temporal->recv_displs[r] = recv_total;
+    send_total += temporal->send_counts[r];
+    recv_total += temporal->recv_counts[r];
+    if (send_total > INT_MAX || recv_total > INT_MAX) {
+      dc_log_error(rank, "Halos of %zu cells exceed the MPI count range",
+                   send_total > recv_total ? send_total : recv_total);
+      MPI_Finalize();
+      exit(1);
+    }
+  }
+  free(temporal->send_buffer);
+  free(temporal->recv_buffer);
+  temporal->send_buffer = malloc(width * send_total * sizeof(float));
+  temporal->recv_buffer = malloc(width * recv_total * sizeof(float));
+  if ((send_total != 0 && temporal->send_buffer == NULL) ||
+      (recv_total != 0 && temporal->recv_buffer == NULL)) {
+    dc_log_error(rank, "OOM: could not allocate temporal halo buffers");
+    MPI_Finalize();
+    exit(1);
+  }
+}
+
+static void dc_temporal_alltoall(dc_temporal_t *temporal, int width,
+                                 MPI_Comm comm) {
+  MPI_Datatype cell;
+  MPI_Type_contiguous(width, MPI_FLOAT, &cell);
+  MPI_Type_commit(&cell);
+  MPI_Alltoallv(temporal->send_buffer, temporal->send_counts,
+                temporal->send_displs, cell, temporal->recv_buffer,
+                temporal->recv_counts, temporal->recv_displs, cell, comm);
+  MPI_Type_free(&cell);
+}
+
+// Pack the fields and model of the process's cells in `region` into
+// `buffer`, array after array. A material table stands in for the per-cell
+// coefficients, which it replaced along with vpz and vsv.
+static void dc_temporal_pack_cells(dc_process_t *process,
+                                   const size_t region[2 * DIMENSIONS],
+                                   float *buffer) {
+  float **fields[TEMPORAL_FIELDS], **model[TEMPORAL_MODEL];
+  dc_temporal_fields(process, fields);
+  const int table = process->material_ids != NULL;
+  dc_temporal_model(table ? &process->materials : &process->precomp_vars,
+                    &process->anisotropy_vars, model);
+  const size_t *start = process->start_coords, *sizes = process->sizes;
+  for (int a = 0; a < TEMPORAL_FIELDS + TEMPORAL_MODEL; a++) {
+    const float *array = a < TEMPORAL_FIELDS ? *fields[a]
+                                             : *model[a - TEMPORAL_FIELDS];
+    const int by_id = table && a >= TEMPORAL_FIELDS;
+    for (size_t z = region[2]; z < region[5]; z++) {
+      for (size_t y = region[1]; y < region[4]; y++) {
+        for (size_t x = region[0]; x < region[3]; x++) {
+          size_t i = dc_get_index_for_coordinates(
+              x - start[0], y - start[1], z - start[2], sizes[0], sizes[1],
+              sizes[2]);
+          if (array == NULL)
+            *buffer++ = 0;
+          else
+            *buffer++ = array[by_id ? process->material_ids[i] : i];
+        }
+      }
+    }
+  }
+}
+
+static void dc_temporal_unpack_cells(dc_process_t *extended,
+                                     const size_t region[2 * DIMENSIONS],
+                                     const float *buffer) {
+  float **fields[TEMPORAL_FIELDS], **model[TEMPORAL_MODEL];
+  dc_temporal_fields(extended, fields);
+  dc_temporal_model(&extended->precomp_vars, &extended->anisotropy_vars,
+                    model);
+  const size_t *start = extended->start_coords, *sizes = extended->sizes;
+  for (int a = 0; a < TEMPORAL_FIELDS + TEMPORAL_MODEL; a++) {
+    float *array = a < TEMPORAL_FIELDS ? *fields[a]
+                                       : *model[a - TEMPORAL_FIELDS];
+    for (size_t z = region[2]; z < region[5]; z++) {
+      for (size_t y = region[1]; y < region[4]; y++) {
+        size_t i = dc_get_index_for_coordinates(
+            region[0] - start[0], y - start[1], z - start[2], sizes[0],
+            sizes[1], sizes[2]);
+        size_t length = region[3] - region[0];
+        memcpy(array + i, buffer, length * sizeof(float));
+        buffer += length;
+      }
+    }
+  }
+}
+
+// Allocate the extended box's fields and per-cell model
+static void dc_temporal_allocate(dc_process_t *extended) {
+  size_t count = dc_compute_count_from_sizes(extended->sizes);
+  float **fields[TEMPORAL_FIELDS], **model[TEMPORAL_MODEL];
+  dc_temporal_fields(extended, fields);
+  dc_temporal_model(&extended->precomp_vars, &extended->anisotropy_vars,
+                    model);
+  for (int a = 0; a < TEMPORAL_FIELDS + TEMPORAL_MODEL; a++) {
+    float **array = a < TEMPORAL_FIELDS ? fields[a]
+                                        : model[a - TEMPORAL_FIELDS];
+    *array = malloc(count * sizeof(float));
+    if (*array == NULL) {
+      dc_log_error(extended->rank,
+                   "OOM: could not allocate the extended box in "
+                   "dc_temporal_init");
+      MPI_Finalize();
+      exit(1);
+    }
+  }
+}
+
+void dc_temporal_init(dc_temporal_t *temporal, dc_process_t *process,
+                      MPI_Comm comm) {
+  const int rank = process->rank;
+  memset(temporal, 0, sizeof(*temporal));
+  if (process->rebalance_interval != 0) {
+    if (rank == COORDINATOR)
+      dc_log_error(rank, "Rebalancing would move the boxes temporal blocking "
+                         "extends, disabling it");
+    process->rebalance_interval = 0;
+  }
+
+  int size;
+  MPI_Comm_size(comm, &size);
+  temporal->num_ranks = size;
+  unsigned long(*boxes)[2 * DIMENSIONS] = malloc(size * sizeof(*boxes));
+  temporal->send_regions =
+      malloc(size * sizeof(*temporal->send_regions));
+  temporal->recv_regions =
+      malloc(size * sizeof(*temporal->recv_regions));
+  temporal->send_counts = malloc(4 * size * sizeof(int));
+  if (boxes == NULL || temporal->send_regions == NULL ||
+      temporal->recv_regions == NULL || temporal->send_counts == NULL) {
+    dc_log_error(rank, "OOM: could not allocate memory in dc_temporal_init");
+    MPI_Finalize();
+    exit(1);
+  }
+  temporal->send_displs = temporal->send_counts + size;
+  temporal->recv_counts = temporal->send_counts + 2 * size;
+  temporal->recv_displs = temporal->send_counts + 3 * size;
+
+  unsigned long box[2 * DIMENSIONS];
+  for (int i = 0; i < DIMENSIONS; i++) {
+    box[i] = process->start_coords[i];
+    box[DIMENSIONS + i] = process->sizes[i];
+  }
+  MPI_Allgather(box, 2 * DIMENSIONS, MPI_UNSIGNED_LONG, boxes,
+                2 * DIMENSIONS, MPI_UNSIGNED_LONG, comm);
+
+  const size_t *global_sizes = process->global_sizes;
+  unsigned long extended_box[2 * DIMENSIONS];
+  dc_temporal_extend(box, global_sizes, process->temporal_steps,
+                     extended_box);
+  dc_process_t *extended = &temporal->extended;
+  *extended = *process;
+  for (int i = 0; i < DIMENSIONS; i++) {
+    extended->start_coords[i] = extended_box[i];
+    extended->sizes[i] = extended_box[DIMENSIONS + i];
+  }
+  if (!dc_local_offsets_fit(extended->sizes)) {
+    dc_log_error(rank,
+                 "Planes of %zu x %zu cells are too large for 32-bit kernel "
+                 "offsets",
+                 extended->sizes[0], extended->sizes[1]);
+    MPI_Finalize();
+    exit(1);
+  }
+  extended->source_index = dc_local_source_index(
+      global_sizes, extended->sizes, extended->start_coords);
+  memset(&extended->anisotropy_vars, 0, sizeof(extended->anisotropy_vars));
+  memset(&extended->precomp_vars, 0, sizeof(extended->precomp_vars));
+  memset(&extended->materials, 0, sizeof(extended->materials));
+  extended->material_count = 0;
+  extended->material_ids = NULL;
+  extended->model_mapping = NULL;
+  extended->model_mapping_size = 0;
+  dc_temporal_allocate(extended);
+
+  // Every cell of a box has one owner, ourselves included
+  size_t own_lo[DIMENSIONS], own_hi[DIMENSIONS];
+  dc_owned_region(box, global_sizes, own_lo, own_hi);
+  for (int r = 0; r < size; r++) {
+    size_t *send = temporal->send_regions[r], *recv = temporal->recv_regions[r];
+    unsigned long theirs[2 * DIMENSIONS];
+    dc_temporal_extend(boxes[r], global_sizes, process->temporal_steps,
+                       theirs);
+    temporal->send_counts[r] =
+        dc_box_overlap(own_lo, own_hi, theirs, send, send + DIMENSIONS);
+    size_t source_lo[DIMENSIONS], source_hi[DIMENSIONS];
+    dc_owned_region(boxes[r], global_sizes, source_lo, source_hi);
+    temporal->recv_counts[r] = dc_box_overlap(source_lo, source_hi,
+                                              extended_box, recv,
+                                              recv + DIMENSIONS);
+  }
+  free(boxes);
+
+  const int width = TEMPORAL_FIELDS + TEMPORAL_MODEL;
+  dc_temporal_buffers(temporal, rank, width);
+  for (int r = 0; r < size; r++) {
+    if (temporal->send_counts[r] != 0)
+      dc_temporal_pack_cells(process, temporal->send_regions[r],
+                             temporal->send_buffer +
+                                 (size_t)width * temporal->send_displs[r]);
+  }
+  dc_temporal_alltoall(temporal, width, comm);
+  for (int r = 0; r < size; r++) {
+    if (temporal->recv_counts[r] != 0)
+      dc_temporal_unpack_cells(extended, temporal->recv_regions[r],
+                               temporal->recv_buffer +
+                                   (size_t)width * temporal->recv_displs[r]);
+  }
+
+  // From now on our own cells stay in place and only the fields move
+  temporal->send_counts[rank] = temporal->recv_counts[rank] = 0;
+  dc_temporal_buffers(temporal, rank, TEMPORAL_FIELDS);
+
+  // The tables of the owners merge into one, exactly unless they hold too
+  // many distinct tuples between them
+  if (process->material_ids != NULL)
+    dc_materials_build(extended, DC_MAX_MATERIALS);
+  float **fields[TEMPORAL_FIELDS];
+  dc_temporal_fields(process, fields);
+  for (int f = 0; f < TEMPORAL_FIELDS; f++) {
+    free(*fields[f]);
+    *fields[f] = NULL;
+  }
+  dc_model_free(process);
+  dc_materials_free(process);
+
+  // Fields plus per-cell coefficients or material IDs
+  const size_t cell_bytes =
+      4 * sizeof(float) + (extended->material_ids != NULL
+                               ? sizeof(uint16_t)
+                               : sizeof(dc_precomp_vars) / sizeof(float *) *
+                                     sizeof(float));
+  const size_t *sizes = extended->sizes;
+  const size_t plane_bytes = sizes[0] * sizes[1] * cell_bytes;
+  const double own_cells = (double)(process->sizes[0] - 2 * STENCIL) *
+                           (process->sizes[1] - 2 * STENCIL) *
+                           (process->sizes[2] - 2 * STENCIL);
+  const double computed_cells = (double)(sizes[0] - 2 * STENCIL) *
+                                (sizes[1] - 2 * STENCIL) *
+                                (sizes[2] - 2 * STENCIL);
+  dc_log_info(rank,
+              "Temporal blocking: %u steps per pass in %d-plane bands over "
+              "a %zu x %zu x %zu box, up to %.0f%% of its cells computed by "
+              "a neighbour too, %.1f MiB in flight instead of %.1f MiB per "
+              "step",
+              process->temporal_steps, DC_TEMPORAL_BAND, sizes[0], sizes[1],
+              sizes[2], 100 * (1 - own_cells / computed_cells),
+              (double)((process->temporal_steps + 1) * DC_TEMPORAL_BAND +
+                       2 * STENCIL) *
+                  plane_bytes / (1 << 20),
+              (double)sizes[2] * plane_bytes / (1 << 20));
+}
+
+void dc_temporal_free(dc_temporal_t *temporal) {
+  dc_process_t *extended = &temporal->extended;
+  float **fields[TEMPORAL_FIELDS];
+  dc_temporal_fields(extended, fields);
+  for (int f = 0; f < TEMPORAL_FIELDS; f++) {
+    free(*fields[f]);
+    *fields[f] = NULL;
+  }
+  dc_model_free(extended);
+  dc_materials_free(extended);
+  free(temporal->send_regions);
+  free(temporal->recv_regions);
+  free(temporal->send_counts);
+  free(temporal->send_buffer);
+  free(temporal->recv_buffer);
+  memset(temporal, 0, sizeof(*temporal));
+}
+
+// Copy the fields of the cells other ranks own in the extended box from them
+static void dc_temporal_exchange(dc_temporal_t *temporal,
+                                 dc_process_t *process, dc_device_data *data,
+                                 MPI_Comm comm) {
+  double start_time = MPI_Wtime();
+  const dc_process_t *extended = &temporal->extended;
+  float *fields[TEMPORAL_FIELDS] = {data->pp, data->pc, data->qp, data->qc};
+  for (int r = 0; r < temporal->num_ranks; r++) {
+    const size_t cells = temporal->send_counts[r];
+    if (cells == 0)
+      continue;
+    size_t lo[DIMENSIONS], hi[DIMENSIONS];
+    for (int i = 0; i < DIMENSIONS; i++) {
+      lo[i] = temporal->send_regions[r][i] - extended->start_coords[i];
+      hi[i] = temporal->send_regions[r][DIMENSIONS + i] -
+              extended->start_coords[i];
+    }
+    float *buffer = temporal->send_buffer +
+                    TEMPORAL_FIELDS * (size_t)temporal->send_displs[r];
+    for (int f = 0; f < TEMPORAL_FIELDS; f++)
+      dc_device_extract_halo_face(data, buffer + f * cells, lo, hi,
+                                  extended->sizes, fields[f]);
+    process->halo_stats.messages_sent++;
+    process->halo_stats.bytes_sent += TEMPORAL_FIELDS * cells * sizeof(float);
+  }
+
+  dc_temporal_alltoall(temporal, TEMPORAL_FIELDS, comm);
+
+  for (int r = 0; r < temporal->num_ranks; r++) {
+    const size_t cells = temporal->recv_counts[r];
+    if (cells == 0)
+      continue;
+    size_t lo[DIMENSIONS], hi[DIMENSIONS];
+    for (int i = 0; i < DIMENSIONS; i++) {
+      lo[i] = temporal->recv_regions[r][i] - extended->start_coords[i];
+      hi[i] = temporal->recv_regions[r][DIMENSIONS + i] -
+              extended->start_coords[i];
+    }
+    const float *buffer = temporal->recv_buffer +
+                          TEMPORAL_FIELDS * (size_t)temporal->recv_displs[r];
+    for (int f = 0; f < TEMPORAL_FIELDS; f++)
+      dc_device_insert_halo_face(data, buffer + f * cells, lo, hi,
+                                 extended->sizes, fields[f]);
+    process->halo_stats.messages_received++;
+    process->halo_stats.bytes_received +=
+        TEMPORAL_FIELDS * cells * sizeof(float);
+  }
+  process->halo_stats.seconds += MPI_Wtime() - start_time;
+}
+
+void dc_temporal_advance(dc_temporal_t *temporal, dc_process_t *process,
+                         dc_device_data *data, MPI_Comm comm,
+                         unsigned int first, unsigned int steps) {
+  dc_temporal_exchange(temporal, process, data, comm);
+
+  const dc_process_t *extended = &temporal->extended;
+  const size_t *sizes = extended->sizes;
+  const size_t bands = (sizes[2] - STENCIL - 1) / DC_TEMPORAL_BAND + 1;
+
+  // The rank's computed cells and the grid's, in extended box coordinates
+  size_t own_lo[DIMENSIONS], own_hi[DIMENSIONS];
+  size_t grid_lo[DIMENSIONS], grid_hi[DIMENSIONS];
+  for (int i = 0; i < DIMENSIONS; i++) {
+    const size_t offset = process->start_coords[i] - extended->start_coords[i];
+    own_lo[i] = offset + STENCIL;
+    own_hi[i] = offset + process->sizes[i] - STENCIL;
+    grid_lo[i] = extended->start_coords[i] == 0 ? STENCIL : 0;
+    grid_hi[i] = extended->start_coords[i] + sizes[i] ==
+                         process->global_sizes[i]
+                     ? sizes[i] - STENCIL
+                     : sizes[i];
+  }
+
+  size_t source[DIMENSIONS] = {0, 0, 0};
+  if (extended->source_index != -1)
+    dc_extract_coordinates(&source[0], &source[1], &source[2], sizes[0],
+                           sizes[1], sizes[2], extended->source_index);
+
+  // Swaps applied so far, mod 2; step k runs after k of them
+  unsigned int parity = 0;
+  // Steps whose source has been added
+  unsigned int sourced = 0;
+  for (size_t front = 0; front < bands + steps - 1; front++) {
+    for (unsigned int k = 0; k < steps && k <= front; k++) {
+      // Step k + 1 reads STENCIL planes past its band, which step k, one
+      // band ahead, has already written; it overwrites step k - 1's output,
+      // which step k has read up to its own band
+      const size_t band = front - k;
+      if (band >= bands)
+        continue;
+      // Step k computes the cells later steps read: STENCIL fewer around
+      // the rank's box each step, and none of the grid's ghosts
+      const size_t grow = (steps - 1 - k) * STENCIL;
+      size_t lo[DIMENSIONS], hi[DIMENSIONS];
+      for (int i = 0; i < DIMENSIONS; i++) {
+        lo[i] = own_lo[i] > grid_lo[i] + grow ? own_lo[i] - grow : grid_lo[i];
+        hi[i] = own_hi[i] + grow < grid_hi[i] ? own_hi[i] + grow : grid_hi[i];
+      }
+      size_t start[DIMENSIONS] = {lo[0], lo[1], band * DC_TEMPORAL_BAND};
+      size_t end[DIMENSIONS] = {hi[0], hi[1], (band + 1) * DC_TEMPORAL_BAND};
+      if (start[2] < lo[2])
+        start[2] = lo[2];
+      if (end[2] > hi[2])
+        end[2] = hi[2];
+      if (start[0] >= end[0] || start[1] >= end[1] || start[2] >= end[2])
+        continue;
+
+      if (parity != k % 2) {
+        dc_device_swap_arrays(data);
+        parity ^= 1;
+      }
+      // Every rank whose step reads the source cell adds it to its copy
+      int reads_source = extended->source_index != -1 && sourced == k &&
+                         end[2] + STENCIL > source[2];
+      for (int i = 0; i < DIMENSIONS && reads_source; i++)
+        reads_source = source[i] + STENCIL >= lo[i] &&
+                       source[i] < hi[i] + STENCIL;
+      if (reads_source) {
+        dc_device_add_source(data, extended->source_index,
+                             dc_calculate_source(process->dt, first + k));
+        sourced++;
+      }
+      dc_propagate(start, end, sizes, process->coordinates, process->topology,
+                   data, process->dx, process->dy, process->dz, process->dt);
+    }
+  }
+
+  if (parity != steps % 2)
+    dc_device_swap_arrays(data);
+}
+
+void dc_temporal_get_results(dc_temporal_t *temporal, dc_process_t *process,
+                             dc_device_data *data) {
+  dc_process_t *extended = &temporal->extended;
+  dc_device_data_get_results(extended, data);
+
+  const size_t *sizes = process->sizes, *from_sizes = extended->sizes;
+  size_t offset[DIMENSIONS];
+  for (int i = 0; i < DIMENSIONS; i++)
+    offset[i] = process->start_coords[i] - extended->start_coords[i];
+  float **fields[TEMPORAL_FIELDS], **from[TEMPORAL_FIELDS];
+  dc_temporal_fields(process, fields);
+  dc_temporal_fields(extended, from);
+  for (int f = 0; f < TEMPORAL_FIELDS; f++) {
+    if (*fields[f] == NULL)
+      *fields[f] = malloc(dc_compute_count_from_sizes(sizes) * sizeof(float));
+    if (*fields[f] == NULL) {
+      dc_log_error(process->rank, "OOM: could not allocate memory for "
+                                  "fields in dc_temporal_get_results");
+      MPI_Finalize();
+      exit(1);
+    }
+    for (size_t z = 0; z < sizes[2]; z++) {
+      for (size_t y = 0; y < sizes[1]; y++) {
+        memcpy(*fields[f] + dc_get_index_for_coordinates(0, y, z, sizes[0],
+                                                          sizes[1], sizes[2]),
+               *from[f] + dc_get_index_for_coordinates(
+                              offset[0], offset[1] + y, offset[2] + z,
+                              from_sizes[0], from_sizes[1], from_sizes[2]),
+               sizes[0] * sizeof(float));
+      }
+    }
+  }
+  dc_device_data_release_results(extended, data);
+}
+
+void dc_temporal_release_results(dc_process_t *process) {
+  float **fields[TEMPORAL_FIELDS];
+  dc_temporal_fields(process, fields);
+  for (int f = 0; f < TEMPORAL_FIELDS; f++) {
+    free(*fields[f]);
+    *fields[f] = NULL;
+  }
+}
@@ -0,0 +1,345 @@
+// dc-compare: compare the raw output of a run, p and then q over the padded
+// grid, against a reference, field by field and optionally over boxes of the
+// grid. The files are mapped and walked a batch at a time, dropping the
+// pages behind, so they may be larger than memory.
+#include <argp.h>
+#include <fcntl.h>
+#include <math.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "definitions.h"
+
+#define DC_COMPARE_FIELDS 2
+#define DC_COMPARE_MAX_BOXES 16
+// Cells of a row one thread compares at a time, and bytes of each file
+// compared between releases of the pages behind
+#define DC_COMPARE_SEGMENT ((size_t)1 << 16)
+#define DC_COMPARE_BATCH ((size_t)64 << 20)
+
+static const char *field_names[DC_COMPARE_FIELDS] = {"p", "q"};
+
+typedef struct {
+  const char *reference;
+  const char *candidate;
+  double tolerance;
+  int threads;
+  int sizes_given;
+  size_t sizes[DIMENSIONS];
+  int boxes;
+  size_t box[DC_COMPARE_MAX_BOXES][2][DIMENSIONS];
+} dc_compare_arguments_t;
+
+typedef struct {
+  size_t cells;
+  double squares, reference_squares;
+  double largest, reference_largest;
+  // Cells differing by more than the tolerance, NaNs included, and cells
+  // whose difference is not finite
+  size_t over, not_finite;
+} dc_errors_t;
+
+typedef struct {
+  const float *data;
+  size_t size;
+  // Bytes from the start whose pages were dropped
+  size_t released;
+} dc_mapping_t;
+
+static struct argp_option options[] = {
+    {"tolerance", 'e', "FLOAT", 0,
+     "Largest absolute difference a cell may have, 1e-6 by default"},
+    {"sizes", 's', "X,Y,Z", 0,
+     "Padded grid the files hold, as dc logs it; needed for boxes"},
+    {"box", 'b', "X0,Y0,Z0,X1,Y1,Z1", 0,
+     "Also compare the cells from (X0, Y0, Z0) up to, excluding, (X1, Y1, "
+     "Z1) of the grid on their own; may be repeated"},
+    {"threads", 't', "INTEGER", 0, "Comparing threads"},
+    {0}};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+  dc_compare_arguments_t *arguments = state->input;
+  switch (key) {
+  case 'e':
+    arguments->tolerance = atof(arg);
+    break;
+  case 's':
+    if (sscanf(arg, "%zu,%zu,%zu", &arguments->sizes[0], &arguments->sizes[1],
+               &arguments->sizes[2]) != 3)
+      argp_error(state, "malformed sizes: %s", arg);
+    arguments->sizes_given = 1;
+    break;
+  case 'b': {
+    if (arguments->boxes == DC_COMPARE_MAX_BOXES)
+      argp_error(state, "at most %d boxes", DC_COMPARE_MAX_BOXES);
+    size_t(*box)[DIMENSIONS] = arguments->box[arguments->boxes++];
+    if (sscanf(arg, "%zu,%zu,%zu,%zu,%zu,%zu", &box[0][0], &box[0][1],
+               &box[0][2], &box[1][0], &box[1][1], &box[1][2]) != 6)
+      argp_error(state, "malformed box: %s", arg);
+    break;
+  }
+  case 't':
+    arguments->threads = atoi(arg);
+    break;
+  case ARGP_KEY_ARG:
+    if (state->arg_num == 0)
+      arguments->reference = arg;
+    else if (state->arg_num == 1)
+      arguments->candidate = arg;
+    else
+      argp_usage(state);
+    break;
+  case ARGP_KEY_END:
+    if (arguments->candidate == NULL)
+      argp_usage(state);
+    if (arguments->boxes > 0 && !arguments->sizes_given)
+      argp_error(state, "boxes need the grid sizes");
+    break;
+  default:
+    return ARGP_ERR_UNKNOWN;
+  }
+  return 0;
+}
+
+static struct argp argp = {
+    options, parse_opt, "REFERENCE CANDIDATE",
+    "Compares the raw output CANDIDATE of a run against REFERENCE; exits "
+    "with 1 when a cell differs by more than the tolerance"};
+
+static int dc_map(const char *path, dc_mapping_t *mapping) {
+  int file = open(path, O_RDONLY);
+  struct stat status;
+  if (file < 0 || fstat(file, &status) != 0 || status.st_size == 0) {
+    fprintf(stderr, "Cannot read %s\n", path);
+    return 0;
+  }
+  mapping->size = status.st_size;
+  mapping->released = 0;
+  mapping->data = mmap(NULL, mapping->size, PROT_READ, MAP_SHARED, file, 0);
+  close(file);
+  if (mapping->data == MAP_FAILED) {
+    fprintf(stderr, "Cannot map %s\n", path);
+    return 0;
+  }
+  madvise((void *)mapping->data, mapping->size, MADV_SEQUENTIAL);
+  return 1;
+}
+
+// Drop the pages wholly before byte `offset`, which were compared already
+static void dc_release(dc_mapping_t *mapping, size_t offset) {
+  const size_t page = sysconf(_SC_PAGESIZE);
+  offset -= offset % page;
+  if (offset <= mapping->released)
+    return;
+  madvise((char *)mapping->data + mapping->released,
+          offset - mapping->released, MADV_DONTNEED);
+  mapping->released = offset;
+}
+
+static inline void dc_accumulate(const float *reference,
+                                 const float *candidate, size_t count,
+                                 double tolerance, double *squares,
+                                 double *reference_squares, double *largest,
+                                 double *reference_largest, size_t *over,
+                                 size_t *not_finite, size_t *nans,
+                                 size_t *reference_nans) {
+  double s = 0, rs = 0, l = 0, rl = 0;
+  size_t o = 0, n = 0, nn = 0, rn = 0;
+#pragma omp simd reduction(+ : s, rs, o, n, nn, rn) reduction(max : l, rl)
+  for (size_t i = 0; i < count; i++) {
+    const double r = reference[i];
+    const double d = (double)candidate[i] - r;
+    const double m = fabs(d);
+    s += d * d;
+    rs += r * r;
+    l = m > l ? m : l;
+    rl = fabs(r) > rl ? fabs(r) : rl;
+    o += !(m <= tolerance);
+    n += !isfinite(d);
+    nn += m != m;
+    rn += r != r;
+  }
+  *squares += s;
+  *reference_squares += rs;
+  *largest = l > *largest ? l : *largest;
+  *reference_largest = rl > *reference_largest ? rl : *reference_largest;
+  *over += o;
+  *not_finite += n;
+  *nans += nn;
+  *reference_nans += rn;
+}
+
+// Cells of a box are compared in units of up to `segment` cells of a row,
+// x fastest, then y, then z, so units go front to back through the field
+static size_t dc_unit_offset(size_t u, const size_t sizes[DIMENSIONS],
+                             const size_t lo[DIMENSIONS],
+                             const size_t hi[DIMENSIONS], size_t segments,
+                             size_t segment) {
+  const size_t row = u / segments;
+  const size_t y = lo[1] + row % (hi[1] - lo[1]);
+  const size_t z = lo[2] + row / (hi[1] - lo[1]);
+  return (z * sizes[1] + y) * sizes[0] + lo[0] + u % segments * segment;
+}
+
+// Compare the cells from `lo` up to `hi` of field `field` in the grid of
+// `sizes`, dropping the pages behind after every batch of units
+static dc_errors_t dc_compare_box(dc_mapping_t *reference,
+                                  dc_mapping_t *candidate, int field,
+                                  const size_t sizes[DIMENSIONS],
+                                  const size_t lo[DIMENSIONS],
+                                  const size_t hi[DIMENSIONS],
+                                  double tolerance) {
+  const size_t cells = sizes[0] * sizes[1] * sizes[2];
+  const float *r = reference->data + field * cells;
+  const float *c = candidate->data + field * cells;
+  const size_t width = hi[0] - lo[0];
+  const size_t segment =
+      width < DC_COMPARE_SEGMENT ? width : DC_COMPARE_SEGMENT;
+  const size_t segments = (width + segment - 1) / segment;
+  const size_t units = (hi[1] - lo[1]) * (hi[2] - lo[2]) * segments;
+  size_t batch = DC_COMPARE_BATCH / (segment * sizeof(float));
+  if (batch == 0)
+    batch = 1;
+  // Earlier passes may have dropped pages of the field already
+  reference->released = candidate->released = 0;
+  dc_release(reference, field * cells * sizeof(float));
+  dc_release(candidate, field * cells * sizeof(float));
+
+  double squares = 0, reference_squares = 0, largest = 0,
+         reference_largest = 0;
+  size_t over = 0, not_finite = 0, nans = 0, reference_nans = 0;
+  for (size_t first = 0; first < units; first += batch) {
+    const size_t last = first + batch < units ? first + batch : units;
+#pragma omp parallel for schedule(static)                                      \
+    reduction(+ : squares, reference_squares, over, not_finite, nans,          \
+                  reference_nans)                                              \
+    reduction(max : largest, reference_largest)
+    for (size_t u = first; u < last; u++) {
+      const size_t offset = dc_unit_offset(u, sizes, lo, hi, segments, segment);
+      const size_t x = lo[0] + u % segments * segment;
+      const size_t count = hi[0] - x < segment ? hi[0] - x : segment;
+      dc_accumulate(r + offset, c + offset, count, tolerance, &squares,
+                    &reference_squares, &largest, &reference_largest, &over,
+                    &not_finite, &nans, &reference_nans);
+    }
+
+    const size_t next =
+        last < units ? dc_unit_offset(last, sizes, lo, hi, segments, segment)
+                     : cells;
+    dc_release(reference, (field * cells + next) * sizeof(float));
+    dc_release(candidate, (field * cells + next) * sizeof(float));
+  }
+
+  // max skips NaNs; a NaN cell makes the largest difference NaN, so a
+  // blown-up run cannot hide behind its finite cells
+  if (nans != 0)
+    largest = NAN;
+  if (reference_nans != 0)
+    reference_largest = NAN;
+
+  const dc_errors_t errors = {width * (hi[1] - lo[1]) * (hi[2] - lo[2]),
+                              squares,
+                              reference_squares,
+                              largest,
+                              reference_largest,
+                              over,
+                              not_finite};
+  return errors;
+}
+
+static void dc_report(const char *field, const char *where,
+                      const dc_errors_t *errors, double tolerance) {
+  const double l2 = sqrt(errors->squares);
+  const double reference_l2 = sqrt(errors->reference_squares);
+  printf("%s%s: %zu cells, L2 %.6e, RMS %.6e, Linf %.6e, relative L2 %.6e, "
+         "relative Linf %.6e, %zu over %g, %zu not finite\n",
+         field, where, errors->cells, l2, l2 / sqrt((double)errors->cells),
+         errors->largest, reference_l2 > 0 ? l2 / reference_l2 : l2,
+         errors->reference_largest > 0
+             ? errors->largest / errors->reference_largest
+             : errors->largest,
+         errors->over, tolerance, errors->not_finite);
+}
+
+int main(int argc, char **argv) {
+  dc_compare_arguments_t arguments = {0};
+  arguments.tolerance = 1e-6;
+  argp_parse(&argp, argc, argv, 0, 0, &arguments);
+  if (arguments.threads > 0)
+    omp_set_num_threads(arguments.threads);
+  double start = omp_get_wtime();
+
+  dc_mapping_t reference, candidate;
+  if (!dc_map(arguments.reference, &reference) ||
+      !dc_map(arguments.candidate, &candidate))
+    return 2;
+  if (reference.size != candidate.size) {
+    fprintf(stderr, "%s holds %zu bytes and %s %zu\n", arguments.reference,
+            reference.size, arguments.candidate, candidate.size);
+    return 2;
+  }
+
+  // Without the grid, a field is one long row
+  const size_t cells = reference.size / (DC_COMPARE_FIELDS * sizeof(float));
+  size_t sizes[DIMENSIONS] = {cells, 1, 1};
+  if (arguments.sizes_given) {
+    memcpy(sizes, arguments.sizes, sizeof(sizes));
+    if (sizes[0] * sizes[1] * sizes[2] != cells ||
+        reference.size != DC_COMPARE_FIELDS * cells * sizeof(float)) {
+      fprintf(stderr, "The files do not hold two fields over a %zu x %zu x "
+                      "%zu grid\n",
+              sizes[0], sizes[1], sizes[2]);
+      return 2;
+    }
+  } else if (reference.size != DC_COMPARE_FIELDS * cells * sizeof(float)) {
+    fprintf(stderr, "The files do not hold two fields of floats\n");
+    return 2;
+  }
+  for (int b = 0; b < arguments.boxes; b++) {
+    for (int i = 0; i < DIMENSIONS; i++) {
+      if (arguments.box[b][0][i] >= arguments.box[b][1][i] ||
+          arguments.box[b][1][i] > sizes[i]) {
+        fprintf(stderr, "Box %d must lie within the %zu x %zu x %zu grid\n",
+                b + 1, sizes[0], sizes[1], sizes[2]);
+        return 2;
+      }
+    }
+  }
+
+  // Whole fields, then the boxes, each walked front to back
+  const size_t whole[DIMENSIONS] = {0, 0, 0};
+  int within = 1;
+  for (int f = 0; f < DC_COMPARE_FIELDS; f++) {
+    dc_errors_t errors = dc_compare_box(&reference, &candidate, f, sizes,
+                                        whole, sizes, arguments.tolerance);
+    dc_report(field_names[f], "", &errors, arguments.tolerance);
+    within = within && errors.over == 0;
+  }
+  for (int b = 0; b < arguments.boxes; b++) {
+    char where[160];
+    snprintf(where, sizeof(where), " in (%zu, %zu, %zu)-(%zu, %zu, %zu)",
+             arguments.box[b][0][0], arguments.box[b][0][1],
+             arguments.box[b][0][2], arguments.box[b][1][0],
+             arguments.box[b][1][1], arguments.box[b][1][2]);
+    for (int f = 0; f < DC_COMPARE_FIELDS; f++) {
+      dc_errors_t errors = dc_compare_box(
+          &reference, &candidate, f, sizes, arguments.box[b][0],
+          arguments.box[b][1], arguments.tolerance);
+      dc_report(field_names[f], where, &errors, arguments.tolerance);
+    }
+  }
+
+  const double seconds = omp_get_wtime() - start;
+  printf("Compared 2 x %zu bytes in %.3f s (%.0f MB/s): %s a tolerance of "
+         "%g\n",
+         reference.size, seconds, 2 * reference.size / 1e6 / seconds,
+         within ? "within" : "outside", arguments.tolerance);
+  munmap((void *)reference.data, reference.size);
+  munmap((void *)candidate.data, candidate.size);
+  return within ? 0 : 1;
+}
@@ -0,0 +1,273 @@
+// dc-merge: assemble the per-rank output files of a run (see rank_file.h)
+// into the layout of a shared output file, or extract a sub-volume from them
+// without assembling the rest
+#include <argp.h>
+#include <fcntl.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rank_file.h"
+
+typedef struct {
+  const char *input;
+  const char *output;
+  int threads;
+  int box_given;
+  size_t box[2][DIMENSIONS];
+} dc_merge_arguments_t;
+
+// A record of the set, its fields straight in the mapping or decoded
+typedef struct {
+  const dc_rank_header_t *header;
+  const float *p, *q;
+  float *decoded;
+} dc_rank_record_t;
+
+typedef struct {
+  void *data;
+  size_t size;
+} dc_rank_mapping_t;
+
+static struct argp_option options[] = {
+    {"box", 'b', "X0,Y0,Z0,X1,Y1,Z1", 0,
+     "Only write the cells from (X0, Y0, Z0) up to, excluding, (X1, Y1, Z1) "
+     "in padded global coordinates, p and then q, x fastest"},
+    {"threads", 't', "INTEGER", 0, "Copying threads"},
+    {0}};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+  dc_merge_arguments_t *arguments = state->input;
+  switch (key) {
+  case 'b':
+    if (sscanf(arg, "%zu,%zu,%zu,%zu,%zu,%zu", &arguments->box[0][0],
+               &arguments->box[0][1], &arguments->box[0][2],
+               &arguments->box[1][0], &arguments->box[1][1],
+               &arguments->box[1][2]) != 6)
+      argp_error(state, "malformed box: %s", arg);
+    arguments->box_given = 1;
+    break;
+  case 't':
+    arguments->threads = atoi(arg);
+    break;
+  case ARGP_KEY_ARG:
+    if (state->arg_num == 0)
+      arguments->input = arg;
+    else if (state->arg_num == 1)
+      arguments->output = arg;
+    else
+      argp_usage(state);
+    break;
+  case ARGP_KEY_END:
+    if (arguments->output == NULL)
+      argp_usage(state);
+    break;
+  default:
+    return ARGP_ERR_UNKNOWN;
+  }
+  return 0;
+}
+
+static struct argp argp = {
+    options, parse_opt, "OUTPUT-FILE DESTINATION",
+    "Merges the OUTPUT-FILE.<n> files of a run with --per-rank-output or "
+    "--io-servers, or of one of its snapshots, into DESTINATION"};
+
+static int dc_map_file(const char *input, int n, dc_rank_mapping_t *mapping) {
+  char path[4096];
+  dc_rank_file_path(path, sizeof(path), input, n);
+  int file = open(path, O_RDONLY);
+  struct stat status;
+  if (file < 0 || fstat(file, &status) != 0 ||
+      (size_t)status.st_size < sizeof(dc_rank_header_t)) {
+    fprintf(stderr, "Cannot read %s\n", path);
+    return 0;
+  }
+  mapping->size = status.st_size;
+  mapping->data = mmap(NULL, mapping->size, PROT_READ, MAP_SHARED, file, 0);
+  close(file);
+  if (mapping->data == MAP_FAILED) {
+    fprintf(stderr, "Cannot map %s\n", path);
+    return 0;
+  }
+  madvise(mapping->data, mapping->size, MADV_SEQUENTIAL);
+  return 1;
+}
+
+// Add the records of file `n` to `records`, sized once the first record
+// tells how many the set holds. Returns 0 when the file is not part of the
+// set.
+static int dc_scan_file(const char *input, int n,
+                        const dc_rank_mapping_t *mapping,
+                        dc_rank_record_t **records, uint32_t *count,
+                        uint32_t *ranks) {
+  for (size_t offset = 0; offset < mapping->size;) {
+    const dc_rank_header_t *header =
+        (const dc_rank_header_t *)((const char *)mapping->data + offset);
+    if (mapping->size - offset < sizeof(*header) ||
+        memcmp(header->magic, DC_RANK_MAGIC, sizeof(DC_RANK_MAGIC)) != 0 ||
+        header->version != DC_RANK_VERSION ||
+        header->bytes > mapping->size - offset - sizeof(*header) ||
+        (header->codec == DC_CODEC_NONE &&
+         header->bytes != 2 * dc_rank_cells(header) * sizeof(float))) {
+      fprintf(stderr, "%s.%d is not a per-rank output file\n", input, n);
+      return 0;
+    }
+    if (*records == NULL) {
+      *ranks = header->ranks;
+      *records = calloc(*ranks, sizeof(dc_rank_record_t));
+      if (*records == NULL) {
+        fprintf(stderr, "OOM: could not allocate %u records\n", *ranks);
+        return 0;
+      }
+    }
+    const dc_rank_header_t *first = (*records)[0].header;
+    if (*count == *ranks || header->ranks != *ranks ||
+        (first != NULL &&
+         (memcmp(header->global_sizes, first->global_sizes,
+                 sizeof(first->global_sizes)) != 0 ||
+          header->iteration != first->iteration))) {
+      fprintf(stderr, "%s.%d holds records of another run\n", input, n);
+      return 0;
+    }
+    (*records)[(*count)++].header = header;
+    offset += sizeof(*header) + header->bytes;
+  }
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  dc_merge_arguments_t arguments = {0};
+  argp_parse(&argp, argc, argv, 0, 0, &arguments);
+  if (arguments.threads > 0)
+    omp_set_num_threads(arguments.threads);
+  double start = omp_get_wtime();
+
+  // Files in order until the set is complete
+  dc_rank_record_t *records = NULL;
+  dc_rank_mapping_t *mappings = NULL;
+  uint32_t ranks = 0, held = 0;
+  int files = 0;
+  while (records == NULL || held < ranks) {
+    dc_rank_mapping_t *grown =
+        realloc(mappings, (files + 1) * sizeof(dc_rank_mapping_t));
+    if (grown == NULL) {
+      fprintf(stderr, "OOM: could not allocate %d file mappings\n", files + 1);
+      return 1;
+    }
+    mappings = grown;
+    if (!dc_map_file(arguments.input, files, &mappings[files]) ||
+        !dc_scan_file(arguments.input, files, &mappings[files], &records,
+                      &held, &ranks))
+      return 1;
+    files++;
+  }
+  const dc_rank_header_t *first = records[0].header;
+
+  // Compressed records are decoded up front, the others read in place
+  int failed = 0;
+#pragma omp parallel for schedule(dynamic) reduction(| : failed)
+  for (uint32_t r = 0; r < ranks; r++) {
+    const dc_rank_header_t *header = records[r].header;
+    const size_t cells = dc_rank_cells(header);
+    const unsigned char *stored = (const unsigned char *)(header + 1);
+    if (header->codec == DC_CODEC_NONE) {
+      records[r].p = (const float *)stored;
+    } else {
+      records[r].decoded = malloc(2 * cells * sizeof(float));
+      unsigned char *scratch = malloc(2 * cells * sizeof(float));
+      failed |= records[r].decoded == NULL || scratch == NULL ||
+                !dc_codec_decode(stored, header->bytes, 2 * cells,
+                                 records[r].decoded, scratch);
+      free(scratch);
+      records[r].p = records[r].decoded;
+    }
+    records[r].q = records[r].p + cells;
+  }
+  if (failed) {
+    fprintf(stderr, "Cannot decode the records of %s\n", arguments.input);
+    return 1;
+  }
+
+  // The whole padded box unless a sub-volume was asked for
+  size_t lo[DIMENSIONS], hi[DIMENSIONS], sizes[DIMENSIONS], count = 1;
+  for (int i = 0; i < DIMENSIONS; i++) {
+    lo[i] = arguments.box_given ? arguments.box[0][i] : 0;
+    hi[i] = arguments.box_given ? arguments.box[1][i]
+                                : first->global_sizes[i];
+    if (lo[i] >= hi[i] || hi[i] > first->global_sizes[i]) {
+      fprintf(stderr, "The box must lie within the %llu x %llu x %llu grid\n",
+              (unsigned long long)first->global_sizes[0],
+              (unsigned long long)first->global_sizes[1],
+              (unsigned long long)first->global_sizes[2]);
+      return 1;
+    }
+    sizes[i] = hi[i] - lo[i];
+    count *= sizes[i];
+  }
+
+  // Cells no rank holds, the global ghosts, stay zero as in a shared file
+  size_t bytes = 2 * count * sizeof(float);
+  int file = open(arguments.output, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (file < 0 || ftruncate(file, bytes) != 0) {
+    fprintf(stderr, "Cannot create %s\n", arguments.output);
+    return 1;
+  }
+  float *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+  close(file);
+  if (p == MAP_FAILED) {
+    fprintf(stderr, "Cannot map %s\n", arguments.output);
+    return 1;
+  }
+  float *q = p + count;
+
+  // Every z plane of the box gets its rows from the ranks crossing it
+#pragma omp parallel for schedule(dynamic)
+  for (size_t z = lo[2]; z < hi[2]; z++) {
+    for (uint32_t r = 0; r < ranks; r++) {
+      const dc_rank_header_t *header = records[r].header;
+      size_t from[DIMENSIONS], to[DIMENSIONS];
+      int crosses = 1;
+      for (int i = 0; i < DIMENSIONS; i++) {
+        from[i] = header->starts[i] > lo[i] ? header->starts[i] : lo[i];
+        to[i] = header->starts[i] + header->sizes[i] < hi[i]
+                    ? header->starts[i] + header->sizes[i]
+                    : hi[i];
+        crosses = crosses && from[i] < to[i];
+      }
+      if (!crosses || z < from[2] || z >= to[2])
+        continue;
+      const size_t run = (to[0] - from[0]) * sizeof(float);
+      for (size_t y = from[1]; y < to[1]; y++) {
+        size_t source = ((z - header->starts[2]) * header->sizes[1] +
+                         (y - header->starts[1])) *
+                            header->sizes[0] +
+                        (from[0] - header->starts[0]);
+        size_t destination =
+            ((z - lo[2]) * sizes[1] + (y - lo[1])) * sizes[0] + (from[0] - lo[0]);
+        memcpy(p + destination, records[r].p + source, run);
+        memcpy(q + destination, records[r].q + source, run);
+      }
+    }
+  }
+
+  if (munmap(p, bytes) != 0) {
+    fprintf(stderr, "Cannot write %s\n", arguments.output);
+    return 1;
+  }
+  for (uint32_t r = 0; r < ranks; r++)
+    free(records[r].decoded);
+  for (int f = 0; f < files; f++)
+    munmap(mappings[f].data, mappings[f].size);
+  free(records);
+  free(mappings);
+  printf("Wrote %zu x %zu x %zu cells from %u ranks in %d files to %s in "
+         "%.3f s\n",
+         sizes[0], sizes[1], sizes[2], ranks, files, arguments.output,
+         omp_get_wtime() - start);
+  return 0;
+}
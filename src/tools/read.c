@@ -0,0 +1,179 @@
+// dc-read: describe a chunked output file (see chunked.h), or extract fields,
+// boxes or planes of it as raw floats, x fastest, decoding only the chunks
+// they touch
+#include <argp.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunked.h"
+
+typedef struct {
+  const char *input;
+  const char *output;
+  const char *field;
+  int threads;
+  int box_given;
+  uint64_t box[2][DIMENSIONS];
+  int plane_axis;
+  uint64_t plane;
+} dc_read_arguments_t;
+
+static struct argp_option options[] = {
+    {"output", 'o', "PATH", 0,
+     "Write the selected cells there instead of describing the file"},
+    {"field", 'f', "NAME", 0, "Only this field; all of them by default"},
+    {"box", 'b', "X0,Y0,Z0,X1,Y1,Z1", 0,
+     "Only the cells from (X0, Y0, Z0) up to, excluding, (X1, Y1, Z1)"},
+    {"plane", 'p', "AXIS=INDEX", 0,
+     "Only the plane at INDEX across AXIS (x, y or z), within the box"},
+    {"threads", 't', "INTEGER", 0, "Decoding threads"},
+    {0}};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+  dc_read_arguments_t *arguments = state->input;
+  unsigned long long values[2 * DIMENSIONS];
+  char axis;
+  switch (key) {
+  case 'o':
+    arguments->output = arg;
+    break;
+  case 'f':
+    arguments->field = arg;
+    break;
+  case 'b':
+    if (sscanf(arg, "%llu,%llu,%llu,%llu,%llu,%llu", &values[0], &values[1],
+               &values[2], &values[3], &values[4], &values[5]) != 6)
+      argp_error(state, "malformed box: %s", arg);
+    for (int i = 0; i < DIMENSIONS; i++) {
+      arguments->box[0][i] = values[i];
+      arguments->box[1][i] = values[DIMENSIONS + i];
+    }
+    arguments->box_given = 1;
+    break;
+  case 'p':
+    if (sscanf(arg, "%c=%llu", &axis, &values[0]) != 2 || axis < 'x' ||
+        axis > 'z')
+      argp_error(state, "malformed plane: %s", arg);
+    arguments->plane_axis = axis - 'x';
+    arguments->plane = values[0];
+    break;
+  case 't':
+    arguments->threads = atoi(arg);
+    break;
+  case ARGP_KEY_ARG:
+    if (state->arg_num > 0)
+      argp_usage(state);
+    arguments->input = arg;
+    break;
+  case ARGP_KEY_END:
+    if (arguments->input == NULL)
+      argp_usage(state);
+    break;
+  default:
+    return ARGP_ERR_UNKNOWN;
+  }
+  return 0;
+}
+
+static struct argp argp = {options, parse_opt, "FILE",
+                           "Reads the chunked output FILE of a run"};
+
+static void dc_describe(const dc_chunked_t *chunked) {
+  const dc_chunked_header_t *header = &chunked->header;
+  uint64_t stored = 0, raw = 0;
+  const uint64_t total = chunked->chunks[0] * chunked->chunks[1] *
+                         chunked->chunks[2] * header->fields;
+  for (uint64_t c = 0; c < total; c++)
+    stored += chunked->index[c].bytes;
+  raw = header->sizes[0] * header->sizes[1] * header->sizes[2] *
+        header->fields * sizeof(float);
+  printf("grid: %llu x %llu x %llu cells, %llu of padding on every side\n",
+         (unsigned long long)header->sizes[0],
+         (unsigned long long)header->sizes[1],
+         (unsigned long long)header->sizes[2],
+         (unsigned long long)header->padding);
+  printf("spacing: %g %g %g, dt %g, iteration %llu\n", header->dx, header->dy,
+         header->dz, header->dt, (unsigned long long)header->iteration);
+  printf("fields:");
+  for (uint32_t f = 0; f < header->fields; f++)
+    printf(" %.8s", header->field_names[f]);
+  printf("\nchunks: %llu x %llu x %llu cells, %llu x %llu x %llu of them\n",
+         (unsigned long long)header->chunk[0],
+         (unsigned long long)header->chunk[1],
+         (unsigned long long)header->chunk[2],
+         (unsigned long long)chunked->chunks[0],
+         (unsigned long long)chunked->chunks[1],
+         (unsigned long long)chunked->chunks[2]);
+  printf("codec: %s, %llu bytes stored for %llu (%.2fx)\n",
+         header->codec == DC_CODEC_DEFLATE ? "deflate" : "none",
+         (unsigned long long)stored, (unsigned long long)raw,
+         (double)raw / stored);
+}
+
+int main(int argc, char **argv) {
+  dc_read_arguments_t arguments = {0};
+  arguments.plane_axis = -1;
+  argp_parse(&argp, argc, argv, 0, 0, &arguments);
+  if (arguments.threads > 0)
+    omp_set_num_threads(arguments.threads);
+
+  dc_chunked_t chunked;
+  if (!dc_chunked_open(&chunked, arguments.input)) {
+    fprintf(stderr, "%s is not a chunked output file\n", arguments.input);
+    return 1;
+  }
+  if (arguments.output == NULL) {
+    dc_describe(&chunked);
+    dc_chunked_close(&chunked);
+    return 0;
+  }
+
+  uint64_t lo[DIMENSIONS], hi[DIMENSIONS], count = 1;
+  for (int i = 0; i < DIMENSIONS; i++) {
+    lo[i] = arguments.box_given ? arguments.box[0][i] : 0;
+    hi[i] = arguments.box_given ? arguments.box[1][i]
+                                : chunked.header.sizes[i];
+  }
+  if (arguments.plane_axis >= 0) {
+    lo[arguments.plane_axis] = arguments.plane;
+    hi[arguments.plane_axis] = arguments.plane + 1;
+  }
+  for (int i = 0; i < DIMENSIONS; i++) {
+    if (lo[i] >= hi[i] || hi[i] > chunked.header.sizes[i]) {
+      fprintf(stderr, "The selection must lie within the grid\n");
+      return 1;
+    }
+    count *= hi[i] - lo[i];
+  }
+
+  float *cells = malloc(count * sizeof(float));
+  FILE *output = fopen(arguments.output, "wb");
+  if (cells == NULL || output == NULL) {
+    fprintf(stderr, "Cannot write %s\n", arguments.output);
+    return 1;
+  }
+  int found = 0;
+  for (uint32_t f = 0; f < chunked.header.fields; f++) {
+    if (arguments.field != NULL &&
+        strncmp(arguments.field, chunked.header.field_names[f],
+                sizeof(chunked.header.field_names[f])) != 0)
+      continue;
+    found = 1;
+    if (!dc_chunked_read_box(&chunked, f, lo, hi, cells) ||
+        fwrite(cells, sizeof(float), count, output) != count) {
+      fprintf(stderr, "Cannot copy field %.8s\n",
+              chunked.header.field_names[f]);
+      return 1;
+    }
+  }
+  if (!found) {
+    fprintf(stderr, "No field %s\n", arguments.field);
+    return 1;
+  }
+  fclose(output);
+  free(cells);
+  dc_chunked_close(&chunked);
+  return 0;
+}
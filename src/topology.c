@@ -0,0 +1,255 @@
+#include <mpi.h>
+#include <stdlib.h>
+
+#include "coordinator.h"
+#include "log.h"
+#include "topology.h"
+
+// Computed cells along `axis` for the rank at `coordinate` under an unweighted
+// partition, where the first `computed % parts` slabs take one extra cell
+static size_t dc_partition_extent(size_t global_size, int parts,
+                                  int coordinate) {
+  size_t computed = global_size - 2 * STENCIL;
+  size_t extent = computed / parts;
+  if ((size_t)coordinate < computed % parts)
+    extent++;
+  return extent;
+}
+
+double dc_predict_halo_bytes(const int topology[DIMENSIONS],
+                             const int coordinates[DIMENSIONS],
+                             const size_t global_sizes[DIMENSIONS],
+                             dc_stencil_footprint_t footprint) {
+  size_t extents[DIMENSIONS];
+  for (int i = 0; i < DIMENSIONS; i++) {
+    extents[i] =
+        dc_partition_extent(global_sizes[i], topology[i], coordinates[i]);
+  }
+
+  double cells = 0;
+  for (int face_index = 0; face_index < NEIGHBOURHOOD; face_index++) {
+    int displacement[DIMENSIONS] = {face_index % 3 - 1,
+                                    (face_index % 9) / 3 - 1,
+                                    face_index / 9 - 1};
+    if (face_index == NEIGHBOURHOOD / 2 ||
+        !dc_footprint_reads_region(footprint, displacement[0],
+                                   displacement[1], displacement[2]))
+      continue;
+
+    double region = 1;
+    int exists = 1;
+    for (int i = 0; i < DIMENSIONS; i++) {
+      int target = coordinates[i] + displacement[i];
+      if (target < 0 || target >= topology[i]) {
+        exists = 0;
+        break;
+      }
+      region *= displacement[i] == 0 ? extents[i] : STENCIL;
+    }
+    if (exists)
+      cells += region;
+  }
+  // pp and qp travel together
+  return 2 * cells * sizeof(float);
+}
+
+static double dc_total_halo_bytes(const int topology[DIMENSIONS],
+                                  const size_t global_sizes[DIMENSIONS],
+                                  dc_stencil_footprint_t footprint,
+                                  double *max_bytes) {
+  double total = 0;
+  *max_bytes = 0;
+  int coordinates[DIMENSIONS];
+  for (coordinates[0] = 0; coordinates[0] < topology[0]; coordinates[0]++) {
+    for (coordinates[1] = 0; coordinates[1] < topology[1]; coordinates[1]++) {
+      for (coordinates[2] = 0; coordinates[2] < topology[2];
+           coordinates[2]++) {
+        double bytes = dc_predict_halo_bytes(topology, coordinates,
+                                             global_sizes, footprint);
+        total += bytes;
+        if (bytes > *max_bytes)
+          *max_bytes = bytes;
+      }
+    }
+  }
+  return total;
+}
+
+void dc_select_topology(int num_processes,
+                        const size_t global_sizes[DIMENSIONS],
+                        dc_stencil_footprint_t footprint,
+                        int topology[DIMENSIONS]) {
+  int best[DIMENSIONS] = {0};
+  double best_total = 0, best_max = 0;
+  int best_fits = 0;
+
+  for (int px = 1; px <= num_processes; px++) {
+    if (num_processes % px != 0)
+      continue;
+    for (int py = 1; py <= num_processes / px; py++) {
+      if ((num_processes / px) % py != 0)
+        continue;
+      int candidate[DIMENSIONS] = {px, py, num_processes / px / py};
+
+      // Every rank must compute at least STENCIL cells per axis so that its
+      // boundary regions do not overlap its ghosts
+      int fits = 1;
+      for (int i = 0; i < DIMENSIONS; i++) {
+        if ((global_sizes[i] - 2 * STENCIL) / candidate[i] < STENCIL)
+          fits = 0;
+      }
+
+      double max_bytes;
+      double total =
+          dc_total_halo_bytes(candidate, global_sizes, footprint, &max_bytes);
+      int better = best[0] == 0 || fits > best_fits ||
+                   (fits == best_fits &&
+                    (total < best_total ||
+                     (total == best_total && max_bytes < best_max)));
+      if (better) {
+        for (int i = 0; i < DIMENSIONS; i++)
+          best[i] = candidate[i];
+        best_total = total;
+        best_max = max_bytes;
+        best_fits = fits;
+      }
+    }
+  }
+
+  for (int i = 0; i < DIMENSIONS; i++)
+    topology[i] = best[i];
+
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  if (rank == COORDINATOR) {
+    dc_log_info(rank,
+                "Selected topology %d x %d x %d: predicted halo %.0f bytes per "
+                "rank per iteration on average, %.0f at most",
+                topology[0], topology[1], topology[2],
+                best_total / num_processes, best_max);
+    if (!best_fits) {
+      dc_log_error(rank, "Some ranks compute fewer than %d cells along an "
+                         "axis; halo regions will overlap",
+                   STENCIL);
+    }
+  }
+}
+
+// Halo bytes crossing node boundaries when the process grid is tiled with
+// blocks of `block` ranks, one block per node
+static double dc_inter_node_bytes(const int topology[DIMENSIONS],
+                                  const int block[DIMENSIONS],
+                                  const size_t global_sizes[DIMENSIONS]) {
+  double bytes = 0;
+  for (int axis = 0; axis < DIMENSIONS; axis++) {
+    // Each cut between blocks along `axis` carries a full plane of STENCIL
+    // cells both ways
+    int cuts = topology[axis] / block[axis] - 1;
+    double plane = STENCIL;
+    for (int i = 0; i < DIMENSIONS; i++) {
+      if (i != axis)
+        plane *= global_sizes[i] - 2 * STENCIL;
+    }
+    bytes += 2.0 * cuts * plane;
+  }
+  return bytes;
+}
+
+int dc_node_aware_rank_key(MPI_Comm world, const int topology[DIMENSIONS],
+                           const size_t global_sizes[DIMENSIONS]) {
+  int world_rank, world_size;
+  MPI_Comm_rank(world, &world_rank);
+  MPI_Comm_size(world, &world_size);
+
+  MPI_Comm node_comm;
+  MPI_Comm_split_type(world, MPI_COMM_TYPE_SHARED, world_rank,
+                      MPI_INFO_NULL, &node_comm);
+  int node_rank, node_size;
+  MPI_Comm_rank(node_comm, &node_rank);
+  MPI_Comm_size(node_comm, &node_size);
+  // Nodes are identified by the world rank of their first member
+  int leader = world_rank;
+  MPI_Bcast(&leader, 1, MPI_INT, 0, node_comm);
+  MPI_Comm_free(&node_comm);
+
+  int local[3] = {leader, node_rank, node_size};
+  int *all = malloc(3 * world_size * sizeof(int));
+  if (all == NULL) {
+    dc_log_error(world_rank, "OOM: could not allocate memory for node layout "
+                             "in dc_node_aware_rank_key");
+    MPI_Finalize();
+    exit(1);
+  }
+  MPI_Allgather(local, 3, MPI_INT, all, 3, MPI_INT, world);
+
+  // Blocking only works when every node hosts the same number of ranks
+  int uniform = 1;
+  for (int i = 0; i < world_size; i++) {
+    if (all[3 * i + 2] != node_size)
+      uniform = 0;
+  }
+  // Index of our node among all nodes, ordered by leader
+  int node_index = 0;
+  for (int i = 0; i < world_size; i++) {
+    if (all[3 * i + 1] == 0 && all[3 * i] < leader)
+      node_index++;
+  }
+  free(all);
+
+  if (!uniform || node_size == 1 || node_size == world_size)
+    return world_rank;
+
+  int block[DIMENSIONS] = {0};
+  double best_bytes = 0;
+  for (int bx = 1; bx <= node_size; bx++) {
+    if (node_size % bx != 0 || topology[0] % bx != 0)
+      continue;
+    for (int by = 1; by <= node_size / bx; by++) {
+      int bz = node_size / bx / by;
+      if ((node_size / bx) % by != 0 || topology[1] % by != 0 ||
+          topology[2] % bz != 0)
+        continue;
+      int candidate[DIMENSIONS] = {bx, by, bz};
+      double bytes = dc_inter_node_bytes(topology, candidate, global_sizes);
+      if (block[0] == 0 || bytes < best_bytes) {
+        for (int i = 0; i < DIMENSIONS; i++)
+          block[i] = candidate[i];
+        best_bytes = bytes;
+      }
+    }
+  }
+
+  if (block[0] == 0) {
+    if (world_rank == COORDINATOR) {
+      dc_log_info(world_rank, "No %d-rank block tiles the %d x %d x %d "
+                              "topology, keeping MPI rank order",
+                  node_size, topology[0], topology[1], topology[2]);
+    }
+    return world_rank;
+  }
+
+  // The node's block in the grid of blocks, then our place inside it
+  int blocks[DIMENSIONS] = {topology[0] / block[0], topology[1] / block[1],
+                            topology[2] / block[2]};
+  int block_coordinates[DIMENSIONS] = {
+      node_index / (blocks[1] * blocks[2]), (node_index / blocks[2]) % blocks[1],
+      node_index % blocks[2]};
+  int inner[DIMENSIONS] = {node_rank / (block[1] * block[2]),
+                           (node_rank / block[2]) % block[1],
+                           node_rank % block[2]};
+  int coordinates[DIMENSIONS];
+  for (int i = 0; i < DIMENSIONS; i++) {
+    coordinates[i] = block_coordinates[i] * block[i] + inner[i];
+  }
+
+  if (world_rank == COORDINATOR) {
+    dc_log_info(world_rank,
+                "Placing %d x %d x %d rank blocks on each node: predicted "
+                "inter-node halo %.0f bytes per iteration",
+                block[0], block[1], block[2],
+                2 * best_bytes * sizeof(float));
+  }
+  // MPI_Cart_create numbers ranks in row-major order of their coordinates
+  return (coordinates[0] * topology[1] + coordinates[1]) * topology[2] +
+         coordinates[2];
+}
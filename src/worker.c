@@ -1,7 +1,9 @@
 #include "bits/types/struct_timeval.h"
+#include "balance.h"
 #include "boundary.h"
 #include "dc_process.h"
 #include "definitions.h"
+#include "halo.h"
 #include "precomp.h"
 #include <math.h>
 #include <mpi.h>
@@ -15,31 +17,48 @@
 #include "device_data.h"
 #include "indexing.h"
 #include "log.h"
+#include "materials.h"
+#include "model_cache.h"
 #include "propagate.h"
+#include "setup.h"
 #include "sys/time.h"
+#include "snapshot.h"
+#include "temporal.h"
 #include "worker.h"
 
 #ifdef SIMGRID
 #include <smpi/smpi.h>
 #endif
 
-void dc_worker_init_from_partition_info(dc_process_t *process, MPI_Comm comm) {
-  dc_partition_info_t info;
-  MPI_Recv(&info, sizeof(dc_partition_info_t), MPI_BYTE, COORDINATOR, 0, comm,
-           MPI_STATUS_IGNORE);
-
-  process->sizes[0] = info.local_sizes[0];
-  process->sizes[1] = info.local_sizes[1];
-  process->sizes[2] = info.local_sizes[2];
-  process->iterations = info.iterations;
-  process->source_index = info.source_index;
+void dc_worker_init(dc_process_t *process, const dc_partition_t *partition,
+                    dc_arguments_t arguments) {
+  size_t global_sizes[DIMENSIONS] = {
+      arguments.size_x + 2 * arguments.absorption_size + 2 * STENCIL,
+      arguments.size_y + 2 * arguments.absorption_size + 2 * STENCIL,
+      arguments.size_z + 2 * arguments.absorption_size + 2 * STENCIL};
+  dc_partition_local(partition, process->coordinates, process->sizes,
+                     process->start_coords);
+  memcpy(process->global_sizes, global_sizes, sizeof(global_sizes));
+  if (arguments.sponge && !dc_device_sponge()) {
+    dc_log_error(process->rank, "This backend cannot apply a sponge, using "
+                                "random velocities in the absorbing zone");
+  } else if (arguments.sponge) {
+    process->sponge_width = arguments.absorption_size;
+  }
+  process->iterations = ceil(arguments.time_max / arguments.dt);
+  process->source_index = dc_local_source_index(
+      global_sizes, process->sizes, process->start_coords);
+
+  if (!dc_local_offsets_fit(process->sizes)) {
+    dc_log_error(process->rank,
+                 "Planes of %zu x %zu cells are too large for 32-bit kernel "
+                 "offsets",
+                 process->sizes[0], process->sizes[1]);
+    MPI_Finalize();
+    exit(1);
+  }
 
   size_t count = dc_compute_count_from_sizes(process->sizes);
-  dc_log_info(process->rank,
-              "Received partition info: local %zux%zux%zu, global %zux%zux%zu",
-              info.local_sizes[0], info.local_sizes[1], info.local_sizes[2],
-              info.global_sizes[0], info.global_sizes[1], info.global_sizes[2]);
-
   process->pp = (float *)calloc(count, sizeof(float));
   process->pc = (float *)calloc(count, sizeof(float));
   process->qp = (float *)calloc(count, sizeof(float));
@@ -51,122 +70,65 @@ void dc_worker_init_from_partition_info(dc_process_t *process, MPI_Comm comm) {
     exit(1);
   }
 
-  size_t sx = info.local_sizes[0];
-  size_t sy = info.local_sizes[1];
-  size_t sz = info.local_sizes[2];
-
-  process->anisotropy_vars.vpz = (float *)malloc(count * sizeof(float));
-  process->anisotropy_vars.vsv = (float *)malloc(count * sizeof(float));
-  process->anisotropy_vars.epsilon = (float *)malloc(count * sizeof(float));
-  process->anisotropy_vars.delta = (float *)malloc(count * sizeof(float));
-  process->anisotropy_vars.phi = (float *)malloc(count * sizeof(float));
-  process->anisotropy_vars.theta = (float *)malloc(count * sizeof(float));
-  if (process->anisotropy_vars.vpz == NULL ||
-      process->anisotropy_vars.vsv == NULL ||
-      process->anisotropy_vars.epsilon == NULL ||
-      process->anisotropy_vars.delta == NULL ||
-      process->anisotropy_vars.phi == NULL ||
-      process->anisotropy_vars.theta == NULL) {
-    dc_log_error(process->rank, "OOM: could not allocate anisotropy arrays");
-    MPI_Finalize();
-    exit(1);
+  dc_model_key_t key = {
+      {arguments.size_x, arguments.size_y, arguments.size_z},
+      arguments.absorption_size,
+      process->sponge_width,
+      {process->start_coords[0], process->start_coords[1],
+       process->start_coords[2]},
+      {process->sizes[0], process->sizes[1], process->sizes[2]}};
+  if (arguments.model_cache == NULL ||
+      !dc_model_cache_load(process, arguments.model_cache, &key)) {
+    process->anisotropy_vars = dc_compute_anisotropy_vars(
+        process->sizes[0], process->sizes[1], process->sizes[2]);
+    unsigned int seed = 0;
+    if (process->sponge_width == 0)
+      randomVelocityBoundaryPartition(
+          process->sizes[0], process->sizes[1], process->sizes[2], // Local
+          global_sizes[0], global_sizes[1], global_sizes[2],       // Global
+          process->start_coords[0], process->start_coords[1],
+          process->start_coords[2], // Start coords
+          arguments.size_x, arguments.size_y, arguments.size_z, // Problem
+          STENCIL, arguments.absorption_size, process->anisotropy_vars.vpz,
+          process->anisotropy_vars.vsv, &seed);
+    process->precomp_vars =
+        dc_compute_precomp_vars(process->sizes[0], process->sizes[1],
+                                process->sizes[2], process->anisotropy_vars);
+    if (arguments.model_cache != NULL)
+      dc_model_cache_store(process, arguments.model_cache, &key);
   }
 
-  // Initialize anisotropy with default values
-  for (size_t i = 0; i < count; i++) {
-    process->anisotropy_vars.vpz[i] = 3000.0f;
-    process->anisotropy_vars.epsilon[i] = 0.24f;
-    process->anisotropy_vars.delta[i] = 0.1f;
-    process->anisotropy_vars.phi[i] = 1.0f;
-    process->anisotropy_vars.theta[i] = atanf(1.0);
-    if (SIGMA > MAX_SIGMA) {
-      process->anisotropy_vars.vsv[i] = 0.0f;
-    } else {
-      process->anisotropy_vars.vsv[i] =
-          process->anisotropy_vars.vpz[i] *
-          sqrtf(fabsf(process->anisotropy_vars.epsilon[i] -
-                      process->anisotropy_vars.delta[i]) /
-                SIGMA);
+  if (arguments.materials != 0 && !dc_device_material_tables()) {
+    dc_log_error(process->rank,
+                 "This backend cannot read a material table, keeping the "
+                 "per-cell model");
+  } else if (arguments.materials != 0) {
+    if (process->rebalance_interval != 0) {
+      // Migration moves the per-cell model, which the table replaces
+      dc_log_error(process->rank,
+                   "Rebalancing needs the per-cell model, disabling it");
+      process->rebalance_interval = 0;
     }
+    dc_materials_build(process, arguments.materials);
   }
 
-  unsigned int seed = 0;
-  randomVelocityBoundaryPartition(sx, sy, sz, // Local sizes
-                                  info.global_sizes[0], info.global_sizes[1],
-                                  info.global_sizes[2], // Global sizes
-                                  info.start_coords[0], info.start_coords[1],
-                                  info.start_coords[2], // Start coords
-                                  info.problem_sizes[0], info.problem_sizes[1],
-                                  info.problem_sizes[2], // Problem sizes
-                                  STENCIL, info.absorption_size,
-                                  process->anisotropy_vars.vpz,
-                                  process->anisotropy_vars.vsv, &seed);
-
-  process->precomp_vars.ch1dxx = (float *)malloc(count * sizeof(float));
-  process->precomp_vars.ch1dyy = (float *)malloc(count * sizeof(float));
-  process->precomp_vars.ch1dzz = (float *)malloc(count * sizeof(float));
-  process->precomp_vars.ch1dxy = (float *)malloc(count * sizeof(float));
-  process->precomp_vars.ch1dyz = (float *)malloc(count * sizeof(float));
-  process->precomp_vars.ch1dxz = (float *)malloc(count * sizeof(float));
-  process->precomp_vars.v2px = (float *)malloc(count * sizeof(float));
-  process->precomp_vars.v2pz = (float *)malloc(count * sizeof(float));
-  process->precomp_vars.v2sz = (float *)malloc(count * sizeof(float));
-  process->precomp_vars.v2pn = (float *)malloc(count * sizeof(float));
-  if (process->precomp_vars.ch1dxx == NULL ||
-      process->precomp_vars.ch1dyy == NULL ||
-      process->precomp_vars.ch1dzz == NULL ||
-      process->precomp_vars.ch1dxy == NULL ||
-      process->precomp_vars.ch1dyz == NULL ||
-      process->precomp_vars.ch1dxz == NULL ||
-      process->precomp_vars.v2px == NULL ||
-      process->precomp_vars.v2pz == NULL ||
-      process->precomp_vars.v2sz == NULL ||
-      process->precomp_vars.v2pn == NULL) {
-    dc_log_error(process->rank, "OOM: could not allocate precomp_vars");
-    MPI_Finalize();
-    exit(1);
-  }
-
-  for (size_t i = 0; i < count; i++) {
-    float sinTheta = sin(process->anisotropy_vars.theta[i]);
-    float cosTheta = cos(process->anisotropy_vars.theta[i]);
-    float sin2Theta = sin(2.0 * process->anisotropy_vars.theta[i]);
-    float sinPhi = sin(process->anisotropy_vars.phi[i]);
-    float cosPhi = cos(process->anisotropy_vars.phi[i]);
-    float sin2Phi = sin(2.0 * process->anisotropy_vars.phi[i]);
-
-    process->precomp_vars.ch1dxx[i] = sinTheta * sinTheta * cosPhi * cosPhi;
-    process->precomp_vars.ch1dyy[i] = sinTheta * sinTheta * sinPhi * sinPhi;
-    process->precomp_vars.ch1dzz[i] = cosTheta * cosTheta;
-    process->precomp_vars.ch1dxy[i] = sinTheta * sinTheta * sin2Phi;
-    process->precomp_vars.ch1dyz[i] = sin2Theta * sinPhi;
-    process->precomp_vars.ch1dxz[i] = sin2Theta * cosPhi;
-
-    process->precomp_vars.v2sz[i] =
-        process->anisotropy_vars.vsv[i] * process->anisotropy_vars.vsv[i];
-    process->precomp_vars.v2pz[i] =
-        process->anisotropy_vars.vpz[i] * process->anisotropy_vars.vpz[i];
-    process->precomp_vars.v2px[i] =
-        process->precomp_vars.v2pz[i] *
-        (1.0 + 2.0 * process->anisotropy_vars.epsilon[i]);
-    process->precomp_vars.v2pn[i] =
-        process->precomp_vars.v2pz[i] *
-        (1.0 + 2.0 * process->anisotropy_vars.delta[i]);
-  }
-
-  dc_log_info(process->rank, "Local initialization complete");
+  dc_log_info(process->rank,
+              "Initialized locally with sizes %zu x %zu x %zu from %zu %zu %zu",
+              process->sizes[0], process->sizes[1], process->sizes[2],
+              process->start_coords[0], process->start_coords[1],
+              process->start_coords[2]);
 }
 
-void dc_send_halo_to_neighbours(dc_process_t process, MPI_Comm comm, int tag,
-                                dc_device_data *data, float *from,
-                                worker_requests_t *requests) {
+void dc_send_halo_to_neighbours(dc_process_t *process, MPI_Comm comm, int tag,
+                                dc_device_data *data, float *from_p,
+                                float *from_q, worker_requests_t *requests) {
   worker_requests_t reqs;
   size_t radius = STENCIL;
 
   reqs.count = 0;
   reqs.requests = malloc(NEIGHBOURHOOD * sizeof(MPI_Request));
   if (reqs.requests == NULL) {
-    dc_log_error(process.rank,
+    dc_log_error(process->rank,
                  "OOM: could not allocate memory for reqs.requests in "
                  "dc_send_halo_to_neighbours");
     MPI_Finalize();
@@ -174,7 +136,7 @@ void dc_send_halo_to_neighbours(dc_process_t process, MPI_Comm comm, int tag,
   }
   reqs.buffers_to_free = malloc(NEIGHBOURHOOD * sizeof(void *));
   if (reqs.buffers_to_free == NULL) {
-    dc_log_error(process.rank,
+    dc_log_error(process->rank,
                  "OOM: could not allocate memory for reqs.buffers_to_free in "
                  "dc_send_halo_to_neighbours");
     MPI_Finalize();
@@ -182,9 +144,9 @@ void dc_send_halo_to_neighbours(dc_process_t process, MPI_Comm comm, int tag,
   }
 
   for (size_t face_index = 0; face_index < NEIGHBOURHOOD; face_index++) {
-    int neighbour_rank = process.neighbours[face_index];
-    if (neighbour_rank == MPI_PROC_NULL)
+    if (!dc_halo_region_messaged(process, face_index))
       continue;
+    int neighbour_rank = process->neighbours[face_index];
     int dz = face_index / 9;
     int dy = (face_index % 9) / 3;
     int dx = face_index % 3;
@@ -198,58 +160,62 @@ void dc_send_halo_to_neighbours(dc_process_t process, MPI_Comm comm, int tag,
       send_starts[0] = radius;
       send_ends[0] = 2 * radius;
     } else if (dx == 1) {
-      send_starts[0] = process.sizes[0] - 2 * radius;
-      send_ends[0] = process.sizes[0] - radius;
+      send_starts[0] = process->sizes[0] - 2 * radius;
+      send_ends[0] = process->sizes[0] - radius;
     } else {
       send_starts[0] = radius;
-      send_ends[0] = process.sizes[0] - radius;
+      send_ends[0] = process->sizes[0] - radius;
     }
 
     if (dy == -1) {
       send_starts[1] = radius;
       send_ends[1] = 2 * radius;
     } else if (dy == 1) {
-      send_starts[1] = process.sizes[1] - 2 * radius;
-      send_ends[1] = process.sizes[1] - radius;
+      send_starts[1] = process->sizes[1] - 2 * radius;
+      send_ends[1] = process->sizes[1] - radius;
     } else {
       send_starts[1] = radius;
-      send_ends[1] = process.sizes[1] - radius;
+      send_ends[1] = process->sizes[1] - radius;
     }
 
     if (dz == -1) {
       send_starts[2] = radius;
       send_ends[2] = 2 * radius;
     } else if (dz == 1) {
-      send_starts[2] = process.sizes[2] - 2 * radius;
-      send_ends[2] = process.sizes[2] - radius;
+      send_starts[2] = process->sizes[2] - 2 * radius;
+      send_ends[2] = process->sizes[2] - radius;
     } else {
       send_starts[2] = radius;
-      send_ends[2] = process.sizes[2] - radius;
+      send_ends[2] = process->sizes[2] - radius;
     }
 
     size_t data_size = (send_ends[0] - send_starts[0]) *
                        (send_ends[1] - send_starts[1]) *
                        (send_ends[2] - send_starts[2]);
 
-    float *send_buffer = malloc(data_size * sizeof(float));
+    float *send_buffer = malloc(HALO_FIELDS * data_size * sizeof(float));
     if (send_buffer == NULL) {
-      dc_log_error(process.rank,
+      dc_log_error(process->rank,
                    "OOM: could not allocate memory for send_buffer in "
                    "dc_send_halo_to_neighbours");
       MPI_Finalize();
       exit(1);
     }
     dc_device_extract_halo_face(data, send_buffer, send_starts, send_ends,
-                                process.sizes, from);
+                                process->sizes, from_p);
+    dc_device_extract_halo_face(data, send_buffer + data_size, send_starts,
+                                send_ends, process->sizes, from_q);
     reqs.buffers_to_free[reqs.count] = send_buffer;
-    MPI_Isend(send_buffer, data_size, MPI_FLOAT, neighbour_rank, tag, comm,
-              &reqs.requests[reqs.count]);
+    MPI_Isend(send_buffer, HALO_FIELDS * data_size, MPI_FLOAT, neighbour_rank,
+              tag, comm, &reqs.requests[reqs.count]);
     reqs.count++;
+    process->halo_stats.messages_sent++;
+    process->halo_stats.bytes_sent += HALO_FIELDS * data_size * sizeof(float);
   }
-  dc_concatenate_worker_requests(process.rank, requests, &reqs);
+  dc_concatenate_worker_requests(process->rank, requests, &reqs);
 }
 
-worker_halos_t dc_receive_halos(dc_process_t process, MPI_Comm comm, int tag) {
+worker_halos_t dc_receive_halos(dc_process_t *process, MPI_Comm comm, int tag) {
   worker_halos_t result;
   size_t radius = STENCIL;
   result.halo_count = 0;
@@ -258,7 +224,7 @@ worker_halos_t dc_receive_halos(dc_process_t process, MPI_Comm comm, int tag) {
   result.requests.requests = malloc(NEIGHBOURHOOD * sizeof(MPI_Request));
   if (result.requests.requests == NULL) {
     dc_log_error(
-        process.rank,
+        process->rank,
         "OOM: could not allocate memory for requests in dc_receive_halos");
     MPI_Finalize();
     exit(1);
@@ -268,7 +234,7 @@ worker_halos_t dc_receive_halos(dc_process_t process, MPI_Comm comm, int tag) {
   result.halo_sizes = calloc(NEIGHBOURHOOD, sizeof(size_t));
   if (result.halo_sizes == NULL) {
     dc_log_error(
-        process.rank,
+        process->rank,
         "OOM: could not allocate memory for halo_sizes in dc_receive_halos");
     MPI_Finalize();
     exit(1);
@@ -276,16 +242,16 @@ worker_halos_t dc_receive_halos(dc_process_t process, MPI_Comm comm, int tag) {
   result.halo_data = calloc(NEIGHBOURHOOD, sizeof(float *));
   if (result.halo_data == NULL) {
     dc_log_error(
-        process.rank,
+        process->rank,
         "OOM: could not allocate memory for halo_data in dc_receive_halos");
     MPI_Finalize();
     exit(1);
   }
 
   for (size_t face_index = 0; face_index < NEIGHBOURHOOD; face_index++) {
-    int neighbour_rank = process.neighbours[face_index];
-    if (neighbour_rank == MPI_PROC_NULL)
+    if (!dc_halo_region_messaged(process, face_index))
       continue;
+    int neighbour_rank = process->neighbours[face_index];
     int dz = face_index / 9;
     int dy = (face_index % 9) / 3;
     int dx = face_index % 3;
@@ -294,26 +260,30 @@ worker_halos_t dc_receive_halos(dc_process_t process, MPI_Comm comm, int tag) {
     size_t recv_data_size = 1;
     for (unsigned int i = 0; i < DIMENSIONS; i++) {
       if (displacement[i] == 0) {
-        recv_data_size *= process.sizes[i] - 2 * radius;
+        recv_data_size *= process->sizes[i] - 2 * radius;
       } else {
         recv_data_size *= radius;
       }
     }
     result.halo_sizes[face_index] = recv_data_size;
-    result.halo_data[face_index] = malloc(recv_data_size * sizeof(float));
+    result.halo_data[face_index] =
+        malloc(HALO_FIELDS * recv_data_size * sizeof(float));
     if (result.halo_data[face_index] == NULL) {
-      dc_log_error(process.rank, "OOM: could not allocate memory for "
+      dc_log_error(process->rank, "OOM: could not allocate memory for "
                                  "halo_data[face_index] in dc_receive_halos");
       MPI_Finalize();
       exit(1);
     }
 
-    MPI_Irecv(result.halo_data[face_index], recv_data_size, MPI_FLOAT,
-              neighbour_rank, tag, comm,
+    MPI_Irecv(result.halo_data[face_index], HALO_FIELDS * recv_data_size,
+              MPI_FLOAT, neighbour_rank, tag, comm,
               &result.requests.requests[result.requests.count]);
 
     result.halo_count++;
     result.requests.count++;
+    process->halo_stats.messages_received++;
+    process->halo_stats.bytes_received +=
+        HALO_FIELDS * recv_data_size * sizeof(float);
   }
   return result;
 }
@@ -408,10 +378,12 @@ void dc_send_data_to_coordinator(dc_process_t process, MPI_Comm comm) {
   return;
 #endif
   MPI_Send(process.sizes, DIMENSIONS, MPI_UNSIGNED_LONG, COORDINATOR, 0, comm);
-  MPI_Send(process.pc, dc_compute_count_from_sizes(process.sizes), MPI_FLOAT,
-           COORDINATOR, 0, comm);
-  MPI_Send(process.qc, dc_compute_count_from_sizes(process.sizes), MPI_FLOAT,
-           COORDINATOR, 0, comm);
+  MPI_Send(process.start_coords, DIMENSIONS, MPI_UNSIGNED_LONG, COORDINATOR, 0,
+           comm);
+  dc_send_floats(process.pc, dc_compute_count_from_sizes(process.sizes),
+                 COORDINATOR, comm);
+  dc_send_floats(process.qc, dc_compute_count_from_sizes(process.sizes),
+                 COORDINATOR, comm);
 }
 
 double get_time_micros() {
@@ -453,9 +425,27 @@ double dc_worker_process(dc_process_t *process, MPI_Comm comm) {
               process->iterations, process->sizes[0], process->sizes[1],
               process->sizes[2]);
 
-  dc_device_data *data = dc_device_data_init(process);
-
-  worker_requests_t all_send_requests = {0};
+  // Temporal blocking exchanges its own deep halos and runs the kernels on
+  // its extended box
+  dc_halo_exchange_t exchange = {0};
+  dc_temporal_t temporal = {0};
+  const int blocking = process->temporal_steps > 1;
+  if (blocking)
+    dc_temporal_init(&temporal, process, comm);
+  else
+    dc_halo_exchange_init(&exchange, process, comm);
+  dc_process_t *kernel_process = blocking ? &temporal.extended : process;
+
+  dc_device_data *data = dc_device_data_init(kernel_process);
+  if (process->layout == DC_LAYOUT_FLAT && !process->uniform_tiles &&
+      dc_propagate_specialized(kernel_process->sizes))
+    dc_log_info(process->rank, "Using the kernel built for %zu x %zu x %zu",
+                kernel_process->sizes[0], kernel_process->sizes[1],
+                kernel_process->sizes[2]);
+
+  dc_balance_t balance = {0};
+  if (process->rebalance_interval != 0)
+    dc_balance_init(&balance, comm);
 
   double start_time = MPI_Wtime();
 
@@ -464,54 +454,92 @@ double dc_worker_process(dc_process_t *process, MPI_Comm comm) {
   double average = -1;
 
   for (unsigned int i = 0; i < process->iterations; i++) {
+    if (blocking) {
+      unsigned int steps = process->iterations - i < process->temporal_steps
+                               ? process->iterations - i
+                               : process->temporal_steps;
+      // Blocks end on snapshots
+      if (process->snapshot_interval != 0 &&
+          process->snapshot_interval - i % process->snapshot_interval < steps)
+        steps = process->snapshot_interval - i % process->snapshot_interval;
+      dc_temporal_advance(&temporal, process, data, comm, i, steps);
+      i += steps - 1;
+      if (dc_snapshot_due(process, i + 1)) {
+        double snapshot_start = MPI_Wtime();
+        dc_temporal_get_results(&temporal, process, data);
+        dc_snapshot_write(process, i + 1);
+        dc_temporal_release_results(process);
+        process->snapshot_seconds += MPI_Wtime() - snapshot_start;
+      }
+      continue;
+    }
+
+    double compute_start = MPI_Wtime();
     if (process->source_index != -1) {
       float source = dc_calculate_source(process->dt, i);
       dc_device_add_source(data, process->source_index, source);
     }
+    double compute_seconds = MPI_Wtime() - compute_start;
 
-    worker_halos_t new_pp_halos = dc_receive_halos(*process, comm, PP_TAG);
-    worker_halos_t new_qp_halos = dc_receive_halos(*process, comm, QP_TAG);
+    dc_halo_exchange_post(&exchange, process, comm, data);
 
+    compute_start = MPI_Wtime();
 #ifdef SIMGRID
     sampled_computation(&average, &count, &stopped, process, data,
                         dc_compute_boundaries);
 #else
     dc_compute_boundaries(process, data);
 #endif
+    compute_seconds += MPI_Wtime() - compute_start;
 
-    dc_send_halo_to_neighbours(*process, comm, PP_TAG, data, data->pp,
-                               &all_send_requests);
-    dc_send_halo_to_neighbours(*process, comm, QP_TAG, data, data->qp,
-                               &all_send_requests);
+    dc_halo_exchange_start(&exchange, process, comm, data);
 
+    compute_start = MPI_Wtime();
 #ifdef SIMGRID
     sampled_computation(&average, &count, &stopped, process, data,
                         dc_compute_interior);
 #else
     dc_compute_interior(process, data);
 #endif
+    compute_seconds += MPI_Wtime() - compute_start;
 
-    dc_concatenate_worker_requests(process->rank, &new_pp_halos.requests,
-                                   &new_qp_halos.requests);
-
-    MPI_Waitall(new_pp_halos.requests.count, new_pp_halos.requests.requests,
-                MPI_STATUSES_IGNORE);
-
-    dc_worker_insert_halos(process, &new_pp_halos, data, data->pp);
-    dc_worker_insert_halos(process, &new_qp_halos, data, data->qp);
-
-    dc_free_worker_halos(&new_pp_halos);
-    dc_free_worker_halos(&new_qp_halos);
+    dc_halo_exchange_finish(&exchange, process, comm, data);
 
     dc_device_swap_arrays(data);
 
-    MPI_Waitall(all_send_requests.count, all_send_requests.requests,
-                MPI_STATUSES_IGNORE);
-    dc_free_worker_requests(&all_send_requests);
+    if (dc_snapshot_due(process, i + 1))
+      dc_snapshot_take(process, data, i + 1);
+
+    if (process->rebalance_interval == 0)
+      continue;
+    balance.compute_seconds += compute_seconds;
+    if ((i + 1) % process->rebalance_interval != 0 ||
+        i + 1 == process->iterations)
+      continue;
+    if (dc_balance_check(&balance, process, comm, i + 1)) {
+      // The exchange and device data are sized for the old slabs
+      dc_device_data_get_results(process, data);
+      dc_device_data_free(data);
+      dc_halo_exchange_free(&exchange, process);
+      dc_balance_migrate(&balance, process, comm);
+      dc_halo_exchange_init(&exchange, process, comm);
+      data = dc_device_data_init(process);
+    }
   }
 
-  dc_device_data_get_results(process, data);
+  if (blocking)
+    dc_temporal_get_results(&temporal, process, data);
+  else
+    dc_device_data_get_results(process, data);
   dc_device_data_free(data);
+  if (blocking)
+    dc_temporal_free(&temporal);
+  else
+    dc_halo_exchange_free(&exchange, process);
+  if (process->rebalance_interval != 0)
+    dc_balance_free(&balance);
+
+  dc_log_halo_stats(process);
 
   double end_time = MPI_Wtime();
   double elapsed = end_time - start_time;
@@ -524,6 +552,61 @@ double dc_worker_process(dc_process_t *process, MPI_Comm comm) {
   return msamples / elapsed;
 }
 
+double dc_worker_calibrate(const dc_process_t *process) {
+  dc_process_t sample = *process;
+  for (int i = 0; i < DIMENSIONS; i++)
+    sample.sizes[i] = CALIBRATION_SIZE + 2 * STENCIL;
+  sample.iterations = CALIBRATION_ITERATIONS;
+  sample.source_index = -1;
+  sample.material_ids = NULL;
+
+  size_t count = dc_compute_count_from_sizes(sample.sizes);
+  sample.pp = (float *)calloc(count, sizeof(float));
+  sample.pc = (float *)calloc(count, sizeof(float));
+  sample.qp = (float *)calloc(count, sizeof(float));
+  sample.qc = (float *)calloc(count, sizeof(float));
+  if (sample.pp == NULL || sample.pc == NULL || sample.qp == NULL ||
+      sample.qc == NULL) {
+    dc_log_error(process->rank, "OOM: could not allocate calibration arrays");
+    MPI_Finalize();
+    exit(1);
+  }
+  sample.anisotropy_vars = dc_compute_anisotropy_vars(
+      sample.sizes[0], sample.sizes[1], sample.sizes[2]);
+  sample.precomp_vars =
+      dc_compute_precomp_vars(sample.sizes[0], sample.sizes[1],
+                              sample.sizes[2], sample.anisotropy_vars);
+
+  dc_device_data *data = dc_device_data_init(&sample);
+  // One untimed iteration so first-touch and device warm-up stay out of the
+  // measurement
+  dc_compute_boundaries(&sample, data);
+  dc_compute_interior(&sample, data);
+  dc_device_swap_arrays(data);
+
+  double start_time = MPI_Wtime();
+  for (unsigned int i = 0; i < sample.iterations; i++) {
+    dc_compute_boundaries(&sample, data);
+    dc_compute_interior(&sample, data);
+    dc_device_swap_arrays(data);
+  }
+  dc_device_data_get_results(&sample, data);
+  double elapsed = MPI_Wtime() - start_time;
+  dc_device_data_free(data);
+
+  free(sample.pp);
+  free(sample.pc);
+  free(sample.qp);
+  free(sample.qc);
+  dc_free_anisotropy_vars(&sample.anisotropy_vars);
+  dc_free_precomp_vars(&sample.precomp_vars);
+
+  double msamples = (double)CALIBRATION_SIZE * CALIBRATION_SIZE *
+                    CALIBRATION_SIZE * sample.iterations / 1000000.0;
+  dc_log_info(process->rank, "Calibration: %lf msamples/s", msamples / elapsed);
+  return msamples / elapsed;
+}
+
 void dc_free_worker_requests(worker_requests_t *requests) {
   if (requests->buffers_to_free != NULL) {
     for (size_t i = 0; i < requests->count; i++) {
@@ -564,9 +647,6 @@ void dc_worker_free(dc_process_t process) {
   free(process.pc);
   free(process.qp);
   free(process.qc);
-
-  free(process.hostnames);
-  process.hostnames = NULL;
 }
 
 void dc_concatenate_worker_requests(int rank, worker_requests_t *target,
@@ -656,7 +736,7 @@ void dc_worker_swap_arrays(dc_process_t *process) {
 
 void dc_worker_insert_halos(const dc_process_t *process,
                             const worker_halos_t *halos, dc_device_data *data,
-                            float *to_array) {
+                            float *to_p, float *to_q) {
   const size_t radius = STENCIL;
 
   for (int dx = -1; dx <= 1; dx++) {
@@ -667,7 +747,7 @@ void dc_worker_insert_halos(const dc_process_t *process,
         }
 
         size_t face_index = 9 * (dz + 1) + 3 * (dy + 1) + dx + 1;
-        if (process->neighbours[face_index] == MPI_PROC_NULL) {
+        if (!dc_halo_region_messaged(process, face_index)) {
           continue;
         }
         float *halo_buffer = halos->halo_data[face_index];
@@ -711,8 +791,25 @@ void dc_worker_insert_halos(const dc_process_t *process,
         }
 
         dc_device_insert_halo_face(data, halo_buffer, recv_starts, recv_ends,
-                                   process->sizes, to_array);
+                                   process->sizes, to_p);
+        dc_device_insert_halo_face(data,
+                                   halo_buffer + halos->halo_sizes[face_index],
+                                   recv_starts, recv_ends, process->sizes,
+                                   to_q);
       }
     }
   }
 }
+
+void dc_log_halo_stats(const dc_process_t *process) {
+  const dc_halo_stats_t *stats = &process->halo_stats;
+  double iterations = process->iterations > 0 ? process->iterations : 1;
+  dc_log_info(process->rank,
+              "Halo exchange: sent %zu messages (%zu bytes), received %zu "
+              "messages (%zu bytes), %.1f messages per iteration, %zu bytes "
+              "copied from node shared memory, %lf s in exchange calls",
+              stats->messages_sent, stats->bytes_sent,
+              stats->messages_received, stats->bytes_received,
+              (stats->messages_sent + stats->messages_received) / iterations,
+              stats->bytes_shared, stats->seconds);
+}
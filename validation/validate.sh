@@ -3,20 +3,20 @@
 USE_SEQUENTIAL="true"
 USE_DISTRIBUTED="true"
 
-CUBE_SIZE_X=100
-CUBE_SIZE_Y=100
-CUBE_SIZE_Z=100
-NUM_ITERATIONS=6
+CUBE_SIZE=100
+ABSORPTION=2
+TIME_MAX=1e-4
 NUM_PROCESSES=8
-STENCIL_SIZE=3
+TOLERANCE=1e-06
+ARGS="--size-x=$CUBE_SIZE --size-y=$CUBE_SIZE --size-z=$CUBE_SIZE --absorption=$ABSORPTION --dx=1e-1 --dy=1e-1 --dz=1e-1 --dt=1e-6 --time-max=$TIME_MAX"
 
-make all
+make -C .. all
 if [[ "$USE_DISTRIBUTED" == "true" ]]; then
-  mpirun --map-by :OVERSUBSCRIBE -np $NUM_PROCESSES ../bin/distributed-cube-average $CUBE_SIZE_X $CUBE_SIZE_Y $CUBE_SIZE_Z $NUM_ITERATIONS $STENCIL_SIZE ./predicted.dc
+  mpirun --map-by :OVERSUBSCRIBE -np $NUM_PROCESSES ../bin/dc $ARGS --output-file=./predicted.dc
 fi
 if [[ "$USE_SEQUENTIAL" == "true" ]]; then
-  mpirun --map-by :OVERSUBSCRIBE -np 1 ../bin/distributed-cube-average $CUBE_SIZE_X $CUBE_SIZE_Y $CUBE_SIZE_Z $NUM_ITERATIONS $STENCIL_SIZE ./ground_truth.dc
+  mpirun --map-by :OVERSUBSCRIBE -np 1 ../bin/dc $ARGS --output-file=./ground_truth.dc
 fi
 if [[ "$USE_SEQUENTIAL" == "true" && "$USE_DISTRIBUTED" == "true" ]]; then
-  Rscript CompareResults.R
+  ../bin/dc-compare --tolerance=$TOLERANCE ./ground_truth.dc ./predicted.dc
 fi